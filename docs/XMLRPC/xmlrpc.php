@@ -83,6 +83,15 @@ class AnopeXMLRPC
 	{
 		return $this->RunXMLRPC("user", array($User));
 	}
+
+	/* List registered nicks or channels matching a pattern, in name order
+	 * Returns an array of names; if there are more, "next" holds the name to pass
+	 * as $After to continue the list
+	 */
+	function DoList($Type, $Pattern = "*", $After = "", $Max = 50)
+	{
+		return $this->RunXMLRPC("list", array($Type, $Pattern, $After, $Max));
+	}
 }
 
 $anopexmlrpc = new AnopeXMLRPC("http://127.0.0.1:8080/xmlrpc");
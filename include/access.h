@@ -35,6 +35,8 @@ struct CoreExport Privilege
 	Anope::string desc;
 	/* Rank relative to other privileges */
 	int rank;
+	/* Position in order of rank, assigned by the PrivilegeManager */
+	unsigned index;
 
 	Privilege(const Anope::string &name, const Anope::string &desc, int rank);
 	bool operator==(const Privilege &other) const;
@@ -43,12 +45,63 @@ struct CoreExport Privilege
 class CoreExport PrivilegeManager
 {
 	static std::vector<Privilege> Privileges;
+	/* Privilege names to their index */
+	static Anope::hash_map<unsigned> PrivilegesByName;
+	static unsigned Generation;
+
+	static void Reindex();
  public:
 	static void AddPrivilege(Privilege p);
 	static void RemovePrivilege(Privilege &p);
 	static Privilege *FindPrivilege(const Anope::string &name);
 	static std::vector<Privilege> &GetPrivileges();
 	static void ClearPrivileges();
+
+	/** Get a number which changes whenever privileges are added or removed,
+	 * and so whenever privilege indexes may have changed
+	 */
+	static unsigned GetGeneration();
+};
+
+/* A set of privileges, by Privilege::index. As privileges are indexed in
+ * order of rank, sets can be compared by rank with a few word operations.
+ */
+class CoreExport PrivilegeSet
+{
+	std::vector<unsigned long> bits;
+
+	static const unsigned BITS = sizeof(unsigned long) * 8;
+
+ public:
+	void Clear()
+	{
+		this->bits.clear();
+	}
+
+	void Set(unsigned i)
+	{
+		if (i / BITS >= this->bits.size())
+			this->bits.resize(i / BITS + 1);
+		this->bits[i / BITS] |= 1UL << (i % BITS);
+	}
+
+	bool Has(unsigned i) const
+	{
+		return i / BITS < this->bits.size() && (this->bits[i / BITS] >> (i % BITS)) & 1;
+	}
+
+	PrivilegeSet &operator|=(const PrivilegeSet &other);
+
+	/** Get the highest ranked privilege in this set
+	 * @return Its index, or -1 if the set is empty
+	 */
+	int Highest() const;
+
+	/** Compare two sets by the highest ranked privilege in either of them
+	 * @return 1 if only this set has it, -1 if only other has it, and 0 if
+	 * both have it or both sets are empty
+	 */
+	int Compare(const PrivilegeSet &other) const;
 };
 
 /* A provider of access. Only used for creating ChanAccesses, as
@@ -74,6 +127,11 @@ class CoreExport AccessProvider : public Service
 /* Represents one entry of an access list on a channel. */
 class CoreExport ChanAccess : public Serializable
 {
+	/* The privileges this entry has, and what they were computed from */
+	mutable PrivilegeSet privileges;
+	mutable bool privileges_valid;
+	mutable unsigned privileges_generation, privileges_levels;
+
  public:
  	/* The provider that created this access entry */
 	AccessProvider *provider;
@@ -103,6 +161,17 @@ class CoreExport ChanAccess : public Serializable
 	 */
 	virtual bool HasPriv(const Anope::string &name) const = 0;
 
+	/** Get every privilege this access entry has. This is computed from
+	 * HasPriv() once and kept until the privileges or the channel's levels
+	 * change, or InvalidatePrivileges() is called.
+	 */
+	const PrivilegeSet &GetPrivileges() const;
+
+	/** Forget the privileges computed for this entry. This must be called
+	 * if the data backing HasPriv() is changed after the entry is in use.
+	 */
+	void InvalidatePrivileges() const;
+
 	/** Serialize the access given by this access entry into a human
 	 * readable form. chanserv/access will return a number, chanserv/xop
 	 * will be AOP, SOP, etc.
@@ -136,6 +205,13 @@ class CoreExport AccessGroup : public std::vector<ChanAccess *>
 
 	AccessGroup();
 
+ private:
+	/* Whether this group has the given privilege, with the entries' combined privileges */
+	bool HasPriv(const Privilege &priv, const PrivilegeSet &entries) const;
+	/* Compare two groups by the highest ranked privilege either of them has */
+	int Compare(const AccessGroup &other) const;
+
+ public:
 	/** Check if this access group has a certain privilege. Eg, it
 	 * will check every ChanAccess entry of this group for any that
 	 * has the given privilege.
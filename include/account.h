@@ -21,8 +21,11 @@
 
 typedef Anope::hash_map<NickAlias *> nickalias_map;
 typedef Anope::hash_map<NickCore *> nickcore_map;
+typedef Anope::map<NickAlias *> ordered_nickalias_map;
 
 extern CoreExport Serialize::Checker<nickalias_map> NickAliasList;
+/* The same nicks as NickAliasList, kept sorted by name for listing */
+extern CoreExport Serialize::Checker<ordered_nickalias_map> OrderedNickAliasList;
 extern CoreExport Serialize::Checker<nickcore_map> NickCoreList;
 
 /* A registered nickname.
@@ -149,6 +152,9 @@ class CoreExport NickCore : public Serializable, public Extensible
 {
 	/* Channels which reference this core in some way (this is on their access list, akick list, is founder, successor, etc) */
 	Serialize::Checker<std::map<ChannelInfo *, int> > chanaccess;
+	/* Access and akick entries for this account, by channel */
+	Serialize::Checker<std::multimap<ChannelInfo *, ChanAccess *> > access_refs;
+	Serialize::Checker<std::multimap<ChannelInfo *, AutoKick *> > akick_refs;
  public:
  	/* Name of the account. Find(display)->nc == this. */
 	Anope::string display;
@@ -303,6 +309,38 @@ class CoreExport NickCore : public Serializable, public Extensible
 	void AddChannelReference(ChannelInfo *ci);
 	void RemoveChannelReference(ChannelInfo *ci);
 	void GetChannelReferences(std::deque<ChannelInfo *> &queue);
+
+	/** Add an access entry for this account, this also adds a reference to its channel
+	 * @param entry The access entry
+	 */
+	void AddAccessReference(ChanAccess *entry);
+
+	/** Remove an access entry for this account and the reference to its channel
+	 * @param entry The access entry
+	 */
+	void RemoveAccessReference(ChanAccess *entry);
+
+	/** Get the access entries for this account on a channel
+	 * @param ci The channel
+	 * @param entries Filled with the access entries
+	 */
+	void GetAccessReferences(ChannelInfo *ci, std::vector<ChanAccess *> &entries);
+
+	/** Add an akick for this account, this also adds a reference to its channel
+	 * @param akick The akick
+	 */
+	void AddAkickReference(AutoKick *akick);
+
+	/** Remove an akick for this account and the reference to its channel
+	 * @param akick The akick
+	 */
+	void RemoveAkickReference(AutoKick *akick);
+
+	/** Get the akicks for this account on a channel
+	 * @param ci The channel
+	 * @param entries Filled with the akicks
+	 */
+	void GetAkickReferences(ChannelInfo *ci, std::vector<AutoKick *> &entries);
 };
 
 /* A request to check if an account/password is valid. These can exist for
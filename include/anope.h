@@ -79,6 +79,11 @@ namespace Anope
 		inline bool equals_ci(const std::string &_str) const { return ci::string(this->_string.c_str()) == _str.c_str(); }
 		inline bool equals_ci(const string &_str) const { return ci::string(this->_string.c_str()) == _str._string.c_str(); }
 
+		/**
+		 * Check whether the string begins with another, case insensitively.
+		 */
+		inline bool starts_with_ci(const string &_str) const { return this->_string.length() >= _str._string.length() && !ci::ci_char_traits::compare(this->_string.c_str(), _str._string.c_str(), _str._string.length()); }
+
 		/**
 		 * Inequality operators, exact opposites of the above.
 		 */
@@ -332,7 +337,25 @@ namespace Anope
 		}
 	};
 
-	template<typename T> class map : public std::map<string, T, ci::less> { };
+	template<typename T> class map : public std::map<string, T, ci::less>
+	{
+	 public:
+		typedef typename std::map<string, T, ci::less>::const_iterator const_iterator;
+
+		/** Finds the first entry whose key may start with prefix. Keys up to and
+		 * including after are skipped, so a listing can be resumed from the last
+		 * key it returned. Keys starting with prefix follow on from here, until
+		 * the first one which does not.
+		 * @param prefix The prefix, eg from LiteralPrefix()
+		 * @param after The key to resume after, if any
+		 */
+		const_iterator lower_bound_prefix(const string &prefix, const string &after = "") const
+		{
+			if (!after.empty() && !ci::less()(after, prefix))
+				return this->upper_bound(after);
+			return this->lower_bound(prefix);
+		}
+	};
 	template<typename T> class multimap : public std::multimap<string, T, ci::less> { };
 	template<typename T> class hash_map : public std::tr1::unordered_map<string, T, hash_ci, compare> { };
 
@@ -428,6 +451,13 @@ namespace Anope
 	 */
 	extern CoreExport bool Match(const string &str, const string &mask, bool case_sensitive = false, bool use_regex = false);
 
+	/** Find the literal text a pattern starts with. Every string which Match()es
+	 * the pattern starts with this, case insensitively.
+	 * @param mask The pattern (e.g. foo*bar gives foo)
+	 * @param use_regex Whether the pattern will be matched with regex allowed, in which case regex patterns have no prefix
+	 */
+	extern CoreExport string LiteralPrefix(const string &mask, bool use_regex = false);
+
 	/** Converts a string to hex
 	 * @param the data to be converted
 	 * @return a anope::string containing the hex value
@@ -497,6 +527,12 @@ namespace Anope
 	 */
 	extern CoreExport time_t DoTime(const Anope::string &s);
 
+	/** Get the current system time to the microsecond, for timing things that
+	 * are over well within a second
+	 * @return Microseconds since the epoch
+	 */
+	extern CoreExport uint64_t MicroTime();
+
 	/** Retrieves a human readable string representing the time in seconds
 	 * @param seconds The time on seconds, eg 60
 	 * @param nc The account to use langauge settings for to translate this string, if applicable
@@ -16,8 +16,11 @@
 #include "serialize.h"
 
 typedef Anope::hash_map<Channel *> channel_map;
+typedef Anope::map<Channel *> ordered_channel_map;
 
 extern CoreExport channel_map ChannelList;
+/* The same channels as ChannelList, kept sorted by name for listing */
+extern CoreExport ordered_channel_map OrderedChannelList;
 
 /* A user container, there is one of these per user per channel. */
 struct ChanUserContainer : public Extensible
@@ -272,6 +275,15 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	void SetCorrectModes(User *u, bool give_mode, bool check_noop);
 
+	/** Set the correct modes for a batch of users who joined together, eg in a netjoin.
+	 * This is the same as calling SetCorrectModes() for each of them in turn, except that
+	 * the lookups which only depend on the channel are done once for the whole batch.
+	 * @param batch The users
+	 * @param give_modes if true modes may be given to the users
+	 * @param check_noop if true, CI_NOAUTOOP is checked before giving modes
+	 */
+	void SetCorrectModes(const std::vector<User *> &batch, bool give_modes, bool check_noop);
+
 	/** Unbans a user from this channel.
 	 * @param u The user to unban
 	 * @param full Whether or not to match using the user's real host and IP
@@ -291,6 +303,12 @@ class CoreExport Channel : public Base, public Extensible
 	 * @param ts The time the channel was created
 	 */
 	static Channel *FindOrCreate(const Anope::string &name, bool &created, time_t ts = Anope::CurTime);
+
+	/** Finds the channels which have a mode set. List and status modes are not tracked.
+	 * @param mname The mode name, eg SECRET
+	 * @return The channels, which is empty if none have the mode
+	 */
+	static const std::set<Channel *> &FindByMode(const Anope::string &mname);
 };
 
 #endif // CHANNELS_H
@@ -102,6 +102,10 @@ namespace Configuration
 		Anope::string DefLanguage;
 		/* options:timeoutcheck */
 		time_t TimeoutCheck;
+		/* options:burstdefer and options:burstskip, keyed by module name */
+		std::map<Anope::string, BurstPolicy> BurstPolicies;
+		/* options:burstbudget, in milliseconds */
+		unsigned BurstBudget;
 
 		/* either "/msg " or "/" */
 		Anope::string StrictPrivmsg;
@@ -110,6 +110,51 @@ namespace DNS
 	class ReplySocket;
 	class Request;
 
+	/** Statistics about the resolver's cache and queries
+	 */
+	struct Stats
+	{
+		/* The number of answers cached, and roughly how much memory they use */
+		unsigned long cache_entries, cache_bytes;
+		/* Requests answered from the cache, requests which were not, and requests which shared a query already in flight */
+		unsigned long hits, misses, coalesced;
+		/* Answers removed from the cache because they expired, or to keep it within its limits */
+		unsigned long expired, evicted;
+
+		/* The number of buckets in each nameserver's latency histogram */
+		static const int LATENCY_BUCKETS = 8;
+
+		/** The upper bound of each latency histogram bucket in milliseconds, 0 for the last
+		 */
+		static long LatencyBound(int bucket)
+		{
+			static const long bounds[LATENCY_BUCKETS] = { 10, 25, 50, 100, 250, 500, 1000, 0 };
+			return bounds[bucket];
+		}
+
+		/** How an upstream nameserver has been performing
+		 */
+		struct Nameserver
+		{
+			Anope::string addr;
+			/* Smoothed round trip time in milliseconds */
+			long srtt;
+			/* Queries sent to it, answered by it, and given up on */
+			unsigned long queries, answers, timeouts;
+			/* Answers by round trip time */
+			unsigned long latency[LATENCY_BUCKETS];
+
+			Nameserver() : srtt(0), queries(0), answers(0), timeouts(0)
+			{
+				for (int i = 0; i < LATENCY_BUCKETS; ++i)
+					latency[i] = 0;
+			}
+		};
+		std::vector<Nameserver> nameservers;
+
+		Stats() : cache_entries(0), cache_bytes(0), hits(0), misses(0), coalesced(0), expired(0), evicted(0) { }
+	};
+
 	/** DNS manager
 	 */
 	class Manager : public Service
@@ -125,6 +170,8 @@ namespace DNS
 	
 		virtual void UpdateSerial() = 0;
 		virtual uint32_t GetSerial() const = 0;
+
+		virtual Stats GetStats() const = 0;
 	};
 	
 	/** A DNS query.
@@ -7,6 +7,7 @@ enum HTTPError
 	HTTP_FOUND = 302,
 	HTTP_BAD_REQUEST = 400,
 	HTTP_PAGE_NOT_FOUND = 404,
+	HTTP_REQUEST_TOO_LARGE = 413,
 	HTTP_NOT_SUPPORTED = 505
 };
 
@@ -72,16 +73,303 @@ struct HTTPReply
 	}
 };
 
+/* Fields of a query string or form body. They are only split and
+ * decoded the first time any of them are looked at.
+ */
+class HTTPForm
+{
+ public:
+	typedef std::map<Anope::string, Anope::string> map;
+	typedef map::iterator iterator;
+
+ private:
+	Anope::string raw;
+	bool parsed;
+	map fields;
+
+	inline void Parse();
+
+ public:
+	HTTPForm() : parsed(true) { }
+
+	/** Set the encoded form this holds, forgetting any decoded fields
+	 * @param r The form, eg. a=b&c=d
+	 */
+	void Assign(const Anope::string &r)
+	{
+		this->raw = r;
+		this->parsed = r.empty();
+		this->fields.clear();
+	}
+
+	bool empty() { this->Parse(); return this->fields.empty(); }
+	size_t count(const Anope::string &name) { this->Parse(); return this->fields.count(name); }
+	Anope::string &operator[](const Anope::string &name) { this->Parse(); return this->fields[name]; }
+	iterator begin() { this->Parse(); return this->fields.begin(); }
+	iterator end() { this->Parse(); return this->fields.end(); }
+};
+
 /* A message from soneone */
 struct HTTPMessage
 {
 	std::map<Anope::string, Anope::string> headers;
 	std::map<Anope::string, Anope::string> cookies;
-	std::map<Anope::string, Anope::string> get_data;
-	std::map<Anope::string, Anope::string> post_data;
+	HTTPForm get_data;
+	HTTPForm post_data;
 	Anope::string content;
 };
 
+/** An incremental parser for HTTP requests. Data is fed to it in whatever
+ * pieces it arrives in, and only the current line and the body are copied.
+ * It has no dependency on sockets, so it may be driven by anything.
+ */
+class HTTPParser
+{
+ public:
+	enum State
+	{
+		/* Waiting for the request line */
+		STATE_REQUEST,
+		/* Reading headers */
+		STATE_HEADERS,
+		/* Reading the body */
+		STATE_BODY,
+		/* A whole request has been read */
+		STATE_DONE,
+		/* The request is malformed or too large */
+		STATE_ERROR
+	};
+
+ private:
+	State state;
+	size_t max_header_size, max_body_size;
+	/* Bytes of request line and headers read so far */
+	size_t header_size;
+	unsigned content_length;
+	Anope::string line, body;
+
+	Anope::string method, target, version;
+	bool keepalive;
+	HTTPMessage message;
+
+	HTTPError error;
+	Anope::string error_message;
+
+	void Fail(HTTPError err, const Anope::string &msg)
+	{
+		this->state = STATE_ERROR;
+		this->error = err;
+		this->error_message = msg;
+	}
+
+	void Finish()
+	{
+		this->message.content = this->body;
+		this->message.post_data.Assign(this->body);
+		this->state = STATE_DONE;
+	}
+
+	void ParseRequestLine()
+	{
+		/* Blank lines may come before the request line */
+		if (this->line.empty())
+			return;
+
+		std::vector<Anope::string> params;
+		spacesepstream(this->line).GetTokens(params);
+
+		if (params.empty() || (params[0] != "GET" && params[0] != "POST"))
+		{
+			this->Fail(HTTP_BAD_REQUEST, "Unknown operation");
+			return;
+		}
+
+		if (params.size() != 3)
+		{
+			this->Fail(HTTP_BAD_REQUEST, "Invalid parameters");
+			return;
+		}
+
+		this->method = params[0];
+		this->version = params[2];
+		/* HTTP/1.1 connections persist unless asked otherwise, older ones must ask to */
+		this->keepalive = this->version == "HTTP/1.1";
+
+		size_t q = params[1].find('?');
+		if (q != Anope::string::npos)
+		{
+			this->target = params[1].substr(0, q);
+			this->message.get_data.Assign(params[1].substr(q + 1));
+		}
+		else
+			this->target = params[1];
+
+		this->state = STATE_HEADERS;
+	}
+
+	void ParseHeader()
+	{
+		if (this->line.empty())
+		{
+			if (this->content_length > this->max_body_size)
+				this->Fail(HTTP_REQUEST_TOO_LARGE, "Request body too large");
+			else if (!this->content_length)
+				this->Finish();
+			else
+				this->state = STATE_BODY;
+			return;
+		}
+
+		size_t sz = this->line.find(':');
+		if (sz == Anope::string::npos || !sz)
+			return;
+
+		Anope::string name = this->line.substr(0, sz), value = this->line.substr(sz + 1);
+		value.trim();
+
+		if (name.equals_ci("Content-Length"))
+		{
+			try
+			{
+				this->content_length = convertTo<unsigned>(value);
+			}
+			catch (const ConvertException &)
+			{
+				this->Fail(HTTP_BAD_REQUEST, "Invalid Content-Length");
+			}
+		}
+		else if (name.equals_ci("Connection"))
+		{
+			commasepstream sep(value);
+			Anope::string token;
+
+			while (sep.GetToken(token))
+			{
+				token.trim();
+				if (token.equals_ci("close"))
+					this->keepalive = false;
+				else if (token.equals_ci("keep-alive"))
+					this->keepalive = true;
+			}
+		}
+		else if (name.equals_ci("Cookie"))
+		{
+			spacesepstream sep(value);
+			Anope::string token;
+
+			while (sep.GetToken(token))
+			{
+				sz = token.find('=');
+				if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
+					continue;
+				size_t end = token.length() - (sz + 1);
+				if (!sep.StreamEnd())
+					--end; // Remove trailing ;
+				this->message.cookies[token.substr(0, sz)] = token.substr(sz + 1, end);
+			}
+		}
+		else if (!value.empty())
+			this->message.headers[name] = value;
+	}
+
+ public:
+	/** Constructor
+	 * @param header_max The most bytes of request line and headers to accept
+	 * @param body_max The largest body to accept
+	 */
+	HTTPParser(size_t header_max, size_t body_max) : max_header_size(header_max), max_body_size(body_max)
+	{
+		this->Reset();
+	}
+
+	/** Forget the current request, ready to read the next one */
+	void Reset()
+	{
+		this->state = STATE_REQUEST;
+		this->header_size = 0;
+		this->content_length = 0;
+		this->line.clear();
+		this->body.clear();
+		this->method.clear();
+		this->target.clear();
+		this->version.clear();
+		this->keepalive = false;
+		this->message = HTTPMessage();
+		this->error = HTTP_ERROR_OK;
+		this->error_message.clear();
+	}
+
+	/** Parse some data. Parsing stops at the end of a request, so that the
+	 * data of a request pipelined after it is left for once this one has
+	 * been dealt with and the parser Reset().
+	 * @param data The data
+	 * @param len The length of data
+	 * @return How many bytes of data were used
+	 */
+	size_t Feed(const char *data, size_t len)
+	{
+		size_t pos = 0;
+
+		while (pos < len && (this->state == STATE_REQUEST || this->state == STATE_HEADERS || this->state == STATE_BODY))
+		{
+			if (this->state == STATE_BODY)
+			{
+				size_t want = std::min(static_cast<size_t>(this->content_length) - this->body.length(), len - pos);
+				this->body.append(data + pos, want);
+				pos += want;
+
+				if (this->body.length() == this->content_length)
+					this->Finish();
+				continue;
+			}
+
+			const char *nl = static_cast<const char *>(memchr(data + pos, '\n', len - pos));
+			size_t n = nl ? nl - (data + pos) : len - pos;
+
+			this->header_size += n;
+			if (this->header_size > this->max_header_size)
+			{
+				this->Fail(HTTP_BAD_REQUEST, "Request header too large");
+				break;
+			}
+
+			this->line.append(data + pos, n);
+			pos += n;
+			if (!nl)
+				break;
+			++pos;
+
+			if (!this->line.empty() && this->line[this->line.length() - 1] == '\r')
+				this->line.erase(this->line.length() - 1);
+
+			if (this->state == STATE_REQUEST)
+				this->ParseRequestLine();
+			else
+				this->ParseHeader();
+			this->line.clear();
+		}
+
+		return pos;
+	}
+
+	State GetState() const { return this->state; }
+
+	/** Whether nothing of a request has been read yet */
+	bool IsEmpty() const { return this->state == STATE_REQUEST && !this->header_size; }
+
+	HTTPError GetError() const { return this->error; }
+	const Anope::string &GetErrorMessage() const { return this->error_message; }
+
+	const Anope::string &GetMethod() const { return this->method; }
+	const Anope::string &GetTarget() const { return this->target; }
+	const Anope::string &GetVersion() const { return this->version; }
+
+	/** Whether the client wants the connection kept open after this request */
+	bool KeepAlive() const { return this->keepalive; }
+
+	HTTPMessage &GetMessage() { return this->message; }
+};
+
 class HTTPClient;
 class HTTPProvider;
 
@@ -223,4 +511,22 @@ namespace HTTPUtils
 	}
 }
 
+void HTTPForm::Parse()
+{
+	if (this->parsed)
+		return;
+	this->parsed = true;
+
+	sepstream sep(this->raw, '&');
+	Anope::string token;
+
+	while (sep.GetToken(token))
+	{
+		size_t sz = token.find('=');
+		if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
+			continue;
+		this->fields[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
+	}
+}
+
 #endif // ANOPE_HTTPD_H
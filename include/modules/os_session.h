@@ -42,6 +42,10 @@ class SessionService : public Service
 
 	virtual ExceptionVector &GetExceptions() = 0;
 
+	/** Called when an exception already in the list has been modified, eg its mask
+	 */
+	virtual void ExceptionsChanged() = 0;
+
 	virtual Session *FindSession(const Anope::string &ip) = 0;
 
 	virtual SessionMap &GetSessions() = 0;
@@ -78,6 +82,8 @@ Serializable* Exception::Unserialize(Serializable *obj, Serialize::Data &data)
 
 	if (!obj)
 		session_service->AddException(ex);
+	else
+		session_service->ExceptionsChanged();
 	return ex;
 }
 
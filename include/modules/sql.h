@@ -93,18 +93,30 @@ namespace SQL
 		bool escape;
 	};
 
+	/** Gives the text put in place of each parameter of a query by Query::Substitute
+	 */
+	struct Substitution
+	{
+		virtual ~Substitution() { }
+
+		virtual Anope::string Replace(const Anope::string &name, const QueryData &data) = 0;
+	};
+
 	struct Query
 	{
 		Anope::string query;
 		std::map<Anope::string, QueryData> parameters;
+		/* Set if this query was returned from Provider::Prepare */
+		bool prepared;
 
-		Query() { }
-		Query(const Anope::string &q) : query(q) { }
+		Query() : prepared(false) { }
+		Query(const Anope::string &q) : query(q), prepared(false) { }
 
 		Query& operator=(const Anope::string &q)
 		{
 			this->query = q;
 			this->parameters.clear();
+			this->prepared = false;
 			return *this;
 		}
 
@@ -128,6 +140,37 @@ namespace SQL
 			}
 			catch (const ConvertException &ex) { }
 		}
+
+		/** Rewrites the text of this query in one pass, replacing each @name@ which is
+		 * one of its parameters with what sub.Replace(name, data) returns. Other text,
+		 * including @s which are not around a parameter, is copied as is.
+		 */
+		CoreExport Anope::string Substitute(Substitution &sub) const;
+	};
+
+	/** For Query::Substitute, builds the text to send to the server, quoting
+	 * and escaping the parameters to be escaped with escaper->Escape()
+	 */
+	template<typename T> struct Quote : Substitution
+	{
+		T *escaper;
+
+		Quote(T *e) : escaper(e) { }
+
+		Anope::string Replace(const Anope::string &, const QueryData &qd) anope_override
+		{
+			return qd.escape ? "'" + this->escaper->Escape(qd.data) + "'" : qd.data;
+		}
+	};
+
+	/** For Query::Substitute, builds the text of a prepared statement, with a ?
+	 * in place of each parameter, remembering the order the parameters are bound in
+	 */
+	struct CoreExport Placeholders : Substitution
+	{
+		std::vector<Anope::string> names;
+
+		Anope::string Replace(const Anope::string &name, const QueryData &) anope_override;
 	};
 
 	/** A result from a SQL query
@@ -183,13 +226,39 @@ namespace SQL
 	class Interface
 	{
 	 public:
+		/* The order queued queries are run in, for providers which queue them */
+		enum Priority
+		{
+			PRIORITY_HIGH,
+			PRIORITY_NORMAL,
+			PRIORITY_LOW,
+			PRIORITY_SIZE
+		};
+
 		Module *owner;
+		/* Fixed, so that the requests of an interface all wait in the same queue */
+		const Priority priority;
 
-		Interface(Module *m) : owner(m) { }
+		Interface(Module *m, Priority p = PRIORITY_NORMAL) : owner(m), priority(p) { }
 		virtual ~Interface() { }
 
 		virtual void OnResult(const Result &r) = 0;
 		virtual void OnError(const Result &r) = 0;
+
+		/** Called with the results of queries run in a transaction by Provider::Run.
+		 * The transaction was committed if none of them has an error. By default each
+		 * result is passed on to OnResult or OnError.
+		 */
+		virtual void OnResults(const std::vector<Result> &results)
+		{
+			for (unsigned i = 0; i < results.size(); ++i)
+			{
+				if (results[i].GetError().empty())
+					this->OnResult(results[i]);
+				else
+					this->OnError(results[i]);
+			}
+		}
 	};
 
 	/** Class providing the SQL service, modules call this to execute queries
@@ -201,16 +270,108 @@ namespace SQL
 
 		virtual void Run(Interface *i, const Query &query) = 0;
 
+		/** Runs the queries in order in a single transaction. If one fails
+		 * the transaction is rolled back and the remaining queries are not run.
+		 * The interface is given the results with Interface::OnResults.
+		 */
+		virtual void Run(Interface *i, const std::vector<Query> &queries) = 0;
+
 		virtual Result RunQuery(const Query &query) = 0;
 
+		/** Synchronous version of Run(Interface *, const std::vector<Query> &)
+		 * @return The results of the queries which were run
+		 */
+		virtual std::vector<Result> RunQuery(const std::vector<Query> &queries) = 0;
+
+		/** Waits until the queries a module has queued with Run() have been run,
+		 * so that a query it then runs with RunQuery() is run after them. Providers
+		 * which run queries as soon as they are given them have nothing to do.
+		 * @param m The module
+		 */
+		virtual void Wait(Module *m) { }
+
 		virtual std::vector<Query> CreateTable(const Anope::string &table, const Data &data) = 0;
 
 		virtual Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) = 0;
 
+		/** Builds a single query inserting or updating many rows at once.
+		 * @param table The table
+		 * @param rows The rows to write, keyed by id. Each id must be non zero
+		 */
+		virtual Query BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows) = 0;
+
+		/** Prepares a query. The provider compiles the query once and reuses
+		 * it every time a query with the same text is run, only binding the new
+		 * parameters. Unescaped parameters can not be bound, so queries using
+		 * them are run normally.
+		 * @return The query to use as a handle to the prepared statement
+		 */
+		virtual Query Prepare(const Query &query) = 0;
+
 		virtual Query GetTables(const Anope::string &prefix) = 0;
 
 		virtual Anope::string FromUnixtime(time_t) = 0;
 	};
 
+	/** Builds the common part of a query writing many rows at once,
+	 * "command INTO `table` (`id`,...) VALUES (...),(...)", for providers
+	 * to add their own handling of existing rows to.
+	 * @param command The command, eg INSERT
+	 * @param table The table
+	 * @param columns The columns the table is known to have, on return the
+	 * columns written, other than id. Columns missing from a row are emptied.
+	 * @param rows The rows to write, keyed by id
+	 */
+	extern CoreExport Query BuildRows(const Anope::string &command, const Anope::string &table, std::set<Anope::string> &columns, const std::map<unsigned int, Data *> &rows);
+
+	/** Writes objects which already have an id to their tables, many rows per
+	 * query and one transaction per table. Objects are only marked as committed
+	 * once their transaction has succeeded, if it fails they are marked dirty
+	 * again so that they are written next time.
+	 */
+	class CoreExport BatchWriter : public Interface
+	{
+		struct Row
+		{
+			Reference<Serializable> obj;
+			Data *data;
+
+			Row(Serializable *o, Data *d) : obj(o), data(d) { }
+		};
+
+		/* Rows to write by table and id */
+		std::map<Anope::string, std::map<unsigned int, Row> > tables;
+		/* Rows of the transactions queued with Provider::Run, oldest first. The
+		 * results of an interface's queries come back in the order they were queued.
+		 */
+		std::deque<std::vector<Row> > pending;
+
+		/* Updates the cache of the rows' objects if the results show their transaction was committed, else marks them dirty */
+		void Finish(std::vector<Row> &rows, const std::vector<Result> &results);
+
+	 public:
+		BatchWriter(Module *m) : Interface(m) { }
+
+		~BatchWriter();
+
+		/** Adds an object to be written by the next Write()
+		 * @param table The table
+		 * @param obj The object, which must have an id
+		 * @param data The serialized object, which is deleted by the writer
+		 */
+		void Add(const Anope::string &table, Serializable *obj, Data *data);
+
+		/** Writes every object added since the last call
+		 * @param sql The provider
+		 * @param background Whether to queue the queries with Provider::Run, rather than waiting for them
+		 */
+		void Write(Provider *sql, bool background);
+
+		void OnResults(const std::vector<Result> &results) anope_override;
+
+		void OnResult(const Result &) anope_override { }
+
+		void OnError(const Result &r) anope_override;
+	};
 }
 
@@ -67,6 +67,43 @@ class CoreExport OperType
 	/** Set of opertypes we inherit from
 	 */
 	std::set<OperType *> inheritances;
+
+	/** Command or privilege masks compiled for matching. Masks without
+	 * wildcards are hashed, masks which are a literal prefix followed by
+	 * a single * are kept in a trie, and only what is left is matched one
+	 * by one. Recent results are remembered.
+	 */
+	class Matcher
+	{
+		struct Node
+		{
+			std::map<unsigned char, unsigned> children;
+			/* A mask ends in * here */
+			bool terminal;
+
+			Node() : terminal(false) { }
+		};
+
+		Anope::hash_map<bool> exact;
+		std::vector<Node> trie;
+		std::vector<Anope::string> wildcards;
+		Anope::hash_map<bool> memo;
+
+		bool Search(const Anope::string &str) const;
+
+	 public:
+		void Compile(const std::list<Anope::string> &masks);
+		bool Matches(const Anope::string &str);
+	};
+
+	mutable Matcher command_matcher, priv_matcher;
+	/* The generation the matchers were compiled at */
+	mutable unsigned compiled;
+
+	/* Changed whenever any opertype's commands, privs, or inheritances change */
+	static unsigned generation;
+
+	void Compile() const;
  public:
  	/** Modes to set when someone identifys using this opertype
 	 */
@@ -19,8 +19,13 @@
 #include "bots.h"
 
 typedef Anope::hash_map<ChannelInfo *> registered_channel_map;
+typedef Anope::map<ChannelInfo *> ordered_registered_channel_map;
 
 extern CoreExport Serialize::Checker<registered_channel_map> RegisteredChannelList;
+/* The same channels as RegisteredChannelList, kept sorted by name for listing */
+extern CoreExport Serialize::Checker<ordered_registered_channel_map> OrderedRegisteredChannelList;
+
+class AutoKickMatcher;
 
 /* Indices for TTB (Times To Ban) */
 enum
@@ -74,6 +79,8 @@ class CoreExport AutoKick : public Serializable
 
 	Anope::string mask;
 	Serialize::Reference<NickCore> nc;
+	/* Parsed mask, NULL if this is an account akick */
+	Entry *entry;
 
 	Anope::string reason;
 	Anope::string creator;
@@ -84,6 +91,12 @@ class CoreExport AutoKick : public Serializable
 	~AutoKick();
 	void Serialize(Serialize::Data &data) const anope_override;
 	static Serializable* Unserialize(Serializable *obj, Serialize::Data &);
+
+	/** Check if this akick matches a user
+	 * @param u The user
+	 * @return true on match
+	 */
+	bool Matches(User *u) const;
 };
 
 struct CoreExport ModeLock : Serializable
@@ -163,7 +176,10 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	Serialize::Checker<std::vector<ChanAccess *> > access;			/* List of authorized users */
 	Serialize::Checker<std::vector<AutoKick *> > akick;			/* List of users to kickban */
 	Serialize::Checker<std::vector<BadWord *> > badwords;			/* List of badwords */
+	unsigned badwords_version;						/* Changed whenever the badwords change */
 	Anope::map<int16_t> levels;
+	unsigned levels_version;						/* Changed whenever the levels change */
+	AutoKickMatcher *akick_matcher;						/* Index of the akick list */
 
  public:
  	friend class ChanAccess;
@@ -301,6 +317,12 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	 */
 	unsigned GetAkickCount() const;
 
+	/** Find the first entry on the channel akick list matching a user
+	 * @param u The user
+	 * @return The akick, or NULL if none match
+	 */
+	AutoKick* MatchAkick(User *u);
+
 	/** Erase an entry from the channel akick list
 	 * @param index The index of the akick
 	 */
@@ -337,6 +359,12 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	 */
 	void ClearBadWords();
 
+	/** Get a number which changes whenever a badword is added, removed or
+	 * updated, so anything built from the badword list knows to rebuild it
+	 * @return The version of the badword list
+	 */
+	unsigned GetBadWordVersion() const;
+
 	/** Check if a mode is mlocked
 	 * @param mode The mode
 	 * @param An optional param
@@ -432,6 +460,12 @@ class CoreExport ChannelInfo : public Serializable, public Extensible
 	 */
 	void ClearLevels();
 
+	/** Get a number which changes whenever a level is set or removed, so
+	 * access entries know to recompute their privileges
+	 * @return The version of the levels
+	 */
+	unsigned GetLevelsVersion() const;
+
 	/** Gets a ban mask for the given user based on the bantype
 	 * of the channel.
 	 * @param u The user
@@ -42,6 +42,9 @@ namespace Serialize
 	extern void RegisterTypes();
 	extern void CheckTypes();
 
+	/* Set while the databases are being loaded, objects are not placed in the dirty sets then */
+	extern CoreExport bool Loading;
+
 	class Type;
 	template<typename T> class Checker;
 	template<typename T> class Reference;
@@ -53,6 +56,8 @@ namespace Serialize
  */
 class CoreExport Serializable : public virtual Base
 {
+	friend class Serialize::Type;
+
  private:
 	/* A list of every serializable item in Anope.
 	 * Some of these are static and constructed at runtime,
@@ -69,6 +74,10 @@ class CoreExport Serializable : public virtual Base
 	size_t last_commit;
 	/* The last time this object was commited to the database */
 	time_t last_commit_time;
+	/* Whether this object has been modified since it was last cleared by a database module */
+	bool dirty;
+	/* Bumped every time this object is marked as modified */
+	unsigned int generation;
 
  protected:
  	Serializable(const Anope::string &serialize_type);
@@ -86,6 +95,24 @@ class CoreExport Serializable : public virtual Base
 	 */
 	void QueueUpdate();
 
+	/** Marks the object as modified, bumping its generation and placing it in its
+	 * type's dirty set if a database module is tracking them and no database is loading.
+	 */
+	void MarkDirty();
+
+	/** Removes the object from its type's dirty set, used by database
+	 * modules once the object has been committed.
+	 */
+	void ClearDirty();
+
+	bool IsDirty() const { return this->dirty; }
+
+	/** Get the generation of this object. The generation changes every
+	 * time the object is marked as modified, so database modules can
+	 * compare it to the generation they last committed.
+	 */
+	unsigned int GetGeneration() const { return this->generation; }
+
 	bool IsCached(Serialize::Data &);
 	void UpdateCache(Serialize::Data &);
 
@@ -108,6 +135,8 @@ class CoreExport Serializable : public virtual Base
  */
 class CoreExport Serialize::Type
 {
+	friend class ::Serializable;
+
 	typedef Serializable* (*unserialize_func)(Serializable *obj, Serialize::Data &);
 
 	static std::vector<Anope::string> TypeOrder;
@@ -127,6 +156,11 @@ class CoreExport Serialize::Type
 	 */
 	time_t timestamp;
 
+	/* Objects of this type that have been modified since the last ClearDirty() */
+	std::set<Serializable *> dirty;
+	/* How many database modules are consuming the dirty sets */
+	static unsigned trackers;
+
  public:
  	/* Map of Serializable::id to Serializable objects */
 	std::map<unsigned int, Serializable *> objects;
@@ -165,6 +199,26 @@ class CoreExport Serialize::Type
 	 */
 	void UpdateTimestamp();
 
+	/** Gets the objects of this type which have been modified since
+	 * the dirty set was last cleared.
+	 */
+	const std::set<Serializable *> &GetDirty() const { return this->dirty; }
+
+	/** Clears the dirty set of this type.
+	 */
+	void ClearDirty();
+
+	/** Registers or unregisters a consumer of the dirty sets. Objects are only
+	 * placed in their type's dirty set while a consumer is registered, as nothing
+	 * else ever clears them. Unregistering the last consumer clears every set.
+	 * @param track true to register, false to unregister
+	 */
+	static void TrackDirty(bool track);
+
+	/** Check whether any database module is consuming the dirty sets.
+	 */
+	static bool IsTrackingDirty() { return trackers > 0; }
+
 	Module* GetOwner() const { return this->owner; }
 
 	static Serialize::Type *Find(const Anope::string &name);
@@ -85,6 +85,12 @@ class CoreExport Server : public Extensible
  public:
  	/* Number of users on the server */
  	unsigned users;
+	/* Number of users introduced while this server was bursting */
+	unsigned burst_users;
+	/* When this server was introduced, see Anope::MicroTime */
+	uint64_t burst_start;
+	/* How long this server took to sync, in milliseconds */
+	uint64_t burst_time;
 
 	/** Delete this server with a reason
 	 * @param reason The reason
@@ -22,13 +22,29 @@
 #include "account.h"
 
 typedef Anope::hash_map<User *> user_map;
+typedef Anope::map<User *> ordered_user_map;
 
 extern CoreExport user_map UserListByNick, UserListByUID;
+/* The same users as UserListByNick, kept sorted by nick for listing */
+extern CoreExport ordered_user_map OrderedUserList;
 
 extern CoreExport int OperCount;
 extern CoreExport unsigned MaxUserCount;
 extern CoreExport time_t MaxUserTime;
 
+/* What is done with a module's OnUserConnect event for users introduced
+ * while their server is bursting, see options:burstdefer and options:burstskip
+ */
+enum BurstPolicy
+{
+	/* Run it right away, as for any other user */
+	BURST_RUN,
+	/* Queue it and run it once the server is done syncing */
+	BURST_DEFER,
+	/* Do not run it at all */
+	BURST_SKIP
+};
+
 /* Online user and channel data. */
 class CoreExport User : public virtual Base, public Extensible, public CommandReply
 {
@@ -363,6 +379,54 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	/** Quits all users who are pending to be quit
 	 */
 	static void QuitUsers();
+
+	/** Start running the OnUserConnect events that were deferred while servers were
+	 * bursting. They are run a few at a time, see options:burstbudget.
+	 */
+	static void RunDeferredConnects();
+
+	/** Get the number of deferred OnUserConnect events that have not been run yet
+	 */
+	static size_t DeferredConnects();
+};
+
+/** Index of online users on their nick, idents, hosts and IP, used to narrow down
+ * which users a mask can match without walking the whole of UserListByNick.
+ */
+class CoreExport UserIndex
+{
+ public:
+	/** Add a user to the index, or reindex them after their nick, ident or host changed
+	 * @param u The user
+	 */
+	static void Update(User *u);
+
+	/** Remove a user from the index
+	 * @param u The user
+	 */
+	static void Remove(User *u);
+
+	/** Find the users who may match a mask. The nick is compared against the user's nick,
+	 * the ident against their real and virtual ident, and the host against their real,
+	 * virtual and cloaked host and their IP.
+	 * @param nick Nick mask, may be empty
+	 * @param ident Ident mask, may be empty
+	 * @param host Host mask or CIDR range, may be empty
+	 * @param users Filled with the candidates, which still have to be checked against the mask
+	 */
+	static void Find(const Anope::string &nick, const Anope::string &ident, const Anope::string &host, std::set<User *> &users);
+
+	/** Find the users who may match a nick!ident@host mask, which is split up the same way as a ban
+	 * @param mask The mask
+	 * @param users Filled with the candidates, which still have to be checked against the mask
+	 */
+	static void Find(const Anope::string &mask, std::set<User *> &users);
+
+	/** Find the users who have a user mode set
+	 * @param mname The mode name, eg INVIS
+	 * @return The users, which is empty if nobody has the mode
+	 */
+	static const std::set<User *> &FindByMode(const Anope::string &mname);
 };
 
 #endif // USERS_H
@@ -201,7 +201,10 @@ class CommandBSBot : public Command
 		if (!user.empty() && !user.equals_cs(bi->GetIdent()))
 			bi->SetIdent(user);
 		if (!host.empty() && !host.equals_cs(bi->host))
+		{
 			bi->host = host;
+			UserIndex::Update(bi);
+		}
 		if (!real.empty() && !real.equals_cs(bi->realname))
 			bi->realname = real;
 
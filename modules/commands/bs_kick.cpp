@@ -607,7 +607,6 @@ struct BanData : ExtensibleItem
 {
 	struct Data
 	{
-		Anope::string mask;
 		time_t last_use;
 		int16_t ttb[TTB_SIZE];
 
@@ -639,18 +638,13 @@ struct BanData : ExtensibleItem
 		return this->data_map.empty();
 	}
 
-	void purge()
+	/** Remove the data for a mask if it has not been used since the given time
+	 */
+	void expire(const Anope::string &key, time_t last_use)
 	{
-		time_t keepdata = Config->GetModule(me)->Get<time_t>("keepdata");
-		for (data_type::iterator it = data_map.begin(), it_end = data_map.end(); it != it_end;)
-		{
-			const Anope::string &user = it->first;
-			Data &bd = it->second;
-			++it;
-
-			if (Anope::CurTime - bd.last_use > keepdata)
-				data_map.erase(user);
-		}
+		data_type::iterator it = this->data_map.find(key);
+		if (it != this->data_map.end() && it->second.last_use == last_use)
+			this->data_map.erase(it);
 	}
 };
 
@@ -663,46 +657,360 @@ struct UserData : ExtensibleItem
 
 	void Clear()
 	{
-		last_use = last_start = Anope::CurTime;
-		lines = times = 0;
-		lastline.clear();
+		window_start = Anope::CurTime;
+		lines = prev_lines = times = 0;
+		lastline = lasttarget = 0;
 	}
 
-	/* Data validity */
-	time_t last_use;
-
-	/* for flood kicker */
-	int16_t lines;
-	time_t last_start;
+	/* for flood kicker, the lines sent in the current floodsecs long window and the one before it */
+	time_t window_start;
+	int16_t lines, prev_lines;
 
 	/* for repeat kicker */
-	Anope::string lasttarget;
 	int16_t times;
 
-	Anope::string lastline;
+	/* Hashes of the last line sent and the channel it was sent to, 0 if none */
+	uint64_t lastline, lasttarget;
+
+	/** Hash a line or channel name case insensitively (64 bit FNV-1a)
+	 */
+	static uint64_t Hash(const Anope::string &str)
+	{
+		uint64_t h = 14695981039346656037ULL;
+		for (unsigned i = 0, end = str.length(); i < end; ++i)
+		{
+			h ^= Anope::tolower(str[i]);
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+};
+
+/** What the kickers need to know about a message, gathered in one pass over it
+ */
+struct MessageInfo
+{
+	enum
+	{
+		HAS_BOLDS = 1 << 0,
+		HAS_COLORS = 1 << 1,
+		HAS_REVERSES = 1 << 2,
+		HAS_ITALICS = 1 << 3,
+		HAS_UNDERLINES = 1 << 4
+	};
+
+	/* The control codes found in the message */
+	unsigned flags;
+	/* The number of upper and lower case letters in the message */
+	unsigned upper, lower;
+	/* The message stripped of control and color codes, as Anope::NormalizeBuffer does.
+	 * This is reused between messages so it does not need to be allocated every time.
+	 */
+	Anope::string normalized;
+
+	MessageInfo() : flags(0), upper(0), lower(0) { }
+
+	/** Gathers the information about a message
+	 * @param buf The message
+	 * @param text Whether to also count the letters and build the normalized message,
+	 * only the caps and badwords kickers need those, the rest only need the flags
+	 */
+	void Classify(const Anope::string &buf, bool text)
+	{
+		this->flags = this->upper = this->lower = 0;
+		this->normalized.clear();
+
+		/* c_str() is always terminated, so looking one past a color code is safe */
+		const char *p = buf.c_str();
+		size_t run = 0;
+
+		for (size_t i = 0, end = buf.length(); i < end; ++i)
+		{
+			unsigned char c = p[i];
+
+			/* Printable characters are copied in runs, the common case */
+			if (c > 31)
+			{
+				if (text && isupper(c))
+					++this->upper;
+				else if (text && islower(c))
+					++this->lower;
+				continue;
+			}
+
+			if (text && run < i)
+				this->normalized.str().append(p + run, i - run);
+
+			switch (c)
+			{
+				case 2:
+					this->flags |= HAS_BOLDS;
+					break;
+				case 3:
+					this->flags |= HAS_COLORS;
+
+					/* Strip the foreground and background colors with it, as NormalizeBuffer does */
+					if (isdigit(p[i + 1]))
+					{
+						++i;
+						if (isdigit(p[i + 1]))
+							++i;
+
+						if (p[i + 1] == ',')
+						{
+							++i;
+							if (isdigit(p[i + 1]))
+								++i;
+							if (isdigit(p[i + 1]))
+								++i;
+						}
+					}
+					break;
+				case 22:
+					this->flags |= HAS_REVERSES;
+					break;
+				case 29:
+					this->flags |= HAS_ITALICS;
+					break;
+				case 31:
+					this->flags |= HAS_UNDERLINES;
+					break;
+				case 1:
+				case 10:
+				case 13:
+					break;
+				default:
+					if (text)
+						this->normalized += c;
+			}
+
+			run = i + 1;
+		}
+
+		if (text && run < buf.length())
+			this->normalized.str().append(p + run, buf.length() - run);
+	}
 };
 
+/** All of a channel's bad words compiled in to an Aho-Corasick automaton,
+ * so a message can be checked against every word in one pass
+ */
+struct BadWordMatcher : ExtensibleItem
+{
+	/* The version of the badword list and the case sensitivity this was built for */
+	unsigned version;
+	bool casesensitive;
+
+ private:
+	struct Word
+	{
+		Anope::string word;
+		BadWordType type;
+	};
+	std::vector<Word> words;
+
+	/* The class of each byte in the automaton's alphabet. Class 0 is every byte that
+	 * is in no word, and bytes which are the same once case folded share a class
+	 */
+	unsigned short classes[256];
+	unsigned num_classes;
+
+	/* Transitions for every state and class, num_classes entries per state. State 0 is the root */
+	std::vector<unsigned> next;
+	/* The words, by index, which end at each state */
+	std::vector<std::vector<unsigned> > output;
+	/* The next shorter suffix of each state with output, or 0 */
+	std::vector<unsigned> dict;
+
+	unsigned char Fold(unsigned char c) const
+	{
+		return this->casesensitive ? c : Anope::tolower(c);
+	}
+
+	/* Whether a word found at [start, end) of buf satisfies its type's word boundaries */
+	static bool Bounded(const Anope::string &buf, size_t start, size_t end, BadWordType type)
+	{
+		bool at_start = start == 0 || buf[start - 1] == ' ', at_end = end == buf.length() || buf[end] == ' ';
+
+		switch (type)
+		{
+			case BW_SINGLE:
+				return at_start && at_end;
+			case BW_START:
+				return at_start;
+			case BW_END:
+				return at_end;
+			default:
+				return true;
+		}
+	}
+
+ public:
+	BadWordMatcher(ChannelInfo *ci, bool cs) : version(ci->GetBadWordVersion()), casesensitive(cs), num_classes(1)
+	{
+		for (unsigned i = 0, end = ci->GetBadWordCount(); i < end; ++i)
+		{
+			const BadWord *bw = ci->GetBadWord(i);
+			Word w;
+			w.word = bw->word;
+			w.type = bw->type;
+			this->words.push_back(w);
+		}
+
+		/* Build the alphabet from the folded bytes of every word */
+		unsigned short folded[256];
+		memset(folded, 0, sizeof(folded));
+		for (unsigned i = 0; i < this->words.size(); ++i)
+			for (unsigned j = 0; j < this->words[i].word.length(); ++j)
+			{
+				unsigned char c = this->Fold(this->words[i].word[j]);
+				if (!folded[c])
+					folded[c] = this->num_classes++;
+			}
+		for (unsigned c = 0; c < 256; ++c)
+			this->classes[c] = folded[this->Fold(c)];
+
+		/* Build the trie, ~0 marking missing edges */
+		this->next.resize(this->num_classes, ~0U);
+		this->output.resize(1);
+		for (unsigned i = 0; i < this->words.size(); ++i)
+		{
+			const Anope::string &word = this->words[i].word;
+			if (word.empty())
+				continue;
+
+			unsigned state = 0;
+			for (unsigned j = 0; j < word.length(); ++j)
+			{
+				unsigned &edge = this->next[state * this->num_classes + this->classes[static_cast<unsigned char>(word[j])]];
+				if (edge == ~0U)
+				{
+					edge = this->output.size();
+					this->next.resize(this->next.size() + this->num_classes, ~0U);
+					this->output.resize(this->output.size() + 1);
+				}
+				state = this->next[state * this->num_classes + this->classes[static_cast<unsigned char>(word[j])]];
+			}
+			this->output[state].push_back(i);
+		}
+
+		/* Breadth first, compute the failure links and replace missing edges with
+		 * the edge of the failure state, which turns the trie in to a DFA
+		 */
+		std::vector<unsigned> fail(this->output.size());
+		this->dict.resize(this->output.size());
+		std::deque<unsigned> queue;
+
+		for (unsigned c = 0; c < this->num_classes; ++c)
+		{
+			unsigned &edge = this->next[c];
+			if (edge == ~0U)
+				edge = 0;
+			else
+				queue.push_back(edge);
+		}
+
+		while (!queue.empty())
+		{
+			unsigned state = queue.front();
+			queue.pop_front();
+
+			for (unsigned c = 0; c < this->num_classes; ++c)
+			{
+				unsigned &edge = this->next[state * this->num_classes + c];
+				unsigned fallback = this->next[fail[state] * this->num_classes + c];
+
+				if (edge == ~0U)
+					edge = fallback;
+				else
+				{
+					fail[edge] = fallback;
+					this->dict[edge] = !this->output[fallback].empty() ? fallback : this->dict[fallback];
+					queue.push_back(edge);
+				}
+			}
+		}
+	}
+
+	/** Find the bad word in a message
+	 * @param buf The normalized message
+	 * @return The first word on the badword list found in the message, or NULL
+	 */
+	const Anope::string *Find(const Anope::string &buf) const
+	{
+		unsigned best = this->words.size();
+
+		for (unsigned i = 0, state = 0, end = buf.length(); i < end; ++i)
+		{
+			state = this->next[state * this->num_classes + this->classes[static_cast<unsigned char>(buf[i])]];
+
+			for (unsigned s = state; s; s = this->dict[s])
+				for (unsigned j = 0; j < this->output[s].size(); ++j)
+				{
+					unsigned w = this->output[s][j];
+					if (w < best && Bounded(buf, i + 1 - this->words[w].word.length(), i + 1, this->words[w].type))
+						best = w;
+				}
+
+			/* Nothing earlier on the list can be found */
+			if (best == 0)
+				break;
+		}
+
+		return best < this->words.size() ? &this->words[best].word : NULL;
+	}
+};
 
 class BanDataPurger : public Timer
 {
+	/** A use of the ban data for a mask on a channel, which expires keepdata after it
+	 */
+	struct Use
+	{
+		time_t when;
+		Anope::string channel, mask;
+	};
+	/* In the order they happened, so only the front needs checking */
+	std::deque<Use> uses;
+
  public:
 	BanDataPurger(Module *o) : Timer(o, 300, Anope::CurTime, true) { }
 
+	void Touch(Channel *c, const Anope::string &mask, BanData::Data &bd)
+	{
+		if (bd.last_use == Anope::CurTime)
+			return;
+
+		bd.last_use = Anope::CurTime;
+
+		Use use;
+		use.when = Anope::CurTime;
+		use.channel = c->name;
+		use.mask = mask;
+		this->uses.push_back(use);
+	}
+
 	void Tick(time_t) anope_override
 	{
 		Log(LOG_DEBUG) << "bs_main: Running bandata purger";
 
-		for (channel_map::iterator it = ChannelList.begin(), it_end = ChannelList.end(); it != it_end; ++it)
+		time_t keepdata = Config->GetModule(me)->Get<time_t>("keepdata");
+
+		/* Data used again since is left alone by BanData::expire, its later use is further back in the queue */
+		while (!this->uses.empty() && Anope::CurTime - this->uses.front().when > keepdata)
 		{
-			Channel *c = it->second;
+			const Use &use = this->uses.front();
 
-			BanData *bd = c->GetExt<BanData *>("bs_main_bandata");
+			Channel *c = Channel::Find(use.channel);
+			BanData *bd = c ? c->GetExt<BanData *>("bs_main_bandata") : NULL;
 			if (bd != NULL)
 			{
-				bd->purge();
+				bd->expire(use.mask, use.when);
 				if (bd->empty())
 					c->Shrink("bs_main_bandata");
 			}
+
+			this->uses.pop_front();
 		}
 	}
 };
@@ -723,6 +1031,9 @@ class BSKick : public Module
 
 	BanDataPurger purger;
 
+	/* The message being checked by OnPrivmsg */
+	MessageInfo message;
+
 	BanData::Data &GetBanData(User *u, Channel *c)
 	{
 		BanData *bd = c->GetExt<BanData *>("bs_main_bandata");
@@ -732,7 +1043,10 @@ class BSKick : public Module
 			c->Extend("bs_main_bandata", bd);
 		}
 
-		return bd->get(u->GetMask());
+		const Anope::string &mask = u->GetMask();
+		BanData::Data &data = bd->get(mask);
+		this->purger.Touch(c, mask, data);
+		return data;
 	}
 
 	UserData *GetUserData(User *u, Channel *c)
@@ -815,6 +1129,9 @@ class BSKick : public Module
 				it->second->Shrink("bs_main_userdata");
 			c->Shrink("bs_main_bandata");
 		}
+
+		for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end(); it != it_end; ++it)
+			it->second->Shrink("bs_kick_badwords");
 	}
 
 	void OnPrivmsg(User *u, Channel *c, Anope::string &msg) anope_override
@@ -852,8 +1169,19 @@ class BSKick : public Module
 		if (realbuf.empty())
 			return;
 
+		bool caps = ci->HasExt("BS_KICK_CAPS") && realbuf.length() >= static_cast<unsigned>(ci->capsmin),
+			badwords = ci->HasExt("BS_KICK_BADWORDS") && ci->GetBadWordCount();
+
+		/* Only look at the message if a kicker is going to use what is found */
+		if (caps || badwords)
+			this->message.Classify(realbuf, true);
+		else if (ci->HasExt("BS_KICK_BOLDS") || ci->HasExt("BS_KICK_COLORS") || ci->HasExt("BS_KICK_REVERSES") || ci->HasExt("BS_KICK_ITALICS") || ci->HasExt("BS_KICK_UNDERLINES"))
+			this->message.Classify(realbuf, false);
+		else
+			this->message.flags = 0;
+
 		/* Bolds kicker */
-		if (ci->HasExt("BS_KICK_BOLDS") && realbuf.find(2) != Anope::string::npos)
+		if (ci->HasExt("BS_KICK_BOLDS") && (this->message.flags & MessageInfo::HAS_BOLDS))
 		{
 			check_ban(ci, u, TTB_BOLDS);
 			bot_kick(ci, u, _("Don't use bolds on this channel!"));
@@ -861,7 +1189,7 @@ class BSKick : public Module
 		}
 
 		/* Color kicker */
-		if (ci->HasExt("BS_KICK_COLORS") && realbuf.find(3) != Anope::string::npos)
+		if (ci->HasExt("BS_KICK_COLORS") && (this->message.flags & MessageInfo::HAS_COLORS))
 		{
 			check_ban(ci, u, TTB_COLORS);
 			bot_kick(ci, u, _("Don't use colors on this channel!"));
@@ -869,7 +1197,7 @@ class BSKick : public Module
 		}
 
 		/* Reverses kicker */
-		if (ci->HasExt("BS_KICK_REVERSES") && realbuf.find(22) != Anope::string::npos)
+		if (ci->HasExt("BS_KICK_REVERSES") && (this->message.flags & MessageInfo::HAS_REVERSES))
 		{
 			check_ban(ci, u, TTB_REVERSES);
 			bot_kick(ci, u, _("Don't use reverses on this channel!"));
@@ -877,7 +1205,7 @@ class BSKick : public Module
 		}
 
 		/* Italics kicker */
-		if (ci->HasExt("BS_KICK_ITALICS") && realbuf.find(29) != Anope::string::npos)
+		if (ci->HasExt("BS_KICK_ITALICS") && (this->message.flags & MessageInfo::HAS_ITALICS))
 		{
 			check_ban(ci, u, TTB_ITALICS);
 			bot_kick(ci, u, _("Don't use italics on this channel!"));
@@ -885,7 +1213,7 @@ class BSKick : public Module
 		}
 
 		/* Underlines kicker */
-		if (ci->HasExt("BS_KICK_UNDERLINES") && realbuf.find(31) != Anope::string::npos)
+		if (ci->HasExt("BS_KICK_UNDERLINES") && (this->message.flags & MessageInfo::HAS_UNDERLINES))
 		{
 			check_ban(ci, u, TTB_UNDERLINES);
 			bot_kick(ci, u, _("Don't use underlines on this channel!"));
@@ -893,17 +1221,9 @@ class BSKick : public Module
 		}
 
 		/* Caps kicker */
-		if (ci->HasExt("BS_KICK_CAPS") && realbuf.length() >= static_cast<unsigned>(ci->capsmin))
+		if (caps)
 		{
-			int i = 0, l = 0;
-
-			for (unsigned j = 0, end = realbuf.length(); j < end; ++j)
-			{
-				if (isupper(realbuf[j]))
-					++i;
-				else if (islower(realbuf[j]))
-					++l;
-			}
+			int i = this->message.upper, l = this->message.lower;
 
 			/* i counts uppercase chars, l counts lowercase chars. Only
 			 * alphabetic chars (so islower || isupper) qualify for the
@@ -919,82 +1239,29 @@ class BSKick : public Module
 		}
 
 		/* Bad words kicker */
-		if (ci->HasExt("BS_KICK_BADWORDS"))
+		if (badwords)
 		{
-			bool mustkick = false;
-
-			/* Normalize the buffer */
-			Anope::string nbuf = Anope::NormalizeBuffer(realbuf);
 			bool casesensitive = Config->GetModule("botserv")->Get<bool>("casesensitive");
 
-			for (unsigned i = 0, end = ci->GetBadWordCount(); i < end; ++i)
+			BadWordMatcher *matcher = ci->GetExt<BadWordMatcher *>("bs_kick_badwords");
+			if (matcher == NULL || matcher->version != ci->GetBadWordVersion() || matcher->casesensitive != casesensitive)
 			{
-				const BadWord *bw = ci->GetBadWord(i);
-
-				if (bw->type == BW_ANY && ((casesensitive && nbuf.find(bw->word) != Anope::string::npos) || (!casesensitive && nbuf.find_ci(bw->word) != Anope::string::npos)))
-					mustkick = true;
-				else if (bw->type == BW_SINGLE)
-				{
-					size_t len = bw->word.length();
-
-					if ((casesensitive && bw->word.equals_cs(nbuf)) || (!casesensitive && bw->word.equals_ci(nbuf)))
-						mustkick = true;
-					else if (nbuf.find(' ') == len && ((casesensitive && bw->word.equals_cs(nbuf)) || (!casesensitive && bw->word.equals_ci(nbuf))))
-						mustkick = true;
-					else
-					{
-						if (nbuf.rfind(' ') == nbuf.length() - len - 1 && ((casesensitive && nbuf.find(bw->word) == nbuf.length() - len) || (!casesensitive && nbuf.find_ci(bw->word) == nbuf.length() - len)))
-							mustkick = true;
-						else
-						{
-							Anope::string wordbuf = " " + bw->word + " ";
-
-							if ((casesensitive && nbuf.find(wordbuf) != Anope::string::npos) || (!casesensitive && nbuf.find_ci(wordbuf) != Anope::string::npos))
-								mustkick = true;
-						}
-					}
-				}
-				else if (bw->type == BW_START)
-				{
-					size_t len = bw->word.length();
-
-					if ((casesensitive && nbuf.substr(0, len).equals_cs(bw->word)) || (!casesensitive && nbuf.substr(0, len).equals_ci(bw->word)))
-						mustkick = true;
-					else
-					{
-						Anope::string wordbuf = " " + bw->word;
-
-						if ((casesensitive && nbuf.find(wordbuf) != Anope::string::npos) || (!casesensitive && nbuf.find_ci(wordbuf) != Anope::string::npos))
-							mustkick = true;
-					}
-				}
-				else if (bw->type == BW_END)
-				{
-					size_t len = bw->word.length();
-
-					if ((casesensitive && nbuf.substr(nbuf.length() - len).equals_cs(bw->word)) || (!casesensitive && nbuf.substr(nbuf.length() - len).equals_ci(bw->word)))
-						mustkick = true;
-					else
-					{
-						Anope::string wordbuf = bw->word + " ";
-
-						if ((casesensitive && nbuf.find(wordbuf) != Anope::string::npos) || (!casesensitive && nbuf.find_ci(wordbuf) != Anope::string::npos))
-							mustkick = true;
-					}
-				}
+				matcher = new BadWordMatcher(ci, casesensitive);
+				ci->Extend("bs_kick_badwords", matcher);
+			}
 
-				if (mustkick)
-				{
-					check_ban(ci, u, TTB_BADWORDS);
-					if (Config->GetModule(me)->Get<bool>("gentlebadwordreason"))
-						bot_kick(ci, u, _("Watch your language!"));
-					else
-						bot_kick(ci, u, _("Don't use the word \"%s\" on this channel!"), bw->word.c_str());
+			const Anope::string *word = matcher->Find(this->message.normalized);
+			if (word != NULL)
+			{
+				check_ban(ci, u, TTB_BADWORDS);
+				if (Config->GetModule(me)->Get<bool>("gentlebadwordreason"))
+					bot_kick(ci, u, _("Watch your language!"));
+				else
+					bot_kick(ci, u, _("Don't use the word \"%s\" on this channel!"), word->c_str());
 
-					return;
-				}
-			} /* for */
-		} /* if badwords */
+				return;
+			}
+		}
 
 		UserData *ud = GetUserData(u, c);
 
@@ -1003,14 +1270,21 @@ class BSKick : public Module
 			/* Flood kicker */
 			if (ci->HasExt("BS_KICK_FLOOD"))
 			{
-				if (Anope::CurTime - ud->last_start > ci->floodsecs)
+				time_t floodsecs = std::max<time_t>(ci->floodsecs, 1), elapsed = Anope::CurTime - ud->window_start;
+
+				if (elapsed >= floodsecs)
 				{
-					ud->last_start = Anope::CurTime;
+					/* The previous window only still counts if it is the one just before this */
+					ud->prev_lines = elapsed < floodsecs * 2 ? ud->lines : 0;
 					ud->lines = 0;
+					ud->window_start += elapsed - elapsed % floodsecs;
+					elapsed %= floodsecs;
 				}
 
 				++ud->lines;
-				if (ud->lines >= ci->floodlines)
+
+				/* Estimate the lines in the last floodsecs by weighting the previous window by how much of it is still in range */
+				if (ud->lines + ud->prev_lines * (floodsecs - elapsed) / floodsecs >= ci->floodlines)
 				{
 					check_ban(ci, u, TTB_FLOOD);
 					bot_kick(ci, u, _("Stop flooding!"));
@@ -1018,10 +1292,12 @@ class BSKick : public Module
 				}
 			}
 
+			uint64_t line = UserData::Hash(realbuf), target = UserData::Hash(ci->name);
+
 			/* Repeat kicker */
 			if (ci->HasExt("BS_KICK_REPEAT"))
 			{
-				if (!ud->lastline.equals_ci(realbuf))
+				if (ud->lastline != line)
 					ud->times = 0;
 				else
 					++ud->times;
@@ -1034,7 +1310,7 @@ class BSKick : public Module
 				}
 			}
 
-			if (ud->lastline.equals_ci(realbuf) && !ud->lasttarget.empty() && !ud->lasttarget.equals_ci(ci->name))
+			if (ud->lastline == line && ud->lasttarget && ud->lasttarget != target)
 			{
 				for (User::ChanUserList::iterator it = u->chans.begin(); it != u->chans.end();)
 				{
@@ -1049,8 +1325,8 @@ class BSKick : public Module
 				}
 			}
 
-			ud->lasttarget = ci->name;
-			ud->lastline = realbuf;
+			ud->lasttarget = target;
+			ud->lastline = line;
 		}
 	}
 };
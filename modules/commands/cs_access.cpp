@@ -33,7 +33,8 @@ class AccessChanAccess : public ChanAccess
 
 	bool HasPriv(const Anope::string &name) const anope_override
 	{
-		return this->ci->GetLevel(name) != ACCESS_INVALID && this->level >= this->ci->GetLevel(name);
+		int16_t l = this->ci->GetLevel(name);
+		return l != ACCESS_INVALID && this->level >= l;
 	}
 
 	Anope::string AccessSerialize() const
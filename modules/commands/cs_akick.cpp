@@ -104,16 +104,18 @@ class CommandCSAKick : public Command
 		}
 		else if (ci->HasExt("PEACE"))
 		{
+			AccessGroup nc_access = ci->AccessFor(nc), u_access = source.AccessFor(ci);
+			Entry entry_mask("", mask);
+
 			/* Match against all currently online users with equal or
 			 * higher access. - Viper */
-			for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
+			std::set<User *> users;
+			UserIndex::Find(mask, users);
+			for (std::set<User *>::iterator it = users.begin(); it != users.end(); ++it)
 			{
-				User *u2 = it->second;
+				User *u2 = *it;
 
-				AccessGroup nc_access = ci->AccessFor(nc), u_access = source.AccessFor(ci);
-				Entry entry_mask("", mask);
-
-				if ((ci->AccessFor(u2).HasPriv("FOUNDER") || nc_access >= u_access) && entry_mask.Matches(u2))
+				if (entry_mask.Matches(u2) && (nc_access >= u_access || ci->AccessFor(u2).HasPriv("FOUNDER")))
 				{
 					source.Reply(ACCESS_DENIED);
 					return;
@@ -126,15 +128,13 @@ class CommandCSAKick : public Command
 			{
 				na = it->second;
 
-				AccessGroup nc_access = ci->AccessFor(na->nc), u_access = source.AccessFor(ci);
-				if (na->nc && (na->nc == ci->GetFounder() || nc_access >= u_access))
+				if (!na->nc || !Anope::Match(na->nick + "!" + na->last_usermask, mask))
+					continue;
+
+				if (na->nc == ci->GetFounder() || ci->AccessFor(na->nc) >= u_access)
 				{
-					Anope::string buf = na->nick + "!" + na->last_usermask;
-					if (Anope::Match(buf, mask))
-					{
-						source.Reply(ACCESS_DENIED);
-						return;
-					}
+					source.Reply(ACCESS_DENIED);
+					return;
 				}
 			 }
 		}
@@ -523,34 +523,20 @@ class CSAKick : public Module
 		if (ci->c->MatchesList(u, "EXCEPT"))
 			return EVENT_CONTINUE;
 
-		for (unsigned j = 0, end = ci->GetAkickCount(); j < end; ++j)
+		AutoKick *autokick = ci->MatchAkick(u);
+		if (autokick)
 		{
-			AutoKick *autokick = ci->GetAkick(j);
-			bool kick = false;
-
-			if (autokick->nc)
-				kick = autokick->nc == u->Account();
-			else if (IRCD->IsChannelValid(autokick->mask))
-			{
-				Channel *c = Channel::Find(autokick->mask);
-				kick = c != NULL && c->FindUser(u);
-			}
-			else
-				kick = Entry("BAN", autokick->mask).Matches(u);
-
-			if (kick)
-			{
-				Log(LOG_DEBUG_2) << u->nick << " matched akick " << (autokick->nc ? autokick->nc->display : autokick->mask);
-				autokick->last_used = Anope::CurTime;
-				if (!autokick->nc && autokick->mask.find('#') == Anope::string::npos)
-					mask = autokick->mask;
-				reason = autokick->reason;
-				if (reason.empty())
-					reason = Config->GetModule(this)->Get<const Anope::string &>("autokickreason");
-				if (reason.empty())
-					reason = "User has been banned from the channel";
-				return EVENT_STOP;
-			}
+			Log(LOG_DEBUG_2) << u->nick << " matched akick " << (autokick->nc ? autokick->nc->display : autokick->mask);
+			autokick->last_used = Anope::CurTime;
+			autokick->QueueUpdate();
+			if (!autokick->nc && autokick->mask.find('#') == Anope::string::npos)
+				mask = autokick->mask;
+			reason = autokick->reason;
+			if (reason.empty())
+				reason = Config->GetModule(this)->Get<const Anope::string &>("autokickreason");
+			if (reason.empty())
+				reason = "User has been banned from the channel";
+			return EVENT_STOP;
 		}
 
 		return EVENT_CONTINUE;
@@ -63,6 +63,7 @@ public:
 			target_ci = new ChannelInfo(*ci);
 			target_ci->name = target;
 			(*RegisteredChannelList)[target_ci->name] = target_ci;
+			(*OrderedRegisteredChannelList)[target_ci->name] = target_ci;
 			target_ci->c = Channel::Find(target_ci->name);
 
 			target_ci->bi = NULL;
@@ -142,13 +142,32 @@ class CommandCSEnforce : public Command
 		bool override = !source.AccessFor(ci).HasPriv("AKICK") && source.HasPriv("chanserv/access/modify");
 		Log(override ? LOG_OVERRIDE : LOG_COMMAND, source, this, ci) << "to enforce bans";
 
+		/* Look up who each ban could match instead of checking every user against
+		 * every ban, unless there are extbans which can match anyone.
+		 */
+		std::set<User *> candidates;
+		bool all = false;
+		for (std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> bans = ci->c->GetModeList("BAN"); bans.first != bans.second && !all; ++bans.first)
+		{
+			if (IRCD->IsExtbanValid(bans.first->second))
+				all = true;
+			else
+				UserIndex::Find(bans.first->second, candidates);
+		}
+
 		std::vector<User *> users;
-		for (Channel::ChanUserList::iterator it = ci->c->users.begin(), it_end = ci->c->users.end(); it != it_end; ++it)
+		if (all || candidates.size() >= ci->c->users.size())
 		{
-			ChanUserContainer *uc = it->second;
-			User *user = uc->user;
+			candidates.clear();
+			for (Channel::ChanUserList::iterator it = ci->c->users.begin(), it_end = ci->c->users.end(); it != it_end; ++it)
+				candidates.insert(it->second->user);
+		}
 
-			if (user->IsProtected())
+		for (std::set<User *>::iterator it = candidates.begin(), it_end = candidates.end(); it != it_end; ++it)
+		{
+			User *user = *it;
+
+			if (!user->FindChannel(ci->c) || user->IsProtected())
 				continue;
 
 			if (ci->c->MatchesList(user, "BAN") && !ci->c->MatchesList(user, "EXCEPT"))
@@ -19,12 +19,12 @@ class CommandCSList : public Command
 	CommandCSList(Module *creator) : Command(creator, "chanserv/list", 1, 2)
 	{
 		this->SetDesc(_("Lists all registered channels matching the given pattern"));
-		this->SetSyntax(_("\037pattern\037 [SUSPENDED] [NOEXPIRE]"));
+		this->SetSyntax(_("\037pattern\037 [AFTER \037channel\037] [SUSPENDED] [NOEXPIRE]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
 	{
-		Anope::string pattern = params[0];
+		Anope::string pattern = params[0], after;
 		unsigned nchans;
 		bool is_servadmin = source.HasCommand("chanserv/list");
 		int count = 0, from = 0, to = 0;
@@ -54,15 +54,19 @@ class CommandCSList : public Command
 
 		nchans = 0;
 
-		if (is_servadmin && params.size() > 1)
+		if (params.size() > 1)
 		{
 			Anope::string keyword;
 			spacesepstream keywords(params[1]);
 			while (keywords.GetToken(keyword))
 			{
-				if (keyword.equals_ci("SUSPENDED"))
+				if (keyword.equals_ci("AFTER"))
+					keywords.GetToken(after);
+				else if (!is_servadmin)
+					continue;
+				else if (keyword.equals_ci("SUSPENDED"))
 					suspended = true;
-				if (keyword.equals_ci("NOEXPIRE"))
+				else if (keyword.equals_ci("NOEXPIRE"))
 					channoexpire = true;
 			}
 		}
@@ -75,40 +79,47 @@ class CommandCSList : public Command
 		ListFormatter list;
 		list.AddColumn("Name").AddColumn("Description");
 
-		Anope::map<ChannelInfo *> ordered_map;
-		for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end(); it != it_end; ++it)
-			ordered_map[it->first] = it->second;
-
-		for (Anope::map<ChannelInfo *>::const_iterator it = ordered_map.begin(), it_end = ordered_map.end(); it != it_end; ++it)
-		{
-			const ChannelInfo *ci = it->second;
+		/* Only channels starting with the literal start of either pattern can match. The
+		 * two prefixes are either nested or cover disjoint runs of names, walked in order. */
+		std::vector<Anope::string> prefixes;
+		prefixes.push_back(Anope::LiteralPrefix(pattern, true));
+		const Anope::string &sprefix = Anope::LiteralPrefix(spattern, true);
+		if (!sprefix.starts_with_ci(prefixes[0]))
+			prefixes.insert(ci::less()(sprefix, prefixes[0]) ? prefixes.begin() : prefixes.end(), sprefix);
+
+		Anope::string last;
+		for (unsigned i = 0; i < prefixes.size(); ++i)
+			for (ordered_registered_channel_map::const_iterator it = OrderedRegisteredChannelList->lower_bound_prefix(prefixes[i], after), it_end = OrderedRegisteredChannelList->end(); it != it_end && it->first.starts_with_ci(prefixes[i]); ++it)
+			{
+				const ChannelInfo *ci = it->second;
 
-			if (!is_servadmin && (ci->HasExt("PRIVATE") || ci->HasExt("SUSPENDED")))
-				continue;
-			else if (suspended && !ci->HasExt("SUSPENDED"))
-				continue;
-			else if (channoexpire && !ci->HasExt("NO_EXPIRE"))
-				continue;
+				if (!is_servadmin && (ci->HasExt("PRIVATE") || ci->HasExt("SUSPENDED")))
+					continue;
+				else if (suspended && !ci->HasExt("SUSPENDED"))
+					continue;
+				else if (channoexpire && !ci->HasExt("NO_EXPIRE"))
+					continue;
 
-			if (pattern.equals_ci(ci->name) || ci->name.equals_ci(spattern) || Anope::Match(ci->name, pattern, false, true) || Anope::Match(ci->name, spattern, false, true))
-			{
-				if (((count + 1 >= from && count + 1 <= to) || (!from && !to)) && ++nchans <= listmax)
+				if (pattern.equals_ci(ci->name) || ci->name.equals_ci(spattern) || Anope::Match(ci->name, pattern, false, true) || Anope::Match(ci->name, spattern, false, true))
 				{
-					bool isnoexpire = false;
-					if (is_servadmin && (ci->HasExt("NO_EXPIRE")))
-						isnoexpire = true;
-
-					ListFormatter::ListEntry entry;
-					entry["Name"] = (isnoexpire ? "!" : "") + ci->name;
-					if (ci->HasExt("SUSPENDED"))
-						entry["Description"] = "[Suspended]";
-					else
-						entry["Description"] = ci->desc;
-					list.AddEntry(entry);
+					if (((count + 1 >= from && count + 1 <= to) || (!from && !to)) && ++nchans <= listmax)
+					{
+						bool isnoexpire = false;
+						if (is_servadmin && (ci->HasExt("NO_EXPIRE")))
+							isnoexpire = true;
+
+						ListFormatter::ListEntry entry;
+						entry["Name"] = (isnoexpire ? "!" : "") + ci->name;
+						if (ci->HasExt("SUSPENDED"))
+							entry["Description"] = "[Suspended]";
+						else
+							entry["Description"] = ci->desc;
+						list.AddEntry(entry);
+						last = ci->name;
+					}
+					++count;
 				}
-				++count;
 			}
-		}
 
 		std::vector<Anope::string> replies;
 		list.Process(replies);
@@ -117,6 +128,15 @@ class CommandCSList : public Command
 			source.Reply(replies[i]);
 
 		source.Reply(_("End of list - %d/%d matches shown."), nchans > listmax ? listmax : nchans, nchans);
+		if (nchans > listmax && !from && !to && !last.empty())
+		{
+			Anope::string options;
+			if (suspended)
+				options += " SUSPENDED";
+			if (channoexpire)
+				options += " NOEXPIRE";
+			source.Reply(_("Type \002%s%s %s %s AFTER %s%s\002 for more."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), source.command.c_str(), pattern.c_str(), last.c_str(), options.c_str());
+		}
 		return;
 	}
 
@@ -133,6 +153,9 @@ class CommandCSList : public Command
 				"Note that a preceding '#' specifies a range, channel names\n"
 				"are to be written without '#'.\n"
 				" \n"
+				"If more channels match than can be shown at once, \002AFTER\002\n"
+				"continues the list from the channel following the one given.\n"
+				" \n"
 				"If the SUSPENDED or NOEXPIRE options are given, only channels\n"
 				"which, respectively, are SUSPENDED or have the NOEXPIRE\n"
 				"flag set will be displayed. If multiple options are given,\n"
@@ -188,6 +188,7 @@ class CSSuspend : public Module
 				ci->Shrink("suspend:expire");
 				ci->Shrink("suspend:by");
 				ci->Shrink("suspend:reason");
+				ci->QueueUpdate();
 
 				Log(LOG_NORMAL, "expire", ChanServ) << "Expiring suspend for " << ci->name;
 			}
@@ -80,7 +80,11 @@ class CommandNSAList : public Command
 				continue;
 			}
 
-			AccessGroup access = ci->AccessFor(nc);
+			std::vector<ChanAccess *> access;
+			nc->GetAccessReferences(ci, access);
+			/* Fall back to the entries whose masks match the account */
+			if (access.empty())
+				access = ci->AccessFor(nc);
 			if (access.empty())
 				continue;
 				
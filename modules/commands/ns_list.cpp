@@ -19,13 +19,13 @@ class CommandNSList : public Command
 	CommandNSList(Module *creator) : Command(creator, "nickserv/list", 1, 2)
 	{
 		this->SetDesc(_("List all registered nicknames that match a given pattern"));
-		this->SetSyntax(_("\037pattern\037 [SUSPENDED] [NOEXPIRE] [UNCONFIRMED]"));
+		this->SetSyntax(_("\037pattern\037 [AFTER \037nick\037] [SUSPENDED] [NOEXPIRE] [UNCONFIRMED]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
 	{
 
-		Anope::string pattern = params[0];
+		Anope::string pattern = params[0], after;
 		const NickCore *mync;
 		unsigned nnicks;
 		bool is_servadmin = source.HasCommand("nickserv/list");
@@ -56,17 +56,21 @@ class CommandNSList : public Command
 
 		nnicks = 0;
 
-		if (is_servadmin && params.size() > 1)
+		if (params.size() > 1)
 		{
 			Anope::string keyword;
 			spacesepstream keywords(params[1]);
 			while (keywords.GetToken(keyword))
 			{
-				if (keyword.equals_ci("NOEXPIRE"))
+				if (keyword.equals_ci("AFTER"))
+					keywords.GetToken(after);
+				else if (!is_servadmin)
+					continue;
+				else if (keyword.equals_ci("NOEXPIRE"))
 					nsnoexpire = true;
-				if (keyword.equals_ci("SUSPENDED"))
+				else if (keyword.equals_ci("SUSPENDED"))
 					suspended = true;
-				if (keyword.equals_ci("UNCONFIRMED"))
+				else if (keyword.equals_ci("UNCONFIRMED"))
 					unconfirmed = true;
 			}
 		}
@@ -76,11 +80,12 @@ class CommandNSList : public Command
 
 		list.AddColumn("Nick").AddColumn("Last usermask");
 
-		Anope::map<NickAlias *> ordered_map;
-		for (nickalias_map::const_iterator it = NickAliasList->begin(), it_end = NickAliasList->end(); it != it_end; ++it)
-			ordered_map[it->first] = it->second;
+		/* Only nicks starting with the literal start of the pattern (up to the !) can match it */
+		Anope::string prefix = Anope::LiteralPrefix(pattern, true);
+		prefix = prefix.substr(0, prefix.find('!'));
 
-		for (Anope::map<NickAlias *>::const_iterator it = ordered_map.begin(), it_end = ordered_map.end(); it != it_end; ++it)
+		Anope::string last;
+		for (ordered_nickalias_map::const_iterator it = OrderedNickAliasList->lower_bound_prefix(prefix, after), it_end = OrderedNickAliasList->end(); it != it_end && it->first.starts_with_ci(prefix); ++it)
 		{
 			const NickAlias *na = it->second;
 
@@ -97,7 +102,7 @@ class CommandNSList : public Command
 			/* We no longer compare the pattern against the output buffer.
 			 * Instead we build a nice nick!user@host buffer to compare.
 			 * The output is then generated separately. -TheShadow */
-			Anope::string buf = Anope::printf("%s!%s", na->nick.c_str(), !na->last_usermask.empty() ? na->last_usermask.c_str() : "*@*");
+			Anope::string buf = na->nick + "!" + (!na->last_usermask.empty() ? na->last_usermask : "*@*");
 			if (na->nick.equals_ci(pattern) || Anope::Match(buf, pattern, false, true))
 			{
 				if (((count + 1 >= from && count + 1 <= to) || (!from && !to)) && ++nnicks <= listmax)
@@ -117,6 +122,7 @@ class CommandNSList : public Command
 					else
 						entry["Last usermask"] = na->last_usermask;
 					list.AddEntry(entry);
+					last = na->nick;
 				}
 				++count;
 			}
@@ -131,6 +137,17 @@ class CommandNSList : public Command
 			source.Reply(replies[i]);
 
 		source.Reply(_("End of list - %d/%d matches shown."), nnicks > listmax ? listmax : nnicks, nnicks);
+		if (nnicks > listmax && !from && !to && !last.empty())
+		{
+			Anope::string options;
+			if (suspended)
+				options += " SUSPENDED";
+			if (nsnoexpire)
+				options += " NOEXPIRE";
+			if (unconfirmed)
+				options += " UNCONFIRMED";
+			source.Reply(_("Type \002%s%s %s %s AFTER %s%s\002 for more."), Config->StrictPrivmsg.c_str(), source.service->nick.c_str(), source.command.c_str(), pattern.c_str(), last.c_str(), options.c_str());
+		}
 		return;
 	}
 
@@ -146,6 +163,9 @@ class CommandNSList : public Command
 				" \n"
 				"Note that a preceding '#' specifies a range.\n"
 				" \n"
+				"If more nicks match than can be shown at once, \002AFTER\002\n"
+				"continues the list from the nick following the one given.\n"
+				" \n"
 				"If the SUSPENDED, UNCONFIRMED or NOEXPIRE options are given, only\n"
 				"nicks which, respectively, are SUSPENDED, UNCONFIRMED or have the\n"
 				"NOEXPIRE flag set will be displayed. If multiple options are\n"
@@ -196,10 +196,12 @@ class NSSuspend : public Module
 			if (when < Anope::CurTime)
 			{
 				na->last_seen = Anope::CurTime;
+				na->QueueUpdate();
 				na->nc->Shrink("SUSPENDED");
 				na->nc->Shrink("suspend:expire");
 				na->nc->Shrink("suspend:by");
 				na->nc->Shrink("suspend:reason");
+				na->nc->QueueUpdate();
 
 				Log(LOG_NORMAL, "expire", NickServ) << "Expiring suspend for " << na->nick;
 			}
@@ -31,6 +31,7 @@ class CommandNSUpdate : public Command
 		{
 			na->last_realname = u->realname;
 			na->last_seen = Anope::CurTime;
+			na->QueueUpdate();
 		}
 
 		FOREACH_MOD(I_OnNickUpdate, OnNickUpdate(u));
@@ -168,9 +168,20 @@ class CommandOSAKill : public Command
 			x->id = XLineManager::GenerateUID();
 
 		unsigned int affected = 0;
-		for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
-			if (akills->Check(it->second, x))
-				++affected;
+		if (x->regex)
+		{
+			for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
+				if (akills->Check(it->second, x))
+					++affected;
+		}
+		else
+		{
+			std::set<User *> users;
+			UserIndex::Find(x->GetNick(), x->GetUser(), x->GetHost(), users);
+			for (std::set<User *>::iterator it = users.begin(); it != users.end(); ++it)
+				if (akills->Check(*it, x))
+					++affected;
+		}
 		float percent = static_cast<float>(affected) / static_cast<float>(UserListByNick.size()) * 100.0;
 
 		if (percent > 95)
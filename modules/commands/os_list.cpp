@@ -13,6 +13,14 @@
 
 #include "module.h"
 
+template<typename T> static bool HasAnyMode(T *t, const std::set<Anope::string> &modes)
+{
+	for (std::set<Anope::string>::const_iterator it = modes.begin(), it_end = modes.end(); it != it_end; ++it)
+		if (t->HasMode(*it))
+			return true;
+	return false;
+}
+
 class CommandOSChanList : public Command
 {
  public:
@@ -46,10 +54,8 @@ class CommandOSChanList : public Command
 			{
 				ChanUserContainer *cc = uit->second;
 
-				if (!modes.empty())
-					for (std::set<Anope::string>::iterator it = modes.begin(), it_end = modes.end(); it != it_end; ++it)
-						if (!cc->chan->HasMode(*it))
-							continue;
+				if (!modes.empty() && !HasAnyMode(cc->chan, modes))
+					continue;
 
 				ListFormatter::ListEntry entry;
 				entry["Name"] = cc->chan->name;
@@ -63,16 +69,25 @@ class CommandOSChanList : public Command
 		{
 			source.Reply(_("Channel list:"));
 
-			for (channel_map::const_iterator cit = ChannelList.begin(), cit_end = ChannelList.end(); cit != cit_end; ++cit)
+			/* With modes given only the channels with one of them are looked at, otherwise the
+			 * channels whose names start with the literal start of the pattern */
+			ordered_channel_map with_modes;
+			for (std::set<Anope::string>::iterator it = modes.begin(), it_end = modes.end(); it != it_end; ++it)
+			{
+				const std::set<Channel *> &chans = Channel::FindByMode(*it);
+				for (std::set<Channel *>::const_iterator cit = chans.begin(), cit_end = chans.end(); cit != cit_end; ++cit)
+					with_modes[(*cit)->name] = *cit;
+			}
+
+			const ordered_channel_map &channels = !modes.empty() ? with_modes : OrderedChannelList;
+			const Anope::string &prefix = Anope::LiteralPrefix(pattern, true);
+
+			for (ordered_channel_map::const_iterator cit = channels.lower_bound_prefix(prefix), cit_end = channels.end(); cit != cit_end && cit->first.starts_with_ci(prefix); ++cit)
 			{
 				Channel *c = cit->second;
 
 				if (!pattern.empty() && !Anope::Match(c->name, pattern, false, true))
 					continue;
-				if (!modes.empty())
-					for (std::set<Anope::string>::iterator it = modes.begin(), it_end = modes.end(); it != it_end; ++it)
-						if (!c->HasMode(*it))
-							continue;
 
 				ListFormatter::ListEntry entry;
 				entry["Name"] = c->name;
@@ -145,10 +160,8 @@ class CommandOSUserList : public Command
 			{
 				ChanUserContainer *uc = cuit->second;
 
-				if (!modes.empty())
-					for (std::set<Anope::string>::iterator it = modes.begin(), it_end = modes.end(); it != it_end; ++it)
-						if (!uc->user->HasMode(*it))
-							continue;
+				if (!modes.empty() && !HasAnyMode(uc->user, modes))
+					continue;
 
 				ListFormatter::ListEntry entry;
 				entry["Name"] = uc->user->nick;
@@ -159,25 +172,49 @@ class CommandOSUserList : public Command
 		else
 		{
 			/* Historically this has been ordered, so... */
-			Anope::map<User *> ordered_map;
-			for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
-				ordered_map[it->first] = it->second;
+			ordered_user_map ordered_map;
+			if (!pattern.empty())
+			{
+				/* Whatever the pattern starts with has to be the start of the nick, and whatever it
+				 * ends with the end of the host, as neither can contain the separators.
+				 */
+				size_t first = pattern.find_first_of("*?"), last = pattern.find_last_of("*?");
+				Anope::string start = first != Anope::string::npos ? pattern.substr(0, first) : pattern,
+					end = last != Anope::string::npos ? pattern.substr(last + 1) : pattern,
+					nick = start.find('!') != Anope::string::npos ? start.substr(0, start.find('!')) : start + "*",
+					host = end.rfind('@') != Anope::string::npos ? end.substr(end.rfind('@') + 1) : "*" + end;
+
+				std::set<User *> users;
+				UserIndex::Find(nick, "", host, users);
+				for (std::set<User *>::iterator it = users.begin(); it != users.end(); ++it)
+					ordered_map[(*it)->nick] = *it;
+			}
+			else if (!modes.empty())
+			{
+				/* Only the users with one of the modes can be shown */
+				for (std::set<Anope::string>::iterator it = modes.begin(), it_end = modes.end(); it != it_end; ++it)
+				{
+					const std::set<User *> &users = UserIndex::FindByMode(*it);
+					for (std::set<User *>::const_iterator uit = users.begin(), uit_end = users.end(); uit != uit_end; ++uit)
+						ordered_map[(*uit)->nick] = *uit;
+				}
+			}
+
+			const ordered_user_map &users = !pattern.empty() || !modes.empty() ? ordered_map : OrderedUserList;
 
 			source.Reply(_("Users list:"));
 
-			for (Anope::map<User *>::const_iterator it = ordered_map.begin(); it != ordered_map.end(); ++it)
+			for (ordered_user_map::const_iterator it = users.begin(); it != users.end(); ++it)
 			{
 				User *u2 = it->second;
 
+				if (!modes.empty() && !HasAnyMode(u2, modes))
+					continue;
 				if (!pattern.empty())
 				{
 					Anope::string mask = u2->nick + "!" + u2->GetIdent() + "@" + u2->GetDisplayedHost(), mask2 = u2->nick + "!" + u2->GetIdent() + "@" + u2->host, mask3 = u2->nick + "!" + u2->GetIdent() + "@" + (!u2->ip.empty() ? u2->ip : u2->host);
 					if (!Anope::Match(mask, pattern) && !Anope::Match(mask2, pattern) && !Anope::Match(mask3, pattern))
 						continue;
-					if (!modes.empty())
-						for (std::set<Anope::string>::iterator mit = modes.begin(), mit_end = modes.end(); mit != mit_end; ++mit)
-							if (!u2->HasMode(*mit))
-								continue;
 				}
 
 				ListFormatter::ListEntry entry;
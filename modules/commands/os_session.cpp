@@ -41,12 +41,93 @@ class MySessionService : public SessionService
 {
 	SessionMap Sessions;
 	Serialize::Checker<ExceptionVector> Exceptions;
+
+	/* An exception and its position in Exceptions */
+	typedef std::pair<unsigned, Exception *> IndexEntry;
+	typedef std::multimap<Anope::string, IndexEntry> ExceptionIndex;
+
+	/* Exceptions by their lowercased mask if it has no wildcards, else by the literal
+	 * text it starts with or the reverse of the text it ends with, whichever is longer.
+	 * A host then only needs matching against the masks keyed on its own prefixes and
+	 * suffixes, and the few masks with neither. This is rebuilt when the exception list
+	 * may have changed, which GetExceptions() allows callers to do directly, or
+	 * an exception in it has been modified.
+	 */
+	ExceptionIndex exact, prefixes, suffixes;
+	std::set<size_t> prefix_lengths, suffix_lengths;
+	std::vector<IndexEntry> others;
+	bool reindex;
+
+	static Anope::string Reverse(const Anope::string &str)
+	{
+		return std::string(str.str().rbegin(), str.str().rend());
+	}
+
+	void Reindex()
+	{
+		exact.clear();
+		prefixes.clear();
+		suffixes.clear();
+		prefix_lengths.clear();
+		suffix_lengths.clear();
+		others.clear();
+
+		for (unsigned i = 0; i < this->Exceptions->size(); ++i)
+		{
+			IndexEntry entry(i, this->Exceptions->at(i));
+			const Anope::string &mask = entry.second->mask.lower();
+			size_t first = mask.find_first_of("*?"), last = mask.find_last_of("*?");
+
+			if (first == Anope::string::npos)
+				exact.insert(std::make_pair(mask, entry));
+			else if (first && first >= mask.length() - last - 1)
+			{
+				prefixes.insert(std::make_pair(mask.substr(0, first), entry));
+				prefix_lengths.insert(first);
+			}
+			else if (last + 1 < mask.length())
+			{
+				suffixes.insert(std::make_pair(Reverse(mask.substr(last + 1)), entry));
+				suffix_lengths.insert(mask.length() - last - 1);
+			}
+			else
+				others.push_back(entry);
+		}
+
+		reindex = false;
+	}
+
+	static void Check(const ExceptionIndex &index, const Anope::string &key, const Anope::string &host, IndexEntry &best)
+	{
+		std::pair<ExceptionIndex::const_iterator, ExceptionIndex::const_iterator> range = index.equal_range(key);
+		for (; range.first != range.second; ++range.first)
+			if (range.first->second.first < best.first && Anope::Match(host, range.first->second.second->mask))
+				best = range.first->second;
+	}
+
+	/* Finds the first exception in the list matching host, if it comes before best */
+	void Find(const Anope::string &host, IndexEntry &best)
+	{
+		const Anope::string &lhost = host.lower(), &rhost = Reverse(lhost);
+
+		Check(exact, lhost, host, best);
+		for (std::set<size_t>::iterator it = prefix_lengths.begin(), it_end = prefix_lengths.end(); it != it_end && *it <= lhost.length(); ++it)
+			Check(prefixes, lhost.substr(0, *it), host, best);
+		for (std::set<size_t>::iterator it = suffix_lengths.begin(), it_end = suffix_lengths.end(); it != it_end && *it <= rhost.length(); ++it)
+			Check(suffixes, rhost.substr(0, *it), host, best);
+
+		for (unsigned i = 0; i < others.size() && others[i].first < best.first; ++i)
+			if (Anope::Match(host, others[i].second->mask))
+				best = others[i];
+	}
+
  public:
-	MySessionService(Module *m) : SessionService(m), Exceptions("Exception") { }
+	MySessionService(Module *m) : SessionService(m), Exceptions("Exception"), reindex(true) { }
 
 	void AddException(Exception *e) anope_override
 	{
 		this->Exceptions->push_back(e);
+		reindex = true;
 	}
 
 	void DelException(Exception *e) anope_override
@@ -54,36 +135,41 @@ class MySessionService : public SessionService
 		ExceptionVector::iterator it = std::find(this->Exceptions->begin(), this->Exceptions->end(), e);
 		if (it != this->Exceptions->end())
 			this->Exceptions->erase(it);
+		reindex = true;
 	}
 
 	Exception *FindException(User *u) anope_override
 	{
-		for (std::vector<Exception *>::const_iterator it = this->Exceptions->begin(), it_end = this->Exceptions->end(); it != it_end; ++it)
-		{
-			Exception *e = *it;
-			if (Anope::Match(u->host, e->mask) || Anope::Match(u->ip, e->mask))
-				return e;
-		}
-		return NULL;
+		if (reindex)
+			this->Reindex();
+
+		IndexEntry best(~0U, static_cast<Exception *>(NULL));
+		this->Find(u->host, best);
+		this->Find(u->ip, best);
+		return best.second;
 	}
 
 	Exception *FindException(const Anope::string &host) anope_override
 	{
-		for (std::vector<Exception *>::const_iterator it = this->Exceptions->begin(), it_end = this->Exceptions->end(); it != it_end; ++it)
-		{
-			Exception *e = *it;
-			if (Anope::Match(host, e->mask))
-				return e;
-		}
+		if (reindex)
+			this->Reindex();
 
-		return NULL;
+		IndexEntry best(~0U, static_cast<Exception *>(NULL));
+		this->Find(host, best);
+		return best.second;
 	}
 
 	ExceptionVector &GetExceptions() anope_override
 	{
+		reindex = true;
 		return this->Exceptions;
 	}
 
+	void ExceptionsChanged() anope_override
+	{
+		reindex = true;
+	}
+
 	void DelSession(Session *s) anope_override
 	{
 		this->Sessions.erase(s->addr);
@@ -13,6 +13,7 @@
 
 #include "module.h"
 #include "modules/os_session.h"
+#include "modules/dns.h"
 
 struct Stats : Serializable
 {
@@ -54,6 +55,7 @@ static int stats_count_servers(Server *s)
 class CommandOSStats : public Command
 {
 	ServiceReference<XLineManager> akills, snlines, sqlines;
+	ServiceReference<DNS::Manager> dnsmanager;
  private:
 	void DoStatsAkill(CommandSource &source)
 	{
@@ -120,6 +122,34 @@ class CommandOSStats : public Command
 		}
 	}
 
+	void DoStatsDNS(CommandSource &source)
+	{
+		if (!dnsmanager)
+		{
+			source.Reply(_("The DNS module is not loaded."));
+			return;
+		}
+
+		DNS::Stats stats = dnsmanager->GetStats();
+		source.Reply(_("DNS cache: %lu entries using %lu bytes"), stats.cache_entries, stats.cache_bytes);
+		source.Reply(_("DNS cache hits: %lu, misses: %lu, shared queries: %lu"), stats.hits, stats.misses, stats.coalesced);
+		source.Reply(_("DNS cache entries expired: %lu, evicted: %lu"), stats.expired, stats.evicted);
+
+		for (unsigned i = 0; i < stats.nameservers.size(); ++i)
+		{
+			const DNS::Stats::Nameserver &ns = stats.nameservers[i];
+			source.Reply(_("Nameserver %s: %lu queries, %lu answers, %lu timeouts, %ldms average response time"), ns.addr.c_str(), ns.queries, ns.answers, ns.timeouts, ns.srtt);
+
+			Anope::string latency;
+			for (int j = 0; j < DNS::Stats::LATENCY_BUCKETS; ++j)
+			{
+				long bound = DNS::Stats::LatencyBound(j);
+				latency += (j ? ", " : "") + (bound ? "<" + stringify(bound) + "ms" : ">=" + stringify(DNS::Stats::LatencyBound(j - 1)) + "ms") + ": " + stringify(ns.latency[j]);
+			}
+			source.Reply(_("Nameserver %s response times: %s"), ns.addr.c_str(), latency.c_str());
+		}
+	}
+
 	void DoStatsReset(CommandSource &source)
 	{
 		MaxUserCount = UserListByNick.size();
@@ -145,9 +175,16 @@ class CommandOSStats : public Command
 		if (!buf.empty())
 			buf.erase(buf.begin());
 
-		source.Reply(_("Uplink server: %s"), Me->GetLinks().front()->GetName().c_str());
+		Server *uplink = Me->GetLinks().front();
+		source.Reply(_("Uplink server: %s"), uplink->GetName().c_str());
 		source.Reply(_("Uplink capab: %s"), buf.c_str());
-		source.Reply(_("Servers found: %d"), stats_count_servers(Me->GetLinks().front()));
+		source.Reply(_("Servers found: %d"), stats_count_servers(uplink));
+		if (uplink->IsSynced())
+			source.Reply(_("Uplink burst: %u users, synced in %lu ms"), uplink->burst_users, static_cast<unsigned long>(uplink->burst_time));
+		else
+			source.Reply(_("Uplink burst: %u users so far, still syncing"), uplink->burst_users);
+		if (User::DeferredConnects())
+			source.Reply(_("Deferred connect checks waiting: %u"), static_cast<unsigned>(User::DeferredConnects()));
 		return;
 	}
 
@@ -193,10 +230,11 @@ class CommandOSStats : public Command
 
  public:
 	CommandOSStats(Module *creator) : Command(creator, "operserv/stats", 0, 1),
-		akills("XLineManager", "xlinemanager/sgline"), snlines("XLineManager", "xlinemanager/snline"), sqlines("XLineManager", "xlinemanager/sqline")
+		akills("XLineManager", "xlinemanager/sgline"), snlines("XLineManager", "xlinemanager/snline"), sqlines("XLineManager", "xlinemanager/sqline"),
+		dnsmanager("DNS::Manager", "dns/manager")
 	{
 		this->SetDesc(_("Show status of Services and network"));
-		this->SetSyntax(_("[AKILL | HASH | UPLINK | UPTIME | ALL | RESET]"));
+		this->SetSyntax(_("[AKILL | DNS | HASH | UPLINK | UPTIME | ALL | RESET]"));
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
@@ -209,6 +247,9 @@ class CommandOSStats : public Command
 		if (extra.equals_ci("ALL") || extra.equals_ci("AKILL"))
 			this->DoStatsAkill(source);
 
+		if (extra.equals_ci("ALL") || extra.equals_ci("DNS"))
+			this->DoStatsDNS(source);
+
 		if (extra.equals_ci("ALL") || extra.equals_ci("HASH"))
 			this->DoStatsHash(source);
 
@@ -218,7 +259,7 @@ class CommandOSStats : public Command
 		if (extra.empty() || extra.equals_ci("ALL") || extra.equals_ci("UPTIME"))
 			this->DoStatsUptime(source);
 
-		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("HASH") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
+		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("DNS") && !extra.equals_ci("HASH") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
 			source.Reply(_("Unknown STATS option: \002%s\002"), extra.c_str());
 	}
 
@@ -237,7 +278,10 @@ class CommandOSStats : public Command
 				"to the number of users currently present on the network.\n"
 				" \n"
 				"The \002UPLINK\002 option displays information about the current\n"
-				"server Anope uses as an uplink to the network.\n"
+				"server Anope uses as an uplink to the network, including how\n"
+				"long it took to burst.\n"
+				" \n"
+				"The \002DNS\002 option displays information about the DNS cache.\n"
 				" \n"
 				"The \002HASH\002 option displays information about the hash maps.\n"
 				" \n"
@@ -569,9 +569,17 @@ class CommandOSSQLine : public CommandOSSXLineBase
 		if (Config->GetBlock("operserv")->Get<bool>("akilids"))
 			x->id = XLineManager::GenerateUID();
 
+		/* Only nicks can match, so unless this is a regex only look at users whose nick might */
+		std::set<User *> users;
+		if (x->regex)
+			for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
+				users.insert(it->second);
+		else
+			UserIndex::Find(x->mask, "", "", users);
+
 		unsigned int affected = 0;
-		for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
-			if (this->xlm()->Check(it->second, x))
+		for (std::set<User *>::iterator it = users.begin(); it != users.end(); ++it)
+			if (this->xlm()->Check(*it, x))
 				++affected;
 		float percent = static_cast<float>(affected) / static_cast<float>(UserListByNick.size()) * 100.0;
 
@@ -622,9 +630,9 @@ class CommandOSSQLine : public CommandOSSXLineBase
 			}
 			else
 			{
-				for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
+				for (std::set<User *>::iterator it = users.begin(); it != users.end(); ++it)
 				{
-					User *user = it->second;
+					User *user = *it;
 
 					if (!user->HasMode("OPER") && user->server != Me && Anope::Match(user->nick, x->mask, false, true))
 						user->Kill(Me->GetName(), rreason);
@@ -12,11 +12,15 @@
 
 #include "module.h"
 
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
 class SaveData : public Serialize::Data
 {
  public:
  	Anope::string last;
-	std::fstream *fs;
+	std::iostream *fs;
 
 	SaveData() : fs(NULL) { }
 
@@ -32,6 +36,33 @@ class SaveData : public Serialize::Data
 	}
 };
 
+/** Parses one line of an object in to its id or one of its keys and values
+ * @param token The line
+ * @param id Set to the object's id if this is its ID line
+ * @param data The object's keys and values
+ * @return false if the line is not part of the object
+ */
+static bool ParseLine(const Anope::string &token, unsigned int &id, std::map<Anope::string, Anope::string> &data)
+{
+	if (token.find("ID ") == 0)
+	{
+		try
+		{
+			id = convertTo<unsigned int>(token.substr(3));
+		}
+		catch (const ConvertException &) { }
+
+		return true;
+	}
+	else if (token.find("DATA ") != 0)
+		return false;
+
+	size_t sp = token.find(' ', 5); // Skip DATA
+	if (sp != Anope::string::npos)
+		data[token.substr(5, sp - 5)] = token.substr(sp + 1);
+	return true;
+}
+
 class LoadData : public Serialize::Data
 {
  public:
@@ -48,25 +79,9 @@ class LoadData : public Serialize::Data
 		if (!read)
 		{
 			for (Anope::string token; std::getline(*this->fs, token.str());)
-			{
-				if (token.find("ID ") == 0)
-				{
-					try
-					{
-						this->id = convertTo<unsigned int>(token.substr(3));
-					}
-					catch (const ConvertException &) { }
-
-					continue;
-				}
-				else if (token.find("DATA ") != 0)
+				if (!ParseLine(token, this->id, this->data))
 					break;
 
-				size_t sp = token.find(' ', 5); // Skip DATA
-				if (sp != Anope::string::npos)
-					data[token.substr(5, sp - 5)] = token.substr(sp + 1);
-			}
-
 			read = true;
 		}
 
@@ -100,6 +115,49 @@ class LoadData : public Serialize::Data
 	}
 };
 
+/* An object read from the database which has not yet been unserialized */
+struct ParsedObject
+{
+	/* Index of the OBJECT line for this object, and the line after its last */
+	size_t begin, end;
+	unsigned int id;
+	std::map<Anope::string, Anope::string> data;
+
+	ParsedObject(size_t b, size_t e) : begin(b), end(e), id(0) { }
+};
+
+/** Parses the lines of a range of objects in to their keys and values.
+ * This does no linking and touches no global state, so it is safe
+ * to run many of these at once on different ranges.
+ */
+class LoadThread : public Thread
+{
+	const std::vector<Anope::string> &lines;
+	std::vector<ParsedObject> &objects;
+	size_t first, last;
+
+ public:
+	LoadThread(const std::vector<Anope::string> &l, std::vector<ParsedObject> &o, size_t f, size_t la) : lines(l), objects(o), first(f), last(la) { }
+
+	static void Parse(const std::vector<Anope::string> &lines, ParsedObject &obj)
+	{
+		for (size_t i = obj.begin + 1; i < obj.end; ++i)
+			if (!ParseLine(lines[i], obj.id, obj.data))
+				break;
+	}
+
+	static void Parse(const std::vector<Anope::string> &lines, std::vector<ParsedObject> &objects, size_t first, size_t last)
+	{
+		for (size_t i = first; i < last; ++i)
+			Parse(lines, objects[i]);
+	}
+
+	void Run() anope_override
+	{
+		Parse(lines, objects, first, last);
+	}
+};
+
 class DBFlatFile : public Module, public Pipe
 {
 	/* Day the last backup was on */
@@ -108,6 +166,39 @@ class DBFlatFile : public Module, public Pipe
 	std::map<Anope::string, std::list<Anope::string> > backups;
 	bool loaded;
 
+	struct CachedObject
+	{
+		/* The generation of the object when it was serialized */
+		unsigned int generation;
+		Anope::string data;
+
+		CachedObject() : generation(0) { }
+	};
+	/* Serialized form of every object, only used when saving incrementally */
+	std::map<Serializable *, CachedObject> cache;
+
+	/* Reserializes only the objects which have changed since they were last cached */
+	void UpdateCache()
+	{
+		const std::list<Serializable *> &items = Serializable::GetItems();
+		for (std::list<Serializable *>::const_iterator it = items.begin(), it_end = items.end(); it != it_end; ++it)
+		{
+			Serializable *base = *it;
+			CachedObject &co = this->cache[base];
+
+			if (co.generation == base->GetGeneration() && co.generation)
+				continue;
+
+			std::stringstream ss;
+			SaveData data;
+			data.fs = &ss;
+			base->Serialize(data);
+
+			co.generation = base->GetGeneration();
+			co.data = ss.str();
+		}
+	}
+
 	void BackupDatabase()
 	{
 		tm *tm = localtime(&Anope::CurTime);
@@ -166,7 +257,7 @@ class DBFlatFile : public Module, public Pipe
 	DBFlatFile(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), last_day(0), loaded(false)
 	{
 
-		Implementation i[] = { I_OnLoadDatabase, I_OnSaveDatabase, I_OnSerializeTypeCreate };
+		Implementation i[] = { I_OnLoadDatabase, I_OnSaveDatabase, I_OnSerializeTypeCreate, I_OnSerializableDestruct };
 		ModuleManager::Attach(i, this, sizeof(i) / sizeof(Implementation));
 	}
 
@@ -190,6 +281,13 @@ class DBFlatFile : public Module, public Pipe
 			Anope::Quitting = true;
 	}
 
+	static long Elapsed(const timeval &start)
+	{
+		timeval now;
+		gettimeofday(&now, NULL);
+		return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+	}
+
 	EventReturn OnLoadDatabase() anope_override
 	{
 		const std::vector<Anope::string> &type_order = Serialize::Type::GetTypeOrder();
@@ -204,36 +302,95 @@ class DBFlatFile : public Module, public Pipe
 			return EVENT_STOP;
 		}
 
-		std::map<Anope::string, std::vector<std::streampos> > positions;
+		timeval start;
+		gettimeofday(&start, NULL);
+
+		std::vector<Anope::string> lines;
+		std::vector<ParsedObject> objects;
+		std::map<Anope::string, std::vector<size_t> > positions;
 
 		for (Anope::string buf; std::getline(fd, buf.str());)
+		{
 			if (buf.find("OBJECT ") == 0)
-				positions[buf.substr(7)].push_back(fd.tellg());
+			{
+				if (!objects.empty())
+					objects.back().end = lines.size();
+				positions[buf.substr(7)].push_back(objects.size());
+				objects.push_back(ParsedObject(lines.size(), lines.size()));
+			}
+			lines.push_back(buf);
+		}
+		if (!objects.empty())
+			objects.back().end = lines.size();
+
+		fd.close();
+
+		/* Parse the objects on a pool of threads, each taking a contiguous range.
+		 * Linking them together must still be done here in type order.
+		 */
+		unsigned threads = Config->GetModule(this)->Get<unsigned>("threads", "4");
+		if (threads > objects.size() / 1000)
+			threads = objects.size() / 1000;
+
+		std::vector<LoadThread *> workers;
+		for (unsigned i = 1; i < threads; ++i)
+		{
+			LoadThread *t = new LoadThread(lines, objects, objects.size() * i / threads, objects.size() * (i + 1) / threads);
+			try
+			{
+				t->Start();
+				workers.push_back(t);
+			}
+			catch (const CoreException &ex)
+			{
+				Log(this) << ex.GetReason() << ", parsing on the main thread instead";
+				delete t;
+				LoadThread::Parse(lines, objects, objects.size() * i / threads, objects.size() * (i + 1) / threads);
+			}
+		}
+
+		/* The main thread takes the first range */
+		LoadThread::Parse(lines, objects, 0, threads > 1 ? objects.size() / threads : objects.size());
+
+		for (unsigned i = 0; i < workers.size(); ++i)
+		{
+			workers[i]->Join();
+			delete workers[i];
+		}
+
+		Log(LOG_DEBUG) << "db_flatfile: Parsed " << objects.size() << " objects using " << (workers.size() + 1) << " thread(s) in " << Elapsed(start) << "ms";
 
 		LoadData ld;
-		ld.fs = &fd;
 
 		for (unsigned i = 0; i < type_order.size(); ++i)
 		{
 			Serialize::Type *stype = Serialize::Type::Find(type_order[i]);
 			if (!stype || stype->GetOwner())
 				continue;
-				
-			std::vector<std::streampos> &pos = positions[stype->GetName()];
+
+			timeval type_start;
+			gettimeofday(&type_start, NULL);
+
+			std::vector<size_t> &pos = positions[stype->GetName()];
 
 			for (unsigned j = 0; j < pos.size(); ++j)
 			{
-				fd.clear();
-				fd.seekg(pos[j]);
+				ParsedObject &po = objects[pos[j]];
+
+				ld.data.swap(po.data);
+				ld.id = po.id;
+				ld.read = true;
 
 				Serializable *obj = stype->Unserialize(NULL, ld);
 				if (obj != NULL)
 					obj->id = ld.id;
 				ld.Reset();
 			}
+
+			Log(this) << "Loaded " << pos.size() << " objects of type " << stype->GetName() << " in " << Elapsed(type_start) << "ms";
 		}
 
-		fd.close();
+		Log(this) << "Loaded database " << db_name << " in " << Elapsed(start) << "ms";
 
 		loaded = true;
 		return EVENT_STOP;
@@ -244,6 +401,13 @@ class DBFlatFile : public Module, public Pipe
 	{
 		BackupDatabase();
 
+		/* Build the cache before forking so it is kept for the next save */
+		bool incremental = Config->GetModule(this)->Get<bool>("incremental");
+		if (incremental)
+			this->UpdateCache();
+		else
+			this->cache.clear();
+
 		int i = -1;
 #ifndef _WIN32
 		if (Config->GetModule(this)->Get<bool>("fork"))
@@ -290,15 +454,21 @@ class DBFlatFile : public Module, public Pipe
 				Serializable *base = *it;
 				Serialize::Type *s_type = base->GetSerializableType();
 
-				data.fs = databases[s_type->GetOwner()];
-				if (!data.fs || !data.fs->is_open())
+				std::fstream *fs = databases[s_type->GetOwner()];
+				if (!fs || !fs->is_open())
 					continue;
 
-				*data.fs << "OBJECT " << s_type->GetName();
+				*fs << "OBJECT " << s_type->GetName();
 				if (base->id)
-					*data.fs << "\nID " << base->id;
-				base->Serialize(data);
-				*data.fs << "\nEND\n";
+					*fs << "\nID " << base->id;
+				if (incremental)
+					*fs << this->cache[base].data;
+				else
+				{
+					data.fs = fs;
+					base->Serialize(data);
+				}
+				*fs << "\nEND\n";
 			}
 
 			for (std::map<Module *, std::fstream *>::iterator it = databases.begin(), it_end = databases.end(); it != it_end; ++it)
@@ -339,6 +509,11 @@ class DBFlatFile : public Module, public Pipe
 		return EVENT_CONTINUE;
 	}
 
+	void OnSerializableDestruct(Serializable *obj) anope_override
+	{
+		this->cache.erase(obj);
+	}
+
 	/* Load just one type. Done if a module is reloaded during runtime */
 	void OnSerializeTypeCreate(Serialize::Type *stype) anope_override
 	{
@@ -32,36 +32,39 @@ class SQLSQLInterface : public Interface
 	}
 };
 
+class DBSQL;
+
 class ResultSQLSQLInterface : public SQLSQLInterface
 {
+	DBSQL *db;
 	Reference<Serializable> obj;
+	Data *data;
 
 public:
-	ResultSQLSQLInterface(Module *o, Serializable *ob) : SQLSQLInterface(o), obj(ob) { }
+	ResultSQLSQLInterface(DBSQL *o, Serializable *ob, Data *d);
 
-	void OnResult(const Result &r) anope_override
+	~ResultSQLSQLInterface()
 	{
-		SQLSQLInterface::OnResult(r);
-		if (r.GetID() > 0 && this->obj)
-			this->obj->id = r.GetID();
-		delete this;
+		delete this->data;
 	}
 
-	void OnError(const Result &r) anope_override
-	{
-		SQLSQLInterface::OnError(r);
-		delete this;
-	}
+	void OnResult(const Result &r) anope_override;
+
+	void OnError(const Result &r) anope_override;
 };
 
 class DBSQL : public Module, public Pipe
 {
 	ServiceReference<Provider> sql;
 	SQLSQLInterface sqlinterface;
+	BatchWriter writer;
 	Anope::string prefix;
 	bool import;
 
+	/* Objects taken from the types' dirty sets waiting to be committed */
 	std::set<Serializable *> updated_items;
+	/* New objects whose insert has not returned yet */
+	std::set<Serializable *> inserting;
 	bool shutting_down;
 	bool loading_databases;
 	bool loaded;
@@ -85,11 +88,14 @@ class DBSQL : public Module, public Pipe
 			this->sql->Run(iface, q);
 		}
 		else
+		{
+			this->sql->Wait(this);
 			this->sql->RunQuery(q);
+		}
 	}
 
  public:
-	DBSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sql("", ""), sqlinterface(this), shutting_down(false), loading_databases(false), loaded(false), imported(false)
+	DBSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sql("", ""), sqlinterface(this), writer(this), shutting_down(false), loading_databases(false), loaded(false), imported(false)
 	{
 
 		Implementation i[] = { I_OnReload, I_OnShutdown, I_OnRestart, I_OnLoadDatabase, I_OnSerializableConstruct, I_OnSerializableDestruct, I_OnSerializableUpdate, I_OnSerializeTypeCreate };
@@ -97,55 +103,126 @@ class DBSQL : public Module, public Pipe
 
 		if (ModuleManager::FindModule("db_sql_live") != NULL)
 			throw ModuleException("db_sql can not be loaded after db_sql_live");
+
+		Serialize::Type::TrackDirty(true);
+	}
+
+	~DBSQL()
+	{
+		Serialize::Type::TrackDirty(false);
 	}
 
 	void OnNotify() anope_override
 	{
-		for (std::set<Serializable *>::iterator it = this->updated_items.begin(), it_end = this->updated_items.end(); it != it_end; ++it)
+		/* Only objects which have been modified since the last commit need to be serialized */
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = Serialize::Type::GetTypes().begin(), it_end = Serialize::Type::GetTypes().end(); it != it_end; ++it)
 		{
-			Serializable *obj = *it;
+			Serialize::Type *s_type = it->second;
+
+			this->updated_items.insert(s_type->GetDirty().begin(), s_type->GetDirty().end());
+			s_type->ClearDirty();
+		}
+
+		/* Objects loaded by another database module were never marked as modified, so import them all */
+		if (!this->loaded && !this->imported && this->import)
+			this->updated_items.insert(Serializable::GetItems().begin(), Serializable::GetItems().end());
+
+		while (!this->updated_items.empty())
+		{
+			Serializable *obj = *this->updated_items.begin();
+			this->updated_items.erase(this->updated_items.begin());
+
+			/* Until its insert returns it has no id to be updated by, and another insert would duplicate it */
+			if (this->inserting.count(obj))
+			{
+				obj->MarkDirty();
+				continue;
+			}
 
 			if (this->sql)
 			{
-				Data data;
-				obj->Serialize(data);
+				Data *data = new Data();
+				obj->Serialize(*data);
 
-				if (obj->IsCached(data))
+				if (obj->IsCached(*data))
+				{
+					delete data;
 					continue;
+				}
 
-				obj->UpdateCache(data);
+				Serialize::Type *s_type = obj->GetSerializableType();
 
 				/* If we didn't load these objects and we don't want to import just update the cache and continue */
-				if (!this->loaded && !this->imported && !this->import)
+				if ((!this->loaded && !this->imported && !this->import) || !s_type)
+				{
+					obj->UpdateCache(*data);
+					delete data;
 					continue;
+				}
 
-				Serialize::Type *s_type = obj->GetSerializableType();
-				if (!s_type)
-					continue;
+				const Anope::string &table = this->prefix + s_type->GetName();
 
-				std::vector<Query> create = this->sql->CreateTable(this->prefix + s_type->GetName(), data);
+				std::vector<Query> create = this->sql->CreateTable(table, *data);
 				for (unsigned i = 0; i < create.size(); ++i)
 					this->RunBackground(create[i]);
 
-				Query insert = this->sql->BuildInsert(this->prefix + s_type->GetName(), obj->id, data);
-				if (this->imported)
-					this->RunBackground(insert, new ResultSQLSQLInterface(this, obj));
+				if (obj->id > 0)
+				{
+					/* The cache is updated once the batch has been committed */
+					this->writer.Add(table, obj, data);
+					continue;
+				}
+
+				/* New objects are inserted one at a time, as we need to know the id they are given */
+				Query insert = this->sql->Prepare(this->sql->BuildInsert(table, obj->id, *data));
+
+				if (this->imported && !Anope::Quitting)
+				{
+					this->inserting.insert(obj);
+					this->sql->Run(new ResultSQLSQLInterface(this, obj, data), insert);
+				}
 				else
 				{
 					/* We are importing objects from another database module, so don't do asynchronous
 					 * queries in case the core has to shut down, it will cut short the import
 					 */
+					this->sql->Wait(this);
 					Result r = this->sql->RunQuery(insert);
-					if (r.GetID() > 0)
-						obj->id = r.GetID();
+					if (!r.GetError().empty())
+					{
+						Log(LOG_DEBUG) << "Error executing query " << r.finished_query << ": " << r.GetError();
+						obj->MarkDirty();
+					}
+					else
+					{
+						if (r.GetID() > 0)
+							obj->id = r.GetID();
+						obj->UpdateCache(*data);
+					}
+					delete data;
 				}
 			}
 		}
 
-		this->updated_items.clear();
+		if (this->sql)
+			this->writer.Write(this->sql, this->imported && !Anope::Quitting);
+
 		this->imported = true;
 	}
 
+	/** Called when the insert of a new object has returned
+	 * @param obj The object
+	 * @param inserted Whether it was inserted
+	 */
+	void Inserted(Serializable *obj, bool inserted)
+	{
+		this->inserting.erase(obj);
+
+		/* Write any changes made while it was being inserted now that it has an id, a failed insert is retried next time */
+		if (inserted && obj->IsDirty())
+			this->Notify();
+	}
+
 	void OnReload(Configuration::Conf *conf) anope_override
 	{
 		Configuration::Block *block = conf->GetModule(this);
@@ -193,16 +270,20 @@ class DBSQL : public Module, public Pipe
 		if (this->shutting_down || this->loading_databases)
 			return;
 		obj->UpdateTS();
-		this->updated_items.insert(obj);
 		this->Notify();
 	}
 
 	void OnSerializableDestruct(Serializable *obj) anope_override
 	{
 		Serialize::Type *s_type = obj->GetSerializableType();
-		if (s_type && obj->id > 0)
-			this->RunBackground("DELETE FROM `" + this->prefix + s_type->GetName() + "` WHERE `id` = " + stringify(obj->id));
+		if (s_type && obj->id > 0 && this->sql)
+		{
+			Query query("DELETE FROM `" + this->prefix + s_type->GetName() + "` WHERE `id` = @id@");
+			query.SetValue("id", obj->id);
+			this->RunBackground(this->sql->Prepare(query));
+		}
 		this->updated_items.erase(obj);
+		this->inserting.erase(obj);
 	}
 
 	void OnSerializableUpdate(Serializable *obj) anope_override
@@ -210,7 +291,6 @@ class DBSQL : public Module, public Pipe
 		if (this->shutting_down || obj->IsTSCached())
 			return;
 		obj->UpdateTS();
-		this->updated_items.insert(obj);
 		this->Notify();
 	}
 
@@ -220,6 +300,7 @@ class DBSQL : public Module, public Pipe
 			return;
 
 		Query query("SELECT * FROM `" + this->prefix + sb->GetName() + "`");
+		this->sql->Wait(this);
 		Result res = this->sql->RunQuery(query);
 
 		for (int j = 0; j < res.Rows(); ++j)
@@ -249,10 +330,40 @@ class DBSQL : public Module, public Pipe
 					if (rit->first != "id" && rit->first != "timestamp")
 						data2[rit->first] << rit->second;
 				obj->UpdateCache(data2); /* We know this is the most up to date copy */
+				obj->ClearDirty();
 			}
 		}
 	}
 };
 
+ResultSQLSQLInterface::ResultSQLSQLInterface(DBSQL *o, Serializable *ob, Data *d) : SQLSQLInterface(o), db(o), obj(ob), data(d)
+{
+}
+
+void ResultSQLSQLInterface::OnResult(const Result &r)
+{
+	SQLSQLInterface::OnResult(r);
+	if (this->obj)
+	{
+		if (r.GetID() > 0)
+			this->obj->id = r.GetID();
+		this->obj->UpdateCache(*this->data);
+		this->db->Inserted(this->obj, true);
+	}
+	delete this;
+}
+
+void ResultSQLSQLInterface::OnError(const Result &r)
+{
+	SQLSQLInterface::OnError(r);
+	if (this->obj)
+	{
+		/* Try again next time */
+		this->obj->MarkDirty();
+		this->db->Inserted(this->obj, false);
+	}
+	delete this;
+}
+
 MODULE_INIT(DBSQL)
 
@@ -3,16 +3,63 @@
 
 using namespace SQL;
 
+class DBMySQL;
+static DBMySQL *me;
+
+/** Receives the changes to a type found by a background poll
+ */
+class PollInterface : public Interface
+{
+ public:
+	Anope::string type;
+
+	PollInterface(Module *o, const Anope::string &t) : Interface(o), type(t) { }
+
+	void OnResult(const Result &r) anope_override;
+
+	void OnError(const Result &r) anope_override;
+};
+
 class DBMySQL : public Module, public Pipe
 {
  private:
 	Anope::string prefix;
 	ServiceReference<Provider> SQL;
+	BatchWriter writer;
 	time_t lastwarn;
 	bool ro;
 	bool init;
+	/* Objects taken from the types' dirty sets waiting to be committed */
 	std::set<Serializable *> updated_items;
 
+	struct PollState
+	{
+		PollInterface *iface;
+		/* Whether a poll is waiting for its result */
+		bool pending;
+		/* Rows older than this are already known */
+		time_t since;
+		/* The time the pending poll was sent */
+		time_t sent;
+		/* Ids of objects written or deleted by us while the poll was pending */
+		std::set<unsigned int> written;
+
+		PollState() : iface(NULL), pending(false), since(0), sent(0) { }
+	};
+	/* Background poll state for each type, by name */
+	std::map<Anope::string, PollState> polls;
+
+	/* How often to poll for changes in the background, or 0 to check each time a type is accessed */
+	time_t poll_interval;
+
+	class PollTimer : public Timer
+	{
+	 public:
+		PollTimer(Module *c) : Timer(c, 1, Anope::CurTime, true) { }
+
+		void Tick(time_t) anope_override;
+	} poll_timer;
+
 	bool CheckSQL()
 	{
 		if (SQL)
@@ -64,8 +111,10 @@ class DBMySQL : public Module, public Pipe
 	}
 
  public:
-	DBMySQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), SQL("", "")
+	DBMySQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), SQL("", ""), writer(this), poll_interval(0), poll_timer(this)
 	{
+		me = this;
+
 		this->lastwarn = 0;
 		this->ro = false;
 		this->init = false;
@@ -75,6 +124,82 @@ class DBMySQL : public Module, public Pipe
 
 		if (ModuleManager::FindFirstOf(DATABASE) != this)
 			throw ModuleException("If db_sql_live is loaded it must be the first database module loaded.");
+
+		Serialize::Type::TrackDirty(true);
+	}
+
+	~DBMySQL()
+	{
+		Serialize::Type::TrackDirty(false);
+
+		for (std::map<Anope::string, PollState>::iterator it = this->polls.begin(), it_end = this->polls.end(); it != it_end; ++it)
+			delete it->second.iface;
+	}
+
+	/** Sends a query for the changes to every type which has been loaded, without
+	 * waiting for the results. Called from the timer when polling in the background.
+	 */
+	void Poll()
+	{
+		if (!this->CheckInit() || !this->poll_interval)
+			return;
+
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = Serialize::Type::GetTypes().begin(), it_end = Serialize::Type::GetTypes().end(); it != it_end; ++it)
+		{
+			Serialize::Type *s_type = it->second;
+
+			/* Types never loaded are loaded by the first access to them */
+			if (!s_type->GetTimestamp())
+				continue;
+
+			PollState &ps = this->polls[s_type->GetName()];
+			if (ps.pending)
+				continue;
+
+			if (!ps.since)
+				ps.since = s_type->GetTimestamp();
+			if (!ps.iface)
+				ps.iface = new PollInterface(this, s_type->GetName());
+
+			ps.pending = true;
+			ps.sent = Anope::CurTime;
+			ps.written.clear();
+
+			this->SQL->Run(ps.iface, "SELECT * FROM `" + this->prefix + s_type->GetName() + "` WHERE (`timestamp` > " + this->SQL->FromUnixtime(ps.since) + " OR `timestamp` IS NULL)");
+		}
+	}
+
+	void OnPollResult(const Anope::string &type, const Result &res)
+	{
+		PollState &ps = this->polls[type];
+		ps.pending = false;
+
+		Serialize::Type *s_type = Serialize::Type::Find(type);
+		if (!s_type || !this->CheckInit())
+			return;
+
+		this->ApplyChanges(s_type, res, &ps.written);
+
+		ps.since = ps.sent;
+		ps.written.clear();
+	}
+
+	void OnPollError(const Anope::string &type, const Result &res)
+	{
+		Log(LOG_DEBUG) << "SQL-live got error " << res.GetError() << " polling " << type;
+
+		/* Leave since alone so the next poll asks for these changes again */
+		PollState &ps = this->polls[type];
+		ps.pending = false;
+		ps.written.clear();
+	}
+
+	/* Remembers that we wrote an object, so a poll sent before the write does not overwrite it with old data */
+	void MarkWritten(Serialize::Type *s_type, unsigned int id)
+	{
+		std::map<Anope::string, PollState>::iterator it = this->polls.find(s_type->GetName());
+		if (it != this->polls.end() && it->second.pending)
+			it->second.written.insert(id);
 	}
 
 	void OnNotify() anope_override
@@ -82,43 +207,77 @@ class DBMySQL : public Module, public Pipe
 		if (!this->CheckInit())
 			return;
 
-		for (std::set<Serializable *>::iterator it = this->updated_items.begin(), it_end = this->updated_items.end(); it != it_end; ++it)
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = Serialize::Type::GetTypes().begin(), it_end = Serialize::Type::GetTypes().end(); it != it_end; ++it)
 		{
-			Serializable *obj = *it;
+			Serialize::Type *s_type = it->second;
 
-			if (obj && this->SQL)
-			{
-				Data data;
-				obj->Serialize(data);
+			this->updated_items.insert(s_type->GetDirty().begin(), s_type->GetDirty().end());
+			s_type->ClearDirty();
+		}
 
-				if (obj->IsCached(data))
-					continue;
+		while (!this->updated_items.empty())
+		{
+			Serializable *obj = *this->updated_items.begin();
+			this->updated_items.erase(this->updated_items.begin());
 
-				obj->UpdateCache(data);
+			if (obj && this->SQL)
+			{
+				Data *data = new Data();
+				obj->Serialize(*data);
 
 				Serialize::Type *s_type = obj->GetSerializableType();
-				if (!s_type)
+				if (obj->IsCached(*data) || !s_type)
+				{
+					delete data;
 					continue;
+				}
+
+				const Anope::string &table = this->prefix + s_type->GetName();
 
-				std::vector<Query> create = this->SQL->CreateTable(this->prefix + s_type->GetName(), data);
+				std::vector<Query> create = this->SQL->CreateTable(table, *data);
 				for (unsigned i = 0; i < create.size(); ++i)
 					this->RunQueryResult(create[i]);
 
-				Result res = this->RunQueryResult(this->SQL->BuildInsert(this->prefix + s_type->GetName(), obj->id, data));
+				if (obj->id > 0)
+				{
+					this->MarkWritten(s_type, obj->id);
+					/* The cache is updated once the batch has been committed */
+					this->writer.Add(table, obj, data);
+					continue;
+				}
+
+				Result res = this->RunQueryResult(this->SQL->Prepare(this->SQL->BuildInsert(table, obj->id, *data)));
+				if (!res.GetError().empty())
+				{
+					/* Try again next time */
+					obj->MarkDirty();
+					delete data;
+					continue;
+				}
+
+				obj->UpdateCache(*data);
+				delete data;
+
 				if (res.GetID() && obj->id != res.GetID())
 				{
 					/* In this case obj is new, so place it into the object map */
 					obj->id = res.GetID();
 					s_type->objects[obj->id] = obj;
+					this->MarkWritten(s_type, obj->id);
 				}
 			}
 		}
 
-		this->updated_items.clear();
+		if (this->CheckSQL())
+			this->writer.Write(this->SQL, false);
 	}
 
 	EventReturn OnLoadDatabase() anope_override
 	{
+		/* Objects created before now were not loaded from SQL and shouldn't be committed */
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = Serialize::Type::GetTypes().begin(), it_end = Serialize::Type::GetTypes().end(); it != it_end; ++it)
+			it->second->ClearDirty();
+
 		init = true;
 		return EVENT_STOP;
 	}
@@ -133,6 +292,8 @@ class DBMySQL : public Module, public Pipe
 		Configuration::Block *block = conf->GetModule(this);
 		this->SQL = ServiceReference<Provider>("SQL::Provider", block->Get<const Anope::string &>("engine"));
 		this->prefix = block->Get<const Anope::string &>("prefix", "anope_db_");
+		this->poll_interval = block->Get<time_t>("pollinterval");
+		this->poll_timer.SetSecs(this->poll_interval ? this->poll_interval : 1);
 	}
 
 	void OnSerializableConstruct(Serializable *obj) anope_override
@@ -140,7 +301,6 @@ class DBMySQL : public Module, public Pipe
 		if (!this->CheckInit())
 			return;
 		obj->UpdateTS();
-		this->updated_items.insert(obj);
 		this->Notify();
 	}
 
@@ -152,7 +312,12 @@ class DBMySQL : public Module, public Pipe
 		if (s_type)
 		{
 			if (obj->id > 0)
-				this->RunQuery("DELETE FROM `" + this->prefix + s_type->GetName() + "` WHERE `id` = " + stringify(obj->id));
+			{
+				Query query("DELETE FROM `" + this->prefix + s_type->GetName() + "` WHERE `id` = @id@");
+				query.SetValue("id", obj->id);
+				this->RunQuery(this->SQL->Prepare(query));
+				this->MarkWritten(s_type, obj->id);
+			}
 			s_type->objects.erase(obj->id);
 		}
 		this->updated_items.erase(obj);
@@ -163,12 +328,26 @@ class DBMySQL : public Module, public Pipe
 		if (!this->CheckInit() || obj->GetTimestamp() == Anope::CurTime)
 			return;
 
+		/* When polling in the background only the first access to a type reads from SQL */
+		if (this->poll_interval && obj->GetTimestamp())
+			return;
+
 		Query query("SELECT * FROM `" + this->prefix + obj->GetName() + "` WHERE (`timestamp` > " + this->SQL->FromUnixtime(obj->GetTimestamp()) + " OR `timestamp` IS NULL)");
 
 		obj->UpdateTimestamp();
 
 		Result res = this->RunQueryResult(query);
 
+		this->ApplyChanges(obj, res, NULL);
+	}
+
+	/** Applies rows read from SQL to the objects of a type
+	 * @param obj The type
+	 * @param res The rows
+	 * @param written If not NULL, ids of objects which must not be changed
+	 */
+	void ApplyChanges(Serialize::Type *obj, const Result &res, const std::set<unsigned int> *written)
+	{
 		bool clear_null = false;
 		for (int i = 0; i < res.Rows(); ++i)
 		{
@@ -185,6 +364,10 @@ class DBMySQL : public Module, public Pipe
 				continue;
 			}
 
+			/* Our own changes are newer than this row */
+			if (written && written->count(id))
+				continue;
+
 			if (res.Get(i, "timestamp").empty())
 			{
 				clear_null = true;
@@ -219,6 +402,7 @@ class DBMySQL : public Module, public Pipe
 							if (rit->first != "id" && rit->first != "timestamp")
 								data2[rit->first] << rit->second;
 						new_s->UpdateCache(data2); /* We know this is the most up to date copy */
+						new_s->ClearDirty();
 					}
 				}
 				else
@@ -229,10 +413,7 @@ class DBMySQL : public Module, public Pipe
 		}
 
 		if (clear_null)
-		{
-			query = "DELETE FROM `" + this->prefix + obj->GetName() + "` WHERE `timestamp` IS NULL";
-			this->RunQuery(query);
-		}
+			this->RunQuery("DELETE FROM `" + this->prefix + obj->GetName() + "` WHERE `timestamp` IS NULL");
 	}
 
 	void OnSerializableUpdate(Serializable *obj) anope_override
@@ -240,10 +421,24 @@ class DBMySQL : public Module, public Pipe
 		if (!this->CheckInit() || obj->IsTSCached())
 			return;
 		obj->UpdateTS();
-		this->updated_items.insert(obj);
 		this->Notify();
 	}
 };
 
+void DBMySQL::PollTimer::Tick(time_t)
+{
+	me->Poll();
+}
+
+void PollInterface::OnResult(const Result &r)
+{
+	me->OnPollResult(this->type, r);
+}
+
+void PollInterface::OnError(const Result &r)
+{
+	me->OnPollError(this->type, r);
+}
+
 MODULE_INIT(DBMySQL)
 
@@ -4,7 +4,7 @@
 class MySQLInterface : public SQL::Interface
 {
  public:
-	MySQLInterface(Module *o) : SQL::Interface(o) { }
+	MySQLInterface(Module *o) : SQL::Interface(o, PRIORITY_LOW) { }
 
 	void OnResult(const SQL::Result &r) anope_override
 	{
@@ -29,6 +29,8 @@ static Anope::string GetStatusFromCode(HTTPError err)
 			return "400 Bad Request";
 		case HTTP_PAGE_NOT_FOUND:
 			return "404 Not Found";
+		case HTTP_REQUEST_TOO_LARGE:
+			return "413 Request Entity Too Large";
 		case HTTP_NOT_SUPPORTED:
 			return "505 HTTP Version Not Supported";
 	}
@@ -36,31 +38,52 @@ static Anope::string GetStatusFromCode(HTTPError err)
 	return "501 Not Implemented";
 }
 
+
+class MyHTTPProvider;
+
 class MyHTTPClient : public HTTPClient
 {
 	HTTPProvider *provider;
-	HTTPMessage header;
-	bool header_done, served;
-	Anope::string page_name;
+	MyHTTPProvider *owner;
+	HTTPParser parser;
 	Reference<HTTPPage> page;
 	Anope::string ip;
 
-	unsigned content_length;
-	Anope::string post_data;
+	/* Data of pipelined requests read while waiting to reply to an earlier one */
+	Anope::string pending;
+	/* Whether the connection stays open after the current request, and whether it is closing after the reply is written */
+	bool keepalive, closing;
+	/* Whether the current request has been passed to its page and has not yet been replied to */
+	bool waiting;
+	/* Whether Consume() is on the stack */
+	bool processing;
+
+	/* Get ready for the next request on this connection */
+	void Reset()
+	{
+		this->parser.Reset();
+		this->page = NULL;
+		this->ip = this->clientaddr.addr();
+		this->keepalive = false;
+		this->waiting = false;
+	}
 
-	enum
+	/* Reply to a malformed request and drop the connection, as the rest of its data can't be trusted */
+	void Reject(HTTPError err, const Anope::string &msg)
 	{
-		ACTION_NONE,
-		ACTION_GET,
-		ACTION_POST
-	} action;
+		this->keepalive = false;
+		this->SendError(err, msg);
+	}
 
 	void Serve()
 	{
-		if (this->served)
-			return;
-		this->served = true;
+		HTTPMessage &header = this->parser.GetMessage();
+		const Anope::string &page_name = this->parser.GetTarget();
 
+		Log(LOG_DEBUG_2) << "HTTP from " << this->clientaddr.addr() << ": " << this->parser.GetMethod() << " " << page_name << " " << this->parser.GetVersion();
+
+		this->keepalive = this->parser.KeepAlive();
+		this->page = this->provider->FindPage(page_name);
 		if (!this->page)
 		{
 			this->SendError(HTTP_PAGE_NOT_FOUND, "Page not found");
@@ -73,156 +96,79 @@ class MyHTTPClient : public HTTPClient
 			{
 				const Anope::string &token = this->provider->ext_headers[i];
 
-				if (this->header.headers.count(token))
+				if (header.headers.count(token))
 				{
-					this->ip = this->header.headers[token];
+					this->ip = header.headers[token];
 					Log(LOG_DEBUG, "httpd") << "m_httpd: IP for connection " << this->GetFD() << " changed to " << this->ip;
 					break;
 				}
 			}
 		}
 
-		Log(LOG_DEBUG, "httpd") << "m_httpd: Serving page " << this->page_name << " to " << this->ip;
+		Log(LOG_DEBUG, "httpd") << "m_httpd: Serving page " << page_name << " to " << this->ip;
 
 		HTTPReply reply;
 		reply.content_type = this->page->GetContentType();
 
-		if (this->page->OnRequest(this->provider, this->page_name, this, this->header, reply))
+		/* Pages which reply later call SendReply themselves, which clears this */
+		this->waiting = true;
+		if (this->page->OnRequest(this->provider, page_name, this, header, reply))
 			this->SendReply(&reply);
 	}
 
- public:
-	time_t created;
-
-	MyHTTPClient(HTTPProvider *l, int f, const sockaddrs &a) : Socket(f, l->IsIPv6()), HTTPClient(l, f, a), provider(l), header_done(false), served(false), ip(a.addr()), content_length(0), action(ACTION_NONE), created(Anope::CurTime)
+	/* Parse and serve as many whole requests as are in the data. Replies must
+	 * go out in the order the requests came in, so this stops at a request
+	 * whose page replies later, keeping the rest of the data until then.
+	 */
+	void Consume(const char *buffer, size_t l)
 	{
-		Log(LOG_DEBUG, "httpd") << "Accepted connection " << f << " from " << a.addr();
-	}
+		this->processing = true;
 
-	~MyHTTPClient()
-	{
-		Log(LOG_DEBUG, "httpd") << "Closing connection " << this->GetFD() << " from " << this->ip;
-	}
-
-	const Anope::string GetIP() anope_override
-	{
-		return this->ip;
-	}
-
-	bool Read(const char *buffer, size_t l) anope_override
-	{
-		Anope::string buf(buffer, l);
-
-		if (!this->header_done)
-		{
-			Anope::string token;
-			sepstream sep(buf, '\n');
-			while (sep.GetToken(token) && !token.trim().empty())
-				this->Read(token);
-			this->header_done = true;
-			buf = sep.GetRemaining();
-		}
-
-		this->post_data += buf;
-
-		if (this->post_data.length() >= this->content_length)
+		size_t used = 0;
+		while (!this->closing && !this->waiting)
 		{
-			sepstream sep(this->post_data, '&');
-			Anope::string token;
+			used += this->parser.Feed(buffer + used, l - used);
 
-			while (sep.GetToken(token))
-			{
-				size_t sz = token.find('=');
-				if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
-					continue;
-				this->header.post_data[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
-				Log(LOG_DEBUG_2) << "HTTP POST from " << this->clientaddr.addr() << ": " << token.substr(0, sz) << ": " << this->header.post_data[token.substr(0, sz)];
-			}
-
-			this->Serve();
+			if (this->parser.GetState() == HTTPParser::STATE_ERROR)
+				this->Reject(this->parser.GetError(), this->parser.GetErrorMessage());
+			else if (this->parser.GetState() == HTTPParser::STATE_DONE)
+				this->Serve();
+			else
+				break;
 		}
-		
-		return true;
-	}
-
-	bool Read(const Anope::string &buf)
-	{
-		Log(LOG_DEBUG_2) << "HTTP from " << this->clientaddr.addr() << ": " << buf;
 
-		if (this->action == ACTION_NONE)
-		{
-			std::vector<Anope::string> params;
-			spacesepstream(buf).GetTokens(params);
+		if (!this->closing && used < l)
+			this->pending.append(buffer + used, l - used);
 
-			if (params.empty() || (params[0] != "GET" && params[0] != "POST"))
-			{
-				this->SendError(HTTP_BAD_REQUEST, "Unknown operation");
-				return true;
-			}
-
-			if (params.size() != 3)
-			{
-				this->SendError(HTTP_BAD_REQUEST, "Invalid parameters");
-				return true;
-			}
+		this->processing = false;
+	}
 
-			if (params[0] == "GET")
-				this->action = ACTION_GET;
-			else if (params[0] == "POST")
-				this->action = ACTION_POST;
+ public:
+	time_t last_activity;
+	std::list<MyHTTPClient *>::iterator pos;
 
-			Anope::string targ = params[1];
-			size_t q = targ.find('?');
-			if (q != Anope::string::npos)
-			{
-				sepstream sep(targ.substr(q + 1), '&');
-				targ = targ.substr(0, q);
+	MyHTTPClient(MyHTTPProvider *l, int f, const sockaddrs &a);
+	~MyHTTPClient();
 
-				Anope::string token;
-				while (sep.GetToken(token))
-				{
-					size_t sz = token.find('=');
-					if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
-						continue;
-					this->header.get_data[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
-				}
-			}
+	/* Whether this connection is between requests */
+	bool IsIdle() const
+	{
+		return this->parser.IsEmpty() && this->pending.empty() && !this->waiting;
+	}
 
-			this->page = this->provider->FindPage(targ);
-			this->page_name = targ;
-		}
-		else if (buf.find("Cookie: ") == 0)
-		{
-			spacesepstream sep(buf.substr(8));
-			Anope::string token;
+	const Anope::string GetIP() anope_override
+	{
+		return this->ip;
+	}
 
-			while (sep.GetToken(token))
-			{
-				size_t sz = token.find('=');
-				if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
-					continue;
-				size_t end = token.length() - (sz + 1);
-				if (!sep.StreamEnd())
-					--end; // Remove trailing ;
-				this->header.cookies[token.substr(0, sz)] = token.substr(sz + 1, end);
-			}
-		}
-		else if (buf.find("Content-Length: ") == 0)
-		{
-			try
-			{
-				this->content_length = convertTo<unsigned>(buf.substr(16));
-			}
-			catch (const ConvertException &ex) { }
-		}
-		else if (buf.find(':') != Anope::string::npos)
-		{
-			size_t sz = buf.find(':');
-			if (sz + 2 < buf.length())
-				this->header.headers[buf.substr(0, sz)] = buf.substr(sz + 2);
-		}
+	bool Read(const char *buffer, size_t l) anope_override;
 
-		return true;
+	bool ProcessWrite() anope_override
+	{
+		if (!HTTPClient::ProcessWrite())
+			return false;
+		/* Close once the final reply has been sent */
+		return !this->closing || !this->write_buffer.empty();
 	}
 
 	void SendError(HTTPError err, const Anope::string &msg) anope_override
@@ -238,6 +184,9 @@ class MyHTTPClient : public HTTPClient
 
 	void SendReply(HTTPReply *message) anope_override
 	{
+		if (this->closing)
+			return;
+
 		this->WriteClient("HTTP/1.1 " + GetStatusFromCode(message->error));
 		this->WriteClient("Date: " + BuildDate());
 		this->WriteClient("Server: Anope-" + Anope::VersionShort());
@@ -263,7 +212,7 @@ class MyHTTPClient : public HTTPClient
 		for (map::iterator it = message->headers.begin(), it_end = message->headers.end(); it != it_end; ++it)
 			this->WriteClient(it->first + ": " + it->second);
 
-		this->WriteClient("Connection: Close");
+		this->WriteClient(this->keepalive ? "Connection: Keep-Alive" : "Connection: Close");
 		this->WriteClient("");
 
 		for (unsigned i = 0; i < message->out.size(); ++i)
@@ -276,35 +225,95 @@ class MyHTTPClient : public HTTPClient
 		}
 
 		message->out.clear();
+
+		if (!this->keepalive)
+		{
+			this->closing = true;
+			return;
+		}
+
+		this->Reset();
+		this->last_activity = Anope::CurTime;
+
+		/* Requests pipelined behind one which was replied to later */
+		if (!this->processing && !this->pending.empty())
+		{
+			Anope::string buf = this->pending;
+			this->pending.clear();
+			this->Consume(buf.c_str(), buf.length());
+		}
 	}
 };
 
 class MyHTTPProvider : public HTTPProvider, public Timer
 {
 	int timeout;
+	unsigned max_connections;
 	std::map<Anope::string, HTTPPage *> pages;
-	std::list<Reference<MyHTTPClient> > clients;
+	/* Open connections, least recently active first */
+	std::list<MyHTTPClient *> clients;
 
  public:
-	MyHTTPProvider(Module *c, const Anope::string &n, const Anope::string &i, const unsigned short p, const int t) : Socket(-1, i.find(':') != Anope::string::npos), HTTPProvider(c, n, i, p), Timer(c, 10, Anope::CurTime, true), timeout(t) { }
+	size_t max_header_size, max_body_size;
+
+	MyHTTPProvider(Module *c, const Anope::string &n, const Anope::string &i, const unsigned short p, const int t) : Socket(-1, i.find(':') != Anope::string::npos), HTTPProvider(c, n, i, p), Timer(c, 10, Anope::CurTime, true), timeout(t), max_connections(0), max_header_size(16384), max_body_size(65536) { }
+
+	~MyHTTPProvider()
+	{
+		while (!this->clients.empty())
+			delete this->clients.front();
+	}
+
+	void SetLimits(int t, unsigned max, size_t header_max, size_t body_max)
+	{
+		this->timeout = t;
+		this->max_connections = max;
+		this->max_header_size = header_max;
+		this->max_body_size = body_max;
+	}
 
 	void Tick(time_t) anope_override
 	{
 		while (!this->clients.empty())
 		{
-			Reference<MyHTTPClient>& c = this->clients.front();
-			if (c && c->created + this->timeout >= Anope::CurTime)
+			MyHTTPClient *c = this->clients.front();
+			if (c->last_activity + this->timeout >= Anope::CurTime)
 				break;
 
+			/* This removes it from the list */
 			delete c;
-			this->clients.pop_front();
 		}
 	}
 
+	void Add(MyHTTPClient *c)
+	{
+		c->pos = this->clients.insert(this->clients.end(), c);
+	}
+
+	void Remove(MyHTTPClient *c)
+	{
+		this->clients.erase(c->pos);
+	}
+
+	/* Move a connection to the back of the idle timeout queue */
+	void Touch(MyHTTPClient *c)
+	{
+		c->last_activity = Anope::CurTime;
+		this->clients.splice(this->clients.end(), this->clients, c->pos);
+	}
+
 	ClientSocket* OnAccept(int fd, const sockaddrs &addr) anope_override
 	{
+		/* Make room by closing the connection which has been idle the longest, if there is one */
+		if (this->max_connections && this->clients.size() >= this->max_connections && this->clients.front()->IsIdle())
+			delete this->clients.front();
+
 		MyHTTPClient *c = new MyHTTPClient(this, fd, addr);
-		this->clients.push_back(c);
+		if (this->max_connections && this->clients.size() > this->max_connections)
+		{
+			Log(LOG_DEBUG, "httpd") << "m_httpd: Too many connections to " << this->name << ", dropping " << addr.addr();
+			c->flags[SF_DEAD] = true;
+		}
 		return c;
 	}
 
@@ -326,6 +335,37 @@ class MyHTTPProvider : public HTTPProvider, public Timer
 	}
 };
 
+MyHTTPClient::MyHTTPClient(MyHTTPProvider *l, int f, const sockaddrs &a) : Socket(f, l->IsIPv6()), HTTPClient(l, f, a), provider(l), owner(l),
+	parser(l->max_header_size, l->max_body_size), ip(a.addr()), keepalive(false), closing(false), waiting(false), processing(false), last_activity(Anope::CurTime)
+{
+	Log(LOG_DEBUG, "httpd") << "Accepted connection " << f << " from " << a.addr();
+	this->owner->Add(this);
+}
+
+MyHTTPClient::~MyHTTPClient()
+{
+	Log(LOG_DEBUG, "httpd") << "Closing connection " << this->GetFD() << " from " << this->ip;
+	this->owner->Remove(this);
+}
+
+bool MyHTTPClient::Read(const char *buffer, size_t l)
+{
+	this->owner->Touch(this);
+
+	if (this->waiting)
+	{
+		/* Hold on to pipelined requests, but not without limit */
+		if (this->pending.length() + l > this->owner->max_header_size + this->owner->max_body_size)
+			this->Reject(HTTP_REQUEST_TOO_LARGE, "Too much data pipelined");
+		else
+			this->pending.append(buffer, l);
+		return true;
+	}
+
+	this->Consume(buffer, l);
+	return true;
+}
+
 class HTTPD : public Module
 {
 	ServiceReference<SSLService> sslref;
@@ -340,14 +380,9 @@ class HTTPD : public Module
 
 	~HTTPD()
 	{
-		for (std::map<int, Socket *>::const_iterator it = SocketEngine::Sockets.begin(), it_end = SocketEngine::Sockets.end(); it != it_end;)
-		{
-			Socket *s = it->second;
-			++it;
-
-			if (dynamic_cast<MyHTTPProvider *>(s) || dynamic_cast<MyHTTPClient *>(s))
-				delete s;
-		}
+		/* Providers close their own connections */
+		for (std::map<Anope::string, HTTPProvider *>::iterator it = this->providers.begin(), it_end = this->providers.end(); it != it_end; ++it)
+			delete it->second;
 
 		this->providers.clear();
 	}
@@ -367,6 +402,9 @@ class HTTPD : public Module
 			Anope::string ip = block->Get<const Anope::string &>("ip");
 			int port = block->Get<int>("port", "8080");
 			int timeout = block->Get<int>("timeout", "30");
+			unsigned max_connections = block->Get<unsigned>("max_connections", "128");
+			size_t max_header_size = block->Get<unsigned>("max_header_size", "16384");
+			size_t max_body_size = block->Get<unsigned>("max_body_size", "65536");
 			bool ssl = block->Get<bool>("ssl", "no");
 			Anope::string ext_ip = block->Get<const Anope::string &>("extforward_ip");
 			Anope::string ext_header = block->Get<const Anope::string &>("extforward_header");
@@ -436,6 +474,7 @@ class HTTPD : public Module
 
 			p->ext_ip = ext_ip;
 			spacesepstream(ext_header).GetTokens(p->ext_headers);
+			anope_dynamic_static_cast<MyHTTPProvider *>(p)->SetLimits(timeout, max_connections, max_header_size, max_body_size);
 		}
 
 		for (std::map<Anope::string, HTTPProvider *>::iterator it = this->providers.begin(), it_end = this->providers.end(); it != it_end;)
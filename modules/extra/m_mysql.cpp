@@ -5,16 +5,26 @@
 #include <mysql/mysql.h>
 #include "sql.h"
 
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
 using namespace SQL;
 
 /** Non blocking threaded MySQL API, based loosely from InspIRCd's m_mysql.cpp
  *
- * This module spawns a single thread that is used to execute blocking MySQL queries.
- * When a module requests a query to be executed it is added to a list for the thread
- * (which never stops looping and sleeing) to pick up and execute, the result of which
- * is inserted in to another queue to be picked up by the main thread. The main thread
- * uses Pipe to become notified through the socket engine when there are results waiting
- * to be sent back to the modules requesting the query
+ * Each service has a pool of connections to its server, and one dispatcher thread per
+ * connection which is used to execute blocking MySQL queries. When a module requests a
+ * query to be executed it is added to the queue of the interface requesting it, for the
+ * next idle thread (which never stops looping and sleeping) to pick up and execute. Only
+ * one request of a module is executed at a time, so its queries are run in the order
+ * they were requested, whichever of its interfaces they were made through. Modules with
+ * requests waiting are picked by priority, high priority first, so eg. authentication
+ * queries are not held up behind a backlog of statistics, though a lower priority is only
+ * passed over so many times in a row so that it is never starved.
+ * The result is inserted in to another queue to be picked up by the main thread. The main
+ * thread uses Pipe to become notified through the socket engine when there are results
+ * waiting to be sent back to the modules requesting the query
  */
 
 class MySQLService;
@@ -27,21 +37,41 @@ struct QueryRequest
 	MySQLService *service;
 	/* The interface to use once we have the result to send the data back */
 	Interface *sqlinterface;
-	/* The actual query */
-	Query query;
+	/* The module this request was queued by. Unlike sqlinterface this is never
+	 * cleared, it keeps the order of the requests of the module
+	 */
+	Module *origin;
+	/* The priority of the queue this request is in */
+	Interface::Priority priority;
+	/* The actual queries */
+	std::vector<Query> queries;
+	/* Whether the queries are run in a transaction */
+	bool transaction;
+	/* When this request was queued */
+	timeval queued;
+
+	QueryRequest(MySQLService *s, Interface *i, const Query &q) : service(s), sqlinterface(i), origin(i ? i->owner : NULL), priority(i ? i->priority : Interface::PRIORITY_NORMAL), queries(1, q), transaction(false)
+	{
+		gettimeofday(&queued, NULL);
+	}
 
-	QueryRequest(MySQLService *s, Interface *i, const Query &q) : service(s), sqlinterface(i), query(q) { }
+	QueryRequest(MySQLService *s, Interface *i, const std::vector<Query> &q) : service(s), sqlinterface(i), origin(i ? i->owner : NULL), priority(i ? i->priority : Interface::PRIORITY_NORMAL), queries(q), transaction(true)
+	{
+		gettimeofday(&queued, NULL);
+	}
 };
 
-/** A query result */
+/** The results of a query request */
 struct QueryResult
 {
 	/* The interface to send the data back on */
 	Interface *sqlinterface;
-	/* The result */
-	Result result;
+	/* The results, one per query run */
+	std::vector<Result> results;
+	/* Whether the queries were run in a transaction */
+	bool transaction;
 
-	QueryResult(Interface *i, Result &r) : sqlinterface(i), result(r) { }
+	QueryResult(Interface *i, const std::vector<Result> &r, bool t) : sqlinterface(i), results(r), transaction(t) { }
 };
 
 /** A MySQL result
@@ -81,6 +111,66 @@ class MySQLResult : public Result
 		}
 	}
 
+	/* Fetches the rows of an executed prepared statement */
+	MySQLResult(unsigned int i, const Query &q, const Anope::string &fq, MYSQL_STMT *stmt) : Result(i, q, fq), res(NULL)
+	{
+		MYSQL_RES *meta = mysql_stmt_result_metadata(stmt);
+		unsigned num_fields = meta ? mysql_num_fields(meta) : 0;
+
+		if (!num_fields || mysql_stmt_store_result(stmt))
+		{
+			if (meta)
+				mysql_free_result(meta);
+			return;
+		}
+
+		MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+
+		/* Bind empty buffers to find the length of each column, then fetch each column on its own */
+		std::vector<MYSQL_BIND> binds(num_fields);
+		std::vector<unsigned long> lengths(num_fields);
+		memset(&binds[0], 0, sizeof(MYSQL_BIND) * num_fields);
+		for (unsigned field_count = 0; field_count < num_fields; ++field_count)
+		{
+			binds[field_count].buffer_type = MYSQL_TYPE_STRING;
+			binds[field_count].length = &lengths[field_count];
+		}
+
+		if (!mysql_stmt_bind_result(stmt, &binds[0]))
+		{
+			for (int ret; (ret = mysql_stmt_fetch(stmt)) == 0 || ret == MYSQL_DATA_TRUNCATED;)
+			{
+				std::map<Anope::string, Anope::string> items;
+
+				for (unsigned field_count = 0; field_count < num_fields; ++field_count)
+				{
+					Anope::string column = (fields[field_count].name ? fields[field_count].name : "");
+					Anope::string data;
+
+					if (lengths[field_count])
+					{
+						std::vector<char> buffer(lengths[field_count]);
+						MYSQL_BIND bind;
+						memset(&bind, 0, sizeof(bind));
+						bind.buffer_type = MYSQL_TYPE_STRING;
+						bind.buffer = &buffer[0];
+						bind.buffer_length = buffer.size();
+
+						if (!mysql_stmt_fetch_column(stmt, &bind, field_count, 0))
+							data = Anope::string(&buffer[0], buffer.size());
+					}
+
+					items[column] = data;
+				}
+
+				this->entries.push_back(items);
+			}
+		}
+
+		mysql_stmt_free_result(stmt);
+		mysql_free_result(meta);
+	}
+
 	MySQLResult(const Query &q, const Anope::string &fq, const Anope::string &err) : Result(0, q, fq, err), res(NULL)
 	{
 	}
@@ -92,10 +182,90 @@ class MySQLResult : public Result
 	}
 };
 
-/** A MySQL connection, there can be multiple
+/** A single connection to a MySQL server, a service has one per dispatcher thread
+ */
+class MySQLConnection
+{
+	MySQLService *service;
+
+	MYSQL *sql;
+
+	/** A compiled statement, and the names of the parameters it binds, in order
+	 */
+	struct Statement
+	{
+		MYSQL_STMT *stmt;
+		std::vector<Anope::string> parameters;
+	};
+	/* Prepared statements, keyed by the text of the query they were prepared from */
+	std::map<Anope::string, Statement> statements;
+
+	/** Finds or compiles the statement for a prepared query.
+	 * Note the mutex must be held!
+	 * @return The statement, or NULL if the query can not be run as a prepared statement
+	 */
+	MYSQL_STMT *GetStatement(const Query &query);
+
+	/** Closes all prepared statements.
+	 * Note the mutex must be held!
+	 */
+	void ClearStatements();
+
+	void Connect();
+
+	bool CheckConnection();
+
+	Anope::string BuildQuery(const Query &q);
+
+ public:
+	/** Escape a query.
+	 * Note the mutex must be held!
+	 */
+	Anope::string Escape(const Anope::string &query);
+
+	/* Locked while a query is executing on this connection, either by
+	 * its dispatcher thread or by the main thread running a query
+	 * synchronously
+	 */
+	Mutex Lock;
+
+	MySQLConnection(MySQLService *s);
+
+	~MySQLConnection();
+
+	/** Execute a query.
+	 * Note the mutex must be held!
+	 */
+	Result Execute(const Query &query);
+
+	/** Execute queries in a transaction, stopping at the first error.
+	 * Note the mutex must be held!
+	 */
+	std::vector<Result> Execute(const std::vector<Query> &queries);
+};
+
+/** The SQL threads used to execute queries, each one owns a connection
+ */
+class DispatcherThread : public Thread
+{
+	MySQLService *service;
+	MySQLConnection *connection;
+
+ public:
+	/* The request this thread is executing, if any. Locked by the service's queue */
+	QueryRequest *current;
+
+	DispatcherThread(MySQLService *s, MySQLConnection *c) : Thread(), service(s), connection(c), current(NULL) { }
+
+	void Run() anope_override;
+};
+
+/** A MySQL service, there can be multiple
  */
 class MySQLService : public Provider
 {
+	friend class MySQLConnection;
+
 	std::map<Anope::string, std::set<Anope::string> > active_schema;
 
 	Anope::string database;
@@ -104,51 +274,97 @@ class MySQLService : public Provider
 	Anope::string password;
 	int port;
 
-	MYSQL *sql;
+	/* The connection pool, and the thread using each connection */
+	std::vector<MySQLConnection *> connections;
+	std::vector<DispatcherThread *> threads;
 
-	/** Escape a query.
-	 * Note the mutex must be held!
+	/** How long requests of one priority have spent waiting and executing
 	 */
-	Anope::string Escape(const Anope::string &query);
+	struct QueueStats
+	{
+		unsigned long requests;
+		unsigned long wait_total, wait_max, exec_total;
+
+		QueueStats() : requests(0), wait_total(0), wait_max(0), exec_total(0) { }
+	} stats[Interface::PRIORITY_SIZE];
+
+	/* How many times in a row each priority has been passed over for a higher one while it had requests waiting */
+	unsigned passes[Interface::PRIORITY_SIZE];
 
  public:
-	/* Locked by the SQL thread when a query is pending on this database,
-	 * prevents us from deleting a connection while a query is executing
-	 * in the thread
+	/* Locks the queues, the stats, and the current request of each thread.
+	 * Signalled when a request is queued.
 	 */
-	Mutex Lock;
-
-	MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po);
+	Condition Queue;
+	/* Signalled when a request is done, for the main thread in Wait() */
+	Condition Drained;
+	/* Pending query requests of each module, in the order they were queued */
+	std::map<Module *, std::deque<QueryRequest *> > QueryRequests;
+	/* Modules with pending requests and none executing, one queue per priority */
+	std::deque<Module *> Ready[Interface::PRIORITY_SIZE];
+	/* Modules with a request executing */
+	std::set<Module *> Busy;
+
+	MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po, unsigned int c);
 
 	~MySQLService();
 
 	void Run(Interface *i, const Query &query) anope_override;
 
+	void Run(Interface *i, const std::vector<Query> &queries) anope_override;
+
 	Result RunQuery(const Query &query) anope_override;
 
+	std::vector<Result> RunQuery(const std::vector<Query> &queries) anope_override;
+
+	void Wait(Module *m) anope_override;
+
 	std::vector<Query> CreateTable(const Anope::string &table, const Data &data) anope_override;
 
 	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) anope_override;
 
+	Query BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows) anope_override;
+
+	Query Prepare(const Query &query) anope_override;
+
 	Query GetTables(const Anope::string &prefix) anope_override;
 
-	void Connect();
+	Anope::string FromUnixtime(time_t);
 
-	bool CheckConnection();
+	/** Queue a request for the dispatcher threads
+	 */
+	void Enqueue(QueryRequest *r);
 
-	Anope::string BuildQuery(const Query &q);
+	/** Take the next request to execute from the highest priority module
+	 * which has none executing, unless a lower priority has been passed over
+	 * too many times.
+	 * Note the queue must be locked!
+	 * @return The request, or NULL if there are none
+	 */
+	QueryRequest *Next();
 
-	Anope::string FromUnixtime(time_t);
-};
+	/** Called when a request from Next() is done executing, lets the next
+	 * request of its module be run.
+	 * Note the queue must be locked!
+	 */
+	void Done(const QueryRequest *r);
 
-/** The SQL thread used to execute queries
- */
-class DispatcherThread : public Thread, public Condition
-{
- public:
-	DispatcherThread() : Thread() { }
+	/** Record how long a request waited in its queue and took to execute.
+	 * Note the queue must be locked!
+	 */
+	void Record(const QueryRequest *r, const timeval &started, const timeval &finished);
 
-	void Run() anope_override;
+	/** Stop results of queries from a module from being sent back to it
+	 */
+	void Forget(Module *m);
+
+	/** Log the queue latencies since the last call, and reset them
+	 */
+	void LogStats();
+
+	/** Pick a connection to run a query on synchronously, and lock it.
+	 */
+	MySQLConnection *Acquire();
 };
 
 class ModuleSQL;
@@ -157,23 +373,30 @@ class ModuleSQL : public Module, public Pipe
 {
 	/* SQL connections */
 	std::map<Anope::string, MySQLService *> MySQLServices;
+
+	class StatsTimer : public Timer
+	{
+	 public:
+		StatsTimer(Module *c) : Timer(c, 300, Anope::CurTime, true) { }
+
+		void Tick(time_t) anope_override
+		{
+			me->LogStats();
+		}
+	} stats_timer;
+
  public:
-	/* Pending query requests */
-	std::deque<QueryRequest> QueryRequests;
+	/* Locks the finished requests */
+	Mutex Finished;
 	/* Pending finished requests with results */
 	std::deque<QueryResult> FinishedRequests;
-	/* The thread used to execute queries */
-	DispatcherThread *DThread;
 
-	ModuleSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
+	ModuleSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR), stats_timer(this)
 	{
 		me = this;
 
 		Implementation i[] = { I_OnReload, I_OnModuleUnload };
 		ModuleManager::Attach(i, this,  2);
-
-		DThread = new DispatcherThread();
-		DThread->Start();
 	}
 
 	~ModuleSQL()
@@ -181,17 +404,12 @@ class ModuleSQL : public Module, public Pipe
 		for (std::map<Anope::string, MySQLService *>::iterator it = this->MySQLServices.begin(); it != this->MySQLServices.end(); ++it)
 			delete it->second;
 		MySQLServices.clear();
-
-		DThread->SetExitState();
-		DThread->Wakeup();
-		DThread->Join();
-		delete DThread;
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
 	{
 		Configuration::Block *config = Config->GetModule(this);
-		int i, num;
+		int i, num = Config->CountBlock("mysql");
 
 		for (std::map<Anope::string, MySQLService *>::iterator it = this->MySQLServices.begin(); it != this->MySQLServices.end();)
 		{
@@ -199,7 +417,7 @@ class ModuleSQL : public Module, public Pipe
 			MySQLService *s = it->second;
 			++it;
 
-			for (i = 0; i < Config->CountBlock("mysql"); ++i)
+			for (i = 0; i < num; ++i)
 				if (Config->GetBlock("mysql", i)->Get<const Anope::string &>("name", "main") == cname)
 					break;
 
@@ -212,7 +430,7 @@ class ModuleSQL : public Module, public Pipe
 			}
 		}
 
-		for (i = 0; i < Config->CountBlock("mysql"); ++i)
+		for (i = 0; i < num; ++i)
 		{
 			Configuration::Block *block = Config->GetBlock("mysql", i);
 			const Anope::string &connname = block->Get<const Anope::string &>("name", "mysql/main");
@@ -224,13 +442,17 @@ class ModuleSQL : public Module, public Pipe
 				const Anope::string &user = block->Get<const Anope::string &>("username", "anope");
 				const Anope::string &password = block->Get<const Anope::string &>("password");
 				int port = block->Get<int>("port", "3306");
+				int connections = block->Get<int>("connections", "1");
+
+				if (connections < 1)
+					connections = 1;
 
 				try
 				{
-					MySQLService *ss = new MySQLService(this, connname, database, server, user, password, port);
+					MySQLService *ss = new MySQLService(this, connname, database, server, user, password, port, connections);
 					this->MySQLServices.insert(std::make_pair(connname, ss));
 
-					Log(LOG_NORMAL, "mysql") << "MySQL: Successfully connected to server " << connname << " (" << server << ")";
+					Log(LOG_NORMAL, "mysql") << "MySQL: Successfully connected to server " << connname << " (" << server << ") with " << connections << " connection(s)";
 				}
 				catch (const SQL::Exception &ex)
 				{
@@ -242,35 +464,18 @@ class ModuleSQL : public Module, public Pipe
 
 	void OnModuleUnload(User *, Module *m) anope_override
 	{
-		this->DThread->Lock();
-
-		for (unsigned i = this->QueryRequests.size(); i > 0; --i)
-		{
-			QueryRequest &r = this->QueryRequests[i - 1];
-
-			if (r.sqlinterface && r.sqlinterface->owner == m)
-			{
-				if (i == 1)
-				{
-					r.service->Lock.Lock();
-					r.service->Lock.Unlock();
-				}
-
-				this->QueryRequests.erase(this->QueryRequests.begin() + i - 1);
-			}
-		}
-
-		this->DThread->Unlock();
+		for (std::map<Anope::string, MySQLService *>::iterator it = this->MySQLServices.begin(); it != this->MySQLServices.end(); ++it)
+			it->second->Forget(m);
 
 		this->OnNotify();
 	}
 
 	void OnNotify() anope_override
 	{
-		this->DThread->Lock();
-		std::deque<QueryResult> finishedRequests = this->FinishedRequests;
-		this->FinishedRequests.clear();
-		this->DThread->Unlock();
+		this->Finished.Lock();
+		std::deque<QueryResult> finishedRequests;
+		finishedRequests.swap(this->FinishedRequests);
+		this->Finished.Unlock();
 
 		for (std::deque<QueryResult>::const_iterator it = finishedRequests.begin(), it_end = finishedRequests.end(); it != it_end; ++it)
 		{
@@ -279,70 +484,267 @@ class ModuleSQL : public Module, public Pipe
 			if (!qr.sqlinterface)
 				throw SQL::Exception("NULL qr.sqlinterface in MySQLPipe::OnNotify() ?");
 
-			if (qr.result.GetError().empty())
-				qr.sqlinterface->OnResult(qr.result);
+			if (qr.transaction)
+				qr.sqlinterface->OnResults(qr.results);
+			else if (qr.results[0].GetError().empty())
+				qr.sqlinterface->OnResult(qr.results[0]);
 			else
-				qr.sqlinterface->OnError(qr.result);
+				qr.sqlinterface->OnError(qr.results[0]);
 		}
 	}
+
+	void LogStats()
+	{
+		for (std::map<Anope::string, MySQLService *>::iterator it = this->MySQLServices.begin(); it != this->MySQLServices.end(); ++it)
+			it->second->LogStats();
+	}
 };
 
-MySQLService::MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po)
-: Provider(o, n), database(d), server(s), user(u), password(p), port(po), sql(NULL)
+static long Elapsed(const timeval &from, const timeval &to)
 {
-	Connect();
+	return (to.tv_sec - from.tv_sec) * 1000 + (to.tv_usec - from.tv_usec) / 1000;
 }
 
-MySQLService::~MySQLService()
+MySQLService::MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po, unsigned int c)
+: Provider(o, n), database(d), server(s), user(u), password(p), port(po)
 {
-	me->DThread->Lock();
-	this->Lock.Lock();
-	mysql_close(this->sql);
-	this->sql = NULL;
+	for (unsigned i = 0; i < Interface::PRIORITY_SIZE; ++i)
+		this->passes[i] = 0;
 
-	for (unsigned i = me->QueryRequests.size(); i > 0; --i)
+	try
+	{
+		for (unsigned i = 0; i < c; ++i)
+			this->connections.push_back(new MySQLConnection(this));
+	}
+	catch (const SQL::Exception &)
 	{
-		QueryRequest &r = me->QueryRequests[i - 1];
+		for (unsigned i = 0; i < this->connections.size(); ++i)
+			delete this->connections[i];
+		throw;
+	}
 
-		if (r.service == this)
+	for (unsigned i = 0; i < this->connections.size(); ++i)
+	{
+		DispatcherThread *thread = new DispatcherThread(this, this->connections[i]);
+		this->threads.push_back(thread);
+		thread->Start();
+	}
+}
+
+MySQLService::~MySQLService()
+{
+	this->Queue.Lock();
+	for (unsigned i = 0; i < this->threads.size(); ++i)
+		this->threads[i]->SetExitState();
+	for (unsigned i = 0; i < this->threads.size(); ++i)
+		this->Queue.Wakeup();
+	this->Queue.Unlock();
+
+	/* This waits for any query currently executing to finish */
+	for (unsigned i = 0; i < this->threads.size(); ++i)
+	{
+		this->threads[i]->Join();
+		delete this->threads[i];
+	}
+
+	for (std::map<Module *, std::deque<QueryRequest *> >::iterator it = this->QueryRequests.begin(), it_end = this->QueryRequests.end(); it != it_end; ++it)
+		for (unsigned i = 0; i < it->second.size(); ++i)
 		{
-			if (r.sqlinterface)
-				r.sqlinterface->OnError(Result(0, r.query, "SQL Interface is going away"));
-			me->QueryRequests.erase(me->QueryRequests.begin() + i - 1);
+			QueryRequest *r = it->second[i];
+
+			if (r->sqlinterface)
+			{
+				std::vector<Result> results;
+				for (unsigned j = 0; j < r->queries.size(); ++j)
+					results.push_back(Result(0, r->queries[j], "SQL Interface is going away"));
+
+				if (r->transaction)
+					r->sqlinterface->OnResults(results);
+				else
+					r->sqlinterface->OnError(results[0]);
+			}
+			delete r;
 		}
-	}
-	this->Lock.Unlock();
-	me->DThread->Unlock();
+
+	for (unsigned i = 0; i < this->connections.size(); ++i)
+		delete this->connections[i];
 }
 
 void MySQLService::Run(Interface *i, const Query &query)
 {
-	me->DThread->Lock();
-	me->QueryRequests.push_back(QueryRequest(this, i, query));
-	me->DThread->Unlock();
-	me->DThread->Wakeup();
+	this->Enqueue(new QueryRequest(this, i, query));
+}
+
+void MySQLService::Run(Interface *i, const std::vector<Query> &queries)
+{
+	this->Enqueue(new QueryRequest(this, i, queries));
 }
 
 Result MySQLService::RunQuery(const Query &query)
 {
-	this->Lock.Lock();
+	MySQLConnection *c = this->Acquire();
+	Result result = c->Execute(query);
+	c->Lock.Unlock();
+	return result;
+}
 
-	Anope::string real_query = this->BuildQuery(query);
+std::vector<Result> MySQLService::RunQuery(const std::vector<Query> &queries)
+{
+	MySQLConnection *c = this->Acquire();
+	std::vector<Result> results = c->Execute(queries);
+	c->Lock.Unlock();
+	return results;
+}
 
-	if (this->CheckConnection() && !mysql_real_query(this->sql, real_query.c_str(), real_query.length()))
+void MySQLService::Wait(Module *m)
+{
+	this->Queue.Lock();
+	while (this->QueryRequests.count(m) || this->Busy.count(m))
 	{
-		MYSQL_RES *res = mysql_store_result(this->sql);
-		unsigned int id = mysql_insert_id(this->sql);
+		/* Done() can't signal until we are waiting, as it has to lock Drained first */
+		this->Drained.Lock();
+		this->Queue.Unlock();
+		this->Drained.Wait();
+		this->Drained.Unlock();
+		this->Queue.Lock();
+	}
+	this->Queue.Unlock();
+}
 
-		this->Lock.Unlock();
-		return MySQLResult(id, query, real_query, res);
+void MySQLService::Enqueue(QueryRequest *r)
+{
+	this->Queue.Lock();
+	std::deque<QueryRequest *> &pending = this->QueryRequests[r->origin];
+	pending.push_back(r);
+	/* Otherwise the interface is already waiting its turn, or Done() will queue it */
+	if (pending.size() == 1 && !this->Busy.count(r->origin))
+		this->Ready[r->priority].push_back(r->origin);
+	this->Queue.Unlock();
+	this->Queue.Wakeup();
+}
+
+QueryRequest *MySQLService::Next()
+{
+	/* How many times in a row a priority with requests waiting may be passed over */
+	static const unsigned max_passes = 8;
+
+	/* The highest priority with requests waiting, unless a lower one has waited too long */
+	int pick = -1;
+	for (unsigned p = 0; p < Interface::PRIORITY_SIZE; ++p)
+		if (!this->Ready[p].empty() && (pick == -1 || this->passes[p] >= max_passes))
+			pick = p;
+
+	if (pick == -1)
+		return NULL;
+
+	for (unsigned p = pick + 1; p < Interface::PRIORITY_SIZE; ++p)
+		if (!this->Ready[p].empty())
+			++this->passes[p];
+	this->passes[pick] = 0;
+
+	Module *m = this->Ready[pick].front();
+	this->Ready[pick].pop_front();
+
+	std::map<Module *, std::deque<QueryRequest *> >::iterator it = this->QueryRequests.find(m);
+	QueryRequest *r = it->second.front();
+	it->second.pop_front();
+	if (it->second.empty())
+		this->QueryRequests.erase(it);
+
+	this->Busy.insert(m);
+	return r;
+}
+
+void MySQLService::Done(const QueryRequest *r)
+{
+	this->Busy.erase(r->origin);
+
+	std::map<Module *, std::deque<QueryRequest *> >::iterator it = this->QueryRequests.find(r->origin);
+	if (it != this->QueryRequests.end())
+		this->Ready[it->second.front()->priority].push_back(r->origin);
+
+	this->Drained.Lock();
+	this->Drained.Wakeup();
+	this->Drained.Unlock();
+}
+
+void MySQLService::Record(const QueryRequest *r, const timeval &started, const timeval &finished)
+{
+	QueueStats &s = this->stats[r->priority];
+	unsigned long wait = Elapsed(r->queued, started);
+
+	++s.requests;
+	s.wait_total += wait;
+	if (wait > s.wait_max)
+		s.wait_max = wait;
+	s.exec_total += Elapsed(started, finished);
+}
+
+void MySQLService::Forget(Module *m)
+{
+	this->Queue.Lock();
+
+	std::map<Module *, std::deque<QueryRequest *> >::iterator it = this->QueryRequests.find(m);
+	if (it != this->QueryRequests.end())
+	{
+		for (unsigned p = 0; p < Interface::PRIORITY_SIZE; ++p)
+		{
+			std::deque<Module *>::iterator rit = std::find(this->Ready[p].begin(), this->Ready[p].end(), m);
+			if (rit != this->Ready[p].end())
+				this->Ready[p].erase(rit);
+		}
+
+		for (unsigned j = 0; j < it->second.size(); ++j)
+			delete it->second[j];
+		this->QueryRequests.erase(it);
 	}
-	else
+
+	/* Queries already executing are left to finish, but their results are dropped */
+	for (unsigned i = 0; i < this->threads.size(); ++i)
+	{
+		QueryRequest *r = this->threads[i]->current;
+
+		if (r && r->sqlinterface && r->sqlinterface->owner == m)
+			r->sqlinterface = NULL;
+	}
+
+	this->Queue.Unlock();
+}
+
+void MySQLService::LogStats()
+{
+	static const char *names[] = { "high", "normal", "low" };
+
+	this->Queue.Lock();
+	QueueStats s[Interface::PRIORITY_SIZE];
+	size_t pending[Interface::PRIORITY_SIZE];
+	for (unsigned p = 0; p < Interface::PRIORITY_SIZE; ++p)
 	{
-		Anope::string error = mysql_error(this->sql);
-		this->Lock.Unlock();
-		return MySQLResult(query, real_query, error);
+		s[p] = this->stats[p];
+		this->stats[p] = QueueStats();
+		pending[p] = 0;
 	}
+	for (std::map<Module *, std::deque<QueryRequest *> >::iterator it = this->QueryRequests.begin(), it_end = this->QueryRequests.end(); it != it_end; ++it)
+		for (unsigned j = 0; j < it->second.size(); ++j)
+			++pending[it->second[j]->priority];
+	this->Queue.Unlock();
+
+	for (unsigned p = 0; p < Interface::PRIORITY_SIZE; ++p)
+		if (s[p].requests || pending[p])
+			Log(LOG_DEBUG) << "m_mysql: " << this->name << " " << names[p] << " priority queue: " << s[p].requests << " requests, "
+				<< (s[p].requests ? s[p].wait_total / s[p].requests : 0) << "ms average wait, " << s[p].wait_max << "ms max wait, "
+				<< (s[p].requests ? s[p].exec_total / s[p].requests : 0) << "ms average execution, " << pending[p] << " pending";
+}
+
+MySQLConnection *MySQLService::Acquire()
+{
+	/* Prefer a connection that is idle, otherwise wait for the first one */
+	for (unsigned i = 0; i < this->connections.size(); ++i)
+		if (this->connections[i]->Lock.TryLock())
+			return this->connections[i];
+
+	this->connections[0]->Lock.Lock();
+	return this->connections[0];
 }
 
 std::vector<Query> MySQLService::CreateTable(const Anope::string &table, const Data &data)
@@ -431,28 +833,186 @@ Query MySQLService::BuildInsert(const Anope::string &table, unsigned int id, Dat
 	return query;
 }
 
+Query MySQLService::BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows)
+{
+	std::set<Anope::string> columns = this->active_schema[table];
+	Query query = BuildRows("INSERT", table, columns, rows);
+
+	Anope::string query_text = query.query + " ON DUPLICATE KEY UPDATE ";
+	for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		query_text += "`" + *it + "`=VALUES(`" + *it + "`),";
+	query_text.erase(query_text.end() - 1);
+
+	query.query = query_text;
+	return query;
+}
+
+Query MySQLService::Prepare(const Query &query)
+{
+	Query q = query;
+	q.prepared = true;
+	return q;
+}
+
 Query MySQLService::GetTables(const Anope::string &prefix)
 {
 	return Query("SHOW TABLES LIKE '" + prefix + "%';");
 }
 
-void MySQLService::Connect()
+Anope::string MySQLService::FromUnixtime(time_t t)
 {
+	return "FROM_UNIXTIME(" + stringify(t) + ")";
+}
+
+MySQLConnection::MySQLConnection(MySQLService *s) : service(s), sql(NULL)
+{
+	this->Connect();
+}
+
+MySQLConnection::~MySQLConnection()
+{
+	this->Lock.Lock();
+	this->ClearStatements();
+	mysql_close(this->sql);
+	this->sql = NULL;
+	this->Lock.Unlock();
+}
+
+std::vector<Result> MySQLConnection::Execute(const std::vector<Query> &queries)
+{
+	std::vector<Result> results;
+
+	Result res = this->Execute(Query("START TRANSACTION"));
+	if (!res.GetError().empty())
+	{
+		results.push_back(res);
+		return results;
+	}
+
+	for (unsigned i = 0; i < queries.size(); ++i)
+	{
+		res = this->Execute(queries[i]);
+		results.push_back(res);
+
+		if (!res.GetError().empty())
+		{
+			this->Execute(Query("ROLLBACK"));
+			return results;
+		}
+	}
+
+	res = this->Execute(Query("COMMIT"));
+	if (!res.GetError().empty())
+		results.push_back(res);
+
+	return results;
+}
+
+Result MySQLConnection::Execute(const Query &query)
+{
+	if (!this->CheckConnection())
+		return MySQLResult(query, query.query, mysql_error(this->sql));
+
+	MYSQL_STMT *stmt = query.prepared ? this->GetStatement(query) : NULL;
+	if (stmt)
+	{
+		const std::vector<Anope::string> &parameters = this->statements[query.query].parameters;
+
+		std::vector<MYSQL_BIND> binds(parameters.size());
+		std::vector<unsigned long> lengths(parameters.size());
+		if (!binds.empty())
+			memset(&binds[0], 0, sizeof(MYSQL_BIND) * binds.size());
+
+		for (unsigned i = 0; i < parameters.size(); ++i)
+		{
+			std::map<Anope::string, QueryData>::const_iterator it = query.parameters.find(parameters[i]);
+			const Anope::string &data = it != query.parameters.end() ? it->second.data : "";
+
+			binds[i].buffer_type = MYSQL_TYPE_STRING;
+			binds[i].buffer = const_cast<char *>(data.c_str());
+			binds[i].buffer_length = lengths[i] = data.length();
+			binds[i].length = &lengths[i];
+		}
+
+		if ((!binds.empty() && mysql_stmt_bind_param(stmt, &binds[0])) || mysql_stmt_execute(stmt))
+			return MySQLResult(query, query.query, mysql_stmt_error(stmt));
+
+		return MySQLResult(mysql_stmt_insert_id(stmt), query, query.query, stmt);
+	}
+
+	Anope::string real_query = this->BuildQuery(query);
+
+	if (!mysql_real_query(this->sql, real_query.c_str(), real_query.length()))
+	{
+		MYSQL_RES *res = mysql_store_result(this->sql);
+		unsigned int id = mysql_insert_id(this->sql);
+
+		return MySQLResult(id, query, real_query, res);
+	}
+	else
+		return MySQLResult(query, real_query, mysql_error(this->sql));
+}
+
+MYSQL_STMT *MySQLConnection::GetStatement(const Query &query)
+{
+	for (std::map<Anope::string, QueryData>::const_iterator it = query.parameters.begin(), it_end = query.parameters.end(); it != it_end; ++it)
+		if (!it->second.escape)
+			return NULL;
+
+	std::map<Anope::string, Statement>::iterator sit = this->statements.find(query.query);
+	if (sit != this->statements.end())
+		return sit->second.stmt;
+
+	Placeholders placeholders;
+	const Anope::string &text = query.Substitute(placeholders);
+
+	Statement statement;
+	statement.parameters = placeholders.names;
+
+	statement.stmt = mysql_stmt_init(this->sql);
+	if (!statement.stmt)
+		return NULL;
+
+	if (mysql_stmt_prepare(statement.stmt, text.c_str(), text.length()) || mysql_stmt_param_count(statement.stmt) != statement.parameters.size())
+	{
+		mysql_stmt_close(statement.stmt);
+		return NULL;
+	}
+
+	/* Don't let the cache grow without bound if something prepares many different queries */
+	if (this->statements.size() >= 128)
+		this->ClearStatements();
+
+	this->statements[query.query] = statement;
+	return statement.stmt;
+}
+
+void MySQLConnection::ClearStatements()
+{
+	for (std::map<Anope::string, Statement>::iterator it = this->statements.begin(), it_end = this->statements.end(); it != it_end; ++it)
+		mysql_stmt_close(it->second.stmt);
+	this->statements.clear();
+}
+
+void MySQLConnection::Connect()
+{
+	/* Statements do not survive a reconnect */
+	this->ClearStatements();
+
 	this->sql = mysql_init(this->sql);
 
 	const unsigned int timeout = 1;
 	mysql_options(this->sql, MYSQL_OPT_CONNECT_TIMEOUT, reinterpret_cast<const char *>(&timeout));
 
-	bool connect = mysql_real_connect(this->sql, this->server.c_str(), this->user.c_str(), this->password.c_str(), this->database.c_str(), this->port, NULL, CLIENT_MULTI_RESULTS);
+	bool connect = mysql_real_connect(this->sql, this->service->server.c_str(), this->service->user.c_str(), this->service->password.c_str(), this->service->database.c_str(), this->service->port, NULL, CLIENT_MULTI_RESULTS);
 
 	if (!connect)
-		throw SQL::Exception("Unable to connect to MySQL service " + this->name + ": " + mysql_error(this->sql));
+		throw SQL::Exception("Unable to connect to MySQL service " + this->service->name + ": " + mysql_error(this->sql));
 	
-	Log(LOG_DEBUG) << "Successfully connected to MySQL service " << this->name << " at " << this->server << ":" << this->port;
+	Log(LOG_DEBUG) << "Successfully connected to MySQL service " << this->service->name << " at " << this->service->server << ":" << this->service->port;
 }
 
-
-bool MySQLService::CheckConnection()
+bool MySQLConnection::CheckConnection()
 {
 	if (!this->sql || mysql_ping(this->sql))
 	{
@@ -469,59 +1029,70 @@ bool MySQLService::CheckConnection()
 	return true;
 }
 
-Anope::string MySQLService::Escape(const Anope::string &query)
+Anope::string MySQLConnection::Escape(const Anope::string &query)
 {
 	char buffer[BUFSIZE];
 	mysql_real_escape_string(this->sql, buffer, query.c_str(), query.length());
 	return buffer;
 }
 
-Anope::string MySQLService::BuildQuery(const Query &q)
-{
-	Anope::string real_query = q.query;
-
-	for (std::map<Anope::string, QueryData>::const_iterator it = q.parameters.begin(), it_end = q.parameters.end(); it != it_end; ++it)
-		real_query = real_query.replace_all_cs("@" + it->first + "@", (it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data));
-
-	return real_query;
-}
-
-Anope::string MySQLService::FromUnixtime(time_t t)
+Anope::string MySQLConnection::BuildQuery(const Query &q)
 {
-	return "FROM_UNIXTIME(" + stringify(t) + ")";
+	Quote<MySQLConnection> quote(this);
+	return q.Substitute(quote);
 }
 
 void DispatcherThread::Run()
 {
-	this->Lock();
+	this->service->Queue.Lock();
 
 	while (!this->GetExitState())
 	{
-		if (!me->QueryRequests.empty())
+		QueryRequest *r = this->service->Next();
+		if (!r)
 		{
-			QueryRequest &r = me->QueryRequests.front();
-			this->Unlock();
+			this->service->Queue.Wait();
+			continue;
+		}
 
-			Result sresult = r.service->RunQuery(r.query);
+		this->current = r;
+		this->service->Queue.Unlock();
 
-			this->Lock();
-			if (!me->QueryRequests.empty() && me->QueryRequests.front().query == r.query)
-			{
-				if (r.sqlinterface)
-					me->FinishedRequests.push_back(QueryResult(r.sqlinterface, sresult));
-				me->QueryRequests.pop_front();
-			}
-		}
+		timeval started, finished;
+		gettimeofday(&started, NULL);
+
+		this->connection->Lock.Lock();
+		std::vector<Result> sresults;
+		if (r->transaction)
+			sresults = this->connection->Execute(r->queries);
 		else
+			sresults.push_back(this->connection->Execute(r->queries[0]));
+		this->connection->Lock.Unlock();
+
+		gettimeofday(&finished, NULL);
+
+		/* Hold the queue lock while handing back the results so the requesting module can't be unloaded in the meantime */
+		this->service->Queue.Lock();
+		this->current = NULL;
+		this->service->Record(r, started, finished);
+		this->service->Done(r);
+
+		if (r->sqlinterface)
 		{
-			if (!me->FinishedRequests.empty())
+			me->Finished.Lock();
+			bool notify = me->FinishedRequests.empty();
+			me->FinishedRequests.push_back(QueryResult(r->sqlinterface, sresults, r->transaction));
+			me->Finished.Unlock();
+
+			/* If there were already results waiting the main thread has been notified of them */
+			if (notify)
 				me->Notify();
-			this->Wait();
 		}
+
+		delete r;
 	}
 
-	this->Unlock();
+	this->service->Queue.Unlock();
 }
 
 MODULE_INIT(ModuleSQL)
-
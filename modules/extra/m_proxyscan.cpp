@@ -24,9 +24,17 @@ class ProxyCallbackListener : public ListenSocket
 {
 	class ProxyCallbackClient : public ClientSocket, public BufferedSocket
 	{
+		ProxyCallbackListener *listener;
+
 	 public:
-		ProxyCallbackClient(ListenSocket *l, int f, const sockaddrs &a) : Socket(f, l->IsIPv6()), ClientSocket(l, a), BufferedSocket()
+		ProxyCallbackClient(ProxyCallbackListener *l, int f, const sockaddrs &a) : Socket(f, l->IsIPv6()), ClientSocket(l, a), BufferedSocket(), listener(l)
+		{
+			listener->clients.insert(this);
+		}
+
+		~ProxyCallbackClient()
 		{
+			listener->clients.erase(this);
 		}
 
 		void OnAccept() anope_override
@@ -40,53 +48,147 @@ class ProxyCallbackListener : public ListenSocket
 		}
 	};
 
+	/* Connections accepted from suspected proxies which are still open */
+	std::set<ProxyCallbackClient *> clients;
+
  public:
 	ProxyCallbackListener(const Anope::string &b, int p) : Socket(-1, b.find(':') != Anope::string::npos), ListenSocket(b, p, false)
 	{
 	}
 
+	~ProxyCallbackListener()
+	{
+		while (!this->clients.empty())
+			delete *this->clients.begin();
+	}
+
 	ClientSocket *OnAccept(int fd, const sockaddrs &addr) anope_override
 	{
 		return new ProxyCallbackClient(this, fd, addr);
 	}
 };
 
+class ProxyConnect;
+
+/* Schedules proxy checks, limiting how many connections are open at once */
+class ProxyScanner
+{
+	/* A check waiting for a free connection slot */
+	struct Probe
+	{
+		Anope::string ip;
+		unsigned check;
+		Anope::string type;
+		unsigned short port;
+	};
+
+	/* An IP with checks queued or in progress */
+	struct Target
+	{
+		unsigned outstanding;
+		bool found;
+		/* Some checks were never run, so a clean result can't be trusted */
+		bool partial;
+
+		Target() : outstanding(0), found(false), partial(false) { }
+	};
+
+	/* The result of the last completed scan of an IP */
+	struct Result
+	{
+		time_t expires;
+		bool found;
+		time_t duration;
+		Anope::string reason;
+	};
+
+	std::deque<Probe> queue;
+	Anope::hash_map<Target> scans;
+	Anope::hash_map<Result> results;
+
+	/* Open connections bucketed by the second they time out in. There is
+	 * one more bucket than seconds in the timeout, so a bucket only ever
+	 * holds connections with the same deadline.
+	 */
+	std::vector<std::set<ProxyConnect *> > wheel;
+	time_t wheel_time;
+	/* Every connection which has not been destroyed yet */
+	std::set<ProxyConnect *> open;
+	bool draining;
+
+	void Start(const Probe &p);
+	void Done(const Anope::string &ip);
+
+ public:
+	std::vector<ProxyCheck> checks;
+	unsigned max_connections, max_queue;
+	time_t timeout, cache_time;
+
+	unsigned connections;
+
+	struct Stats
+	{
+		unsigned long queued, dropped, started, completed, positive, cached;
+
+		Stats() : queued(0), dropped(0), started(0), completed(0), positive(0), cached(0) { }
+	} stats;
+
+	ProxyScanner() : wheel_time(Anope::CurTime), draining(false), max_connections(0), max_queue(0), timeout(0), cache_time(0), connections(0) { }
+
+	/** Queue every configured check against an IP
+	 * @param u The user connecting from the IP
+	 */
+	void Scan(User *u);
+
+	/** Start queued checks while there are free connection slots */
+	void Drain();
+
+	/** Called when an open proxy has been found on an IP */
+	void Found(ProxyConnect *con, time_t duration, const Anope::string &reason);
+
+	/** Called when a connection is destroyed, for any reason */
+	void Finished(ProxyConnect *con);
+
+	/** Time out connections whose deadline has passed */
+	void Expire();
+
+	/** Drop queued checks and cached results, and rebuild the timeout wheel */
+	void Reset();
+
+	/** Destroy every connection, without starting any more */
+	void Shutdown();
+};
+
+static ProxyScanner *scanner;
+
 class ProxyConnect : public ConnectionSocket
 {
 	static ServiceReference<XLineManager> akills;
 
  public:
- 	static std::set<ProxyConnect *> proxies;
-
- 	ProxyCheck proxy;
+	ProxyCheck proxy;
+	Anope::string ip;
 	unsigned short port;
- 	time_t created;
+	time_t created;
+	/* Bucket in the scanner's timeout wheel, or -1 */
+	int slot;
 
-	ProxyConnect(ProxyCheck &p, unsigned short po) : Socket(-1), ConnectionSocket(), proxy(p),
-		port(po), created(Anope::CurTime)
+	ProxyConnect(ProxyCheck &p, const Anope::string &i, unsigned short po) : Socket(-1), ConnectionSocket(), proxy(p),
+		ip(i), port(po), created(Anope::CurTime), slot(-1)
 	{
-		proxies.insert(this);
 	}
 
 	~ProxyConnect()
 	{
-		proxies.erase(this);
+		scanner->Finished(this);
 	}
 
 	virtual void OnConnect() anope_override = 0;
 	virtual const Anope::string GetType() const = 0;
 
- protected:
-	void Ban()
+	static void Ban(const Anope::string &ip, time_t duration, const Anope::string &reason)
 	{
-		Anope::string reason = this->proxy.reason;
-
-		reason = reason.replace_all_cs("%t", this->GetType());
-		reason = reason.replace_all_cs("%i", this->conaddr.addr());
-		reason = reason.replace_all_cs("%p", stringify(this->conaddr.port()));
-
-		Log(OperServ) << "PROXYSCAN: Open " << this->GetType() << " proxy found on " << this->conaddr.addr() << ":" << this->conaddr.port() << " (" << reason << ")";
-		XLine *x = new XLine("*@" + this->conaddr.addr(), OperServ ? OperServ->nick : "", Anope::CurTime + this->proxy.duration, reason, XLineManager::GenerateUID());
+		XLine *x = new XLine("*@" + ip, OperServ ? OperServ->nick : "", Anope::CurTime + duration, reason, XLineManager::GenerateUID());
 		if (add_to_akill && akills)
 		{
 			akills->AddXLine(x);
@@ -101,14 +203,26 @@ class ProxyConnect : public ConnectionSocket
 			delete x;
 		}
 	}
+
+ protected:
+	void Ban()
+	{
+		Anope::string reason = this->proxy.reason;
+
+		reason = reason.replace_all_cs("%t", this->GetType());
+		reason = reason.replace_all_cs("%i", this->ip);
+		reason = reason.replace_all_cs("%p", stringify(this->port));
+
+		Log(OperServ) << "PROXYSCAN: Open " << this->GetType() << " proxy found on " << this->ip << ":" << this->port << " (" << reason << ")";
+		scanner->Found(this, this->proxy.duration, reason);
+	}
 };
 ServiceReference<XLineManager> ProxyConnect::akills("XLineManager", "xlinemanager/sgline");
-std::set<ProxyConnect *> ProxyConnect::proxies;
 
 class HTTPProxyConnect : public ProxyConnect, public BufferedSocket
 {
  public:
-	HTTPProxyConnect(ProxyCheck &p, unsigned short po) : Socket(-1), ProxyConnect(p, po), BufferedSocket()
+	HTTPProxyConnect(ProxyCheck &p, const Anope::string &i, unsigned short po) : Socket(-1), ProxyConnect(p, i, po), BufferedSocket()
 	{
 	}
 
@@ -140,7 +254,7 @@ class HTTPProxyConnect : public ProxyConnect, public BufferedSocket
 class SOCKS5ProxyConnect : public ProxyConnect, public BinarySocket
 {
  public:
-	SOCKS5ProxyConnect(ProxyCheck &p, unsigned short po) : Socket(-1), ProxyConnect(p, po), BinarySocket()
+	SOCKS5ProxyConnect(ProxyCheck &p, const Anope::string &i, unsigned short po) : Socket(-1), ProxyConnect(p, i, po), BinarySocket()
 	{
 	}
 
@@ -192,38 +306,309 @@ class SOCKS5ProxyConnect : public ProxyConnect, public BinarySocket
 	}
 };
 
+void ProxyScanner::Scan(User *u)
+{
+	Anope::hash_map<Result>::iterator rit = this->results.find(u->ip);
+	if (rit != this->results.end())
+	{
+		if (rit->second.expires > Anope::CurTime)
+		{
+			++this->stats.cached;
+			if (rit->second.found)
+				ProxyConnect::Ban(u->ip, rit->second.duration, rit->second.reason);
+			return;
+		}
+		this->results.erase(rit);
+	}
+
+	/* Another client from this IP is already being scanned */
+	if (this->scans.count(u->ip))
+		return;
+
+	Target &scan = this->scans[u->ip];
+	for (unsigned i = this->checks.size(); i > 0; --i)
+	{
+		const ProxyCheck &p = this->checks[i - 1];
+
+		for (std::set<Anope::string, ci::less>::const_iterator it = p.types.begin(), it_end = p.types.end(); it != it_end; ++it)
+			for (unsigned k = 0; k < p.ports.size(); ++k)
+			{
+				if (this->queue.size() >= this->max_queue)
+				{
+					++this->stats.dropped;
+					scan.partial = true;
+					continue;
+				}
+
+				Probe probe;
+				probe.ip = u->ip;
+				probe.check = i - 1;
+				probe.type = *it;
+				probe.port = p.ports[k];
+				this->queue.push_back(probe);
+
+				++scan.outstanding;
+				++this->stats.queued;
+			}
+	}
+
+	if (!scan.outstanding)
+		this->scans.erase(u->ip);
+	else
+		this->Drain();
+}
+
+void ProxyScanner::Start(const Probe &p)
+{
+	ProxyCheck &check = this->checks[p.check];
+	ProxyConnect *con = NULL;
+	try
+	{
+		if (p.type.equals_ci("HTTP"))
+			con = new HTTPProxyConnect(check, p.ip, p.port);
+		else if (p.type.equals_ci("SOCKS5"))
+			con = new SOCKS5ProxyConnect(check, p.ip, p.port);
+		else
+		{
+			this->Done(p.ip);
+			return;
+		}
+
+		++this->connections;
+		++this->stats.started;
+		this->open.insert(con);
+
+		/* Reset() sizes the wheel, but may not have been called yet */
+		if (this->wheel.empty())
+			this->wheel.resize(this->timeout + 1);
+
+		time_t deadline = con->created + this->timeout;
+		con->slot = deadline % this->wheel.size();
+		this->wheel[con->slot].insert(con);
+
+		con->Connect(p.ip, p.port);
+	}
+	catch (const SocketException &ex)
+	{
+		Log(LOG_DEBUG) << "m_proxyscan: " << ex.GetReason();
+		if (con)
+			/* This calls Done() */
+			delete con;
+		else
+			this->Done(p.ip);
+	}
+}
+
+void ProxyScanner::Drain()
+{
+	/* Starting a connection may finish another one, which drains again */
+	if (this->draining)
+		return;
+	this->draining = true;
+
+	while (!this->queue.empty() && this->connections < this->max_connections)
+	{
+		Probe p = this->queue.front();
+		this->queue.pop_front();
+
+		/* Nothing left to learn about this IP */
+		Anope::hash_map<Target>::iterator it = this->scans.find(p.ip);
+		if (it != this->scans.end() && it->second.found)
+		{
+			this->Done(p.ip);
+			continue;
+		}
+
+		this->Start(p);
+	}
+
+	this->draining = false;
+}
+
+void ProxyScanner::Done(const Anope::string &ip)
+{
+	Anope::hash_map<Target>::iterator it = this->scans.find(ip);
+	if (it == this->scans.end())
+		return;
+
+	if (--it->second.outstanding)
+		return;
+
+	/* Positive results are cached by Found() */
+	if (!it->second.found && !it->second.partial && this->cache_time)
+	{
+		Result &r = this->results[ip];
+		r.expires = Anope::CurTime + this->cache_time;
+		r.found = false;
+		r.duration = 0;
+	}
+
+	this->scans.erase(it);
+}
+
+void ProxyScanner::Found(ProxyConnect *con, time_t duration, const Anope::string &reason)
+{
+	Anope::hash_map<Target>::iterator it = this->scans.find(con->ip);
+	if (it != this->scans.end())
+	{
+		/* Another check already found a proxy on this IP */
+		if (it->second.found)
+			return;
+		it->second.found = true;
+	}
+
+	++this->stats.positive;
+	ProxyConnect::Ban(con->ip, duration, reason);
+
+	if (this->cache_time)
+	{
+		Result &r = this->results[con->ip];
+		r.expires = Anope::CurTime + this->cache_time;
+		r.found = true;
+		r.duration = duration;
+		r.reason = reason;
+	}
+}
+
+void ProxyScanner::Finished(ProxyConnect *con)
+{
+	if (con->slot >= 0)
+	{
+		this->wheel[con->slot].erase(con);
+		con->slot = -1;
+	}
+
+	if (!this->open.erase(con))
+		return;
+
+	--this->connections;
+	++this->stats.completed;
+
+	this->Done(con->ip);
+	this->Drain();
+}
+
+void ProxyScanner::Expire()
+{
+	if (this->wheel.empty())
+		return;
+
+	/* Deleting a connection frees its slot, which may start queued checks
+	 * in to the buckets being visited, so they are deleted afterwards
+	 */
+	std::vector<ProxyConnect *> expired;
+
+	/* Visit every bucket whose second has passed since the last call, at most once each */
+	time_t from = this->wheel_time + 1;
+	if (Anope::CurTime - from >= static_cast<time_t>(this->wheel.size()))
+		from = Anope::CurTime - this->wheel.size() + 1;
+
+	for (time_t t = from; t <= Anope::CurTime; ++t)
+	{
+		std::set<ProxyConnect *> &bucket = this->wheel[t % this->wheel.size()];
+		for (std::set<ProxyConnect *>::iterator it = bucket.begin(); it != bucket.end();)
+		{
+			ProxyConnect *con = *it;
+
+			if (con->created + this->timeout > Anope::CurTime)
+			{
+				++it;
+				continue;
+			}
+
+			bucket.erase(it++);
+			con->slot = -1;
+			expired.push_back(con);
+		}
+	}
+
+	this->wheel_time = Anope::CurTime;
+
+	/* A port which drops packets would otherwise hold its slot until the kernel gives up connecting */
+	for (unsigned i = 0; i < expired.size(); ++i)
+		delete expired[i];
+}
+
+void ProxyScanner::Reset()
+{
+	for (Anope::hash_map<Target>::iterator it = this->scans.begin(), it_end = this->scans.end(); it != it_end; ++it)
+		it->second.partial = true;
+
+	/* Queued probes refer to checks by index */
+	while (!this->queue.empty())
+	{
+		Anope::string ip = this->queue.front().ip;
+		this->queue.pop_front();
+		this->Done(ip);
+	}
+
+	this->results.clear();
+
+	this->wheel.clear();
+	this->wheel.resize(this->timeout + 1);
+	this->wheel_time = Anope::CurTime;
+
+	for (std::set<ProxyConnect *>::iterator it = this->open.begin(), it_end = this->open.end(); it != it_end; ++it)
+	{
+		ProxyConnect *con = *it;
+		con->slot = (con->created + this->timeout) % this->wheel.size();
+		this->wheel[con->slot].insert(con);
+	}
+}
+
+void ProxyScanner::Shutdown()
+{
+	this->queue.clear();
+	this->max_connections = 0;
+
+	while (!this->open.empty())
+		delete *this->open.begin();
+}
+
 class ModuleProxyScan : public Module
 {
 	Anope::string listen_ip;
 	unsigned short listen_port;
 	Anope::string con_notice, con_source;
-	std::vector<ProxyCheck> proxyscans;
+	ProxyScanner proxyscanner;
 
 	ProxyCallbackListener *listener;
 
 	class ConnectionTimeout : public Timer
 	{
 	 public:
-		ConnectionTimeout(Module *c, long timeout) : Timer(c, timeout, Anope::CurTime, true)
+		ConnectionTimeout(Module *c) : Timer(c, 1, Anope::CurTime, true)
 		{
 		}
 
 		void Tick(time_t) anope_override
 		{
-			for (std::set<ProxyConnect *>::iterator it = ProxyConnect::proxies.begin(), it_end = ProxyConnect::proxies.end(); it != it_end; ++it)
-			{
-				ProxyConnect *p = *it;
-
-				if (p->created + this->GetSecs() < Anope::CurTime)
-					p->flags[SF_DEAD] = true;
-			}
+			scanner->Expire();
 		}
 	} connectionTimeout;
 
+	class StatsTimer : public Timer
+	{
+	 public:
+		StatsTimer(Module *c) : Timer(c, 300, Anope::CurTime, true) { }
+
+		void Tick(time_t) anope_override
+		{
+			ProxyScanner::Stats s = scanner->stats;
+			scanner->stats = ProxyScanner::Stats();
+
+			if (s.queued || s.cached || scanner->connections)
+				Log(LOG_DEBUG) << "m_proxyscan: " << s.queued << " checks queued, " << s.dropped << " dropped, " << s.started << " started, "
+					<< s.completed << " completed, " << s.positive << " positive, " << s.cached << " answered from cache, "
+					<< scanner->connections << " connections open";
+		}
+	} stats_timer;
+
  public:
 	ModuleProxyScan(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR),
-		connectionTimeout(this, 5)
+		connectionTimeout(this), stats_timer(this)
 	{
+		scanner = &this->proxyscanner;
 
 		Implementation i[] = { I_OnReload, I_OnUserConnect };
 		ModuleManager::Attach(i, this, sizeof(i) / sizeof(Implementation));
@@ -233,23 +618,7 @@ class ModuleProxyScan : public Module
 
 	~ModuleProxyScan()
 	{
-		for (std::set<ProxyConnect *>::iterator it = ProxyConnect::proxies.begin(), it_end = ProxyConnect::proxies.end(); it != it_end;)
-		{
-			ProxyConnect *p = *it;
-			++it;
-			delete p;
-		}
-
-		for (std::map<int, Socket *>::const_iterator it = SocketEngine::Sockets.begin(), it_end = SocketEngine::Sockets.end(); it != it_end;)
-		{
-			Socket *s = it->second;
-			++it;
-
-			ClientSocket *cs = dynamic_cast<ClientSocket *>(s);
-			if (cs != NULL && cs->ls == this->listener)
-				delete s;
-		}
-
+		this->proxyscanner.Shutdown();
 		delete this->listener;
 	}
 
@@ -280,7 +649,12 @@ class ModuleProxyScan : public Module
 		this->con_notice = config->Get<const Anope::string &>("connect_notice");
 		this->con_source = config->Get<const Anope::string &>("connect_source");
 		add_to_akill = config->Get<bool>("add_to_akill", "true");
-		this->connectionTimeout.SetSecs(config->Get<time_t>("timeout", "5s"));
+		this->proxyscanner.timeout = config->Get<time_t>("timeout", "5s");
+		this->proxyscanner.max_connections = config->Get<unsigned>("max_connections", "128");
+		this->proxyscanner.max_queue = config->Get<unsigned>("max_queue", "4096");
+		this->proxyscanner.cache_time = config->Get<time_t>("cache_time", "1h");
+		if (!this->proxyscanner.max_connections)
+			this->proxyscanner.max_connections = 1;
 
 		ProxyCheckString = Config->GetBlock("networkinfo")->Get<const Anope::string &>("networkname") + " proxy check";
 		delete this->listener;
@@ -294,7 +668,8 @@ class ModuleProxyScan : public Module
 			throw ConfigException("m_proxyscan: " + ex.GetReason());
 		}
 
-		this->proxyscans.clear();
+		this->proxyscanner.Reset();
+		this->proxyscanner.checks.clear();
 		for (int i = 0; i < conf->CountBlock("proxyscan"); ++i)
 		{
 			Configuration::Block *block = conf->GetBlock("proxyscan", i);
@@ -329,7 +704,7 @@ class ModuleProxyScan : public Module
 			if (p.reason.empty())
 				continue;
 
-			this->proxyscans.push_back(p);
+			this->proxyscanner.checks.push_back(p);
 		}
 	}
 
@@ -357,32 +732,7 @@ class ModuleProxyScan : public Module
 				user->SendMessage(bi, this->con_notice);
 		}
 
-		for (unsigned i = this->proxyscans.size(); i > 0; --i)
-		{
-			ProxyCheck &p = this->proxyscans[i - 1];
-
-			for (std::set<Anope::string, ci::less>::iterator it = p.types.begin(), it_end = p.types.end(); it != it_end; ++it)
-			{
-				for (unsigned k = 0; k < p.ports.size(); ++k)
-				{
-					try
-					{
-						ProxyConnect *con = NULL;
-						if (it->equals_ci("HTTP"))
-							con = new HTTPProxyConnect(p, p.ports[k]);
-						else if (it->equals_ci("SOCKS5"))
-							con = new SOCKS5ProxyConnect(p, p.ports[k]);
-						else
-							continue;
-						con->Connect(user->ip, p.ports[k]);
-					}
-					catch (const SocketException &ex)
-					{
-						Log(LOG_DEBUG) << "m_proxyscan: " << ex.GetReason();
-					}
-				}
-			}
-		}
+		this->proxyscanner.Scan(user);
 	}
 };
 
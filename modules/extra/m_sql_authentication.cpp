@@ -10,7 +10,7 @@ class SQLAuthenticationResult : public SQL::Interface
 	IdentifyRequest *req;
 
  public:
-	SQLAuthenticationResult(User *u, IdentifyRequest *r) : SQL::Interface(me), user(u), req(r)
+	SQLAuthenticationResult(User *u, IdentifyRequest *r) : SQL::Interface(me, PRIORITY_HIGH), user(u), req(r)
 	{
 		req->Hold(me);
 	}
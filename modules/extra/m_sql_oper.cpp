@@ -13,7 +13,7 @@ class SQLOperResult : public SQL::Interface
 	};
 
  public:
-	SQLOperResult(Module *m, User *u) : SQL::Interface(m), user(u) { }
+	SQLOperResult(Module *m, User *u) : SQL::Interface(m, PRIORITY_HIGH), user(u) { }
 
 	void OnResult(const SQL::Result &r) anope_override
 	{
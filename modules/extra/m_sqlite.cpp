@@ -33,25 +33,52 @@ class SQLiteService : public Provider
 {
 	std::map<Anope::string, std::set<Anope::string> > active_schema;
 
+	/** A compiled statement, and the names of the parameters it binds, in order
+	 */
+	struct Statement
+	{
+		sqlite3_stmt *stmt;
+		std::vector<Anope::string> parameters;
+	};
+	/* Prepared statements, keyed by the text of the query they were prepared from */
+	std::map<Anope::string, Statement> statements;
+
 	Anope::string database;
 
 	sqlite3 *sql;
 
-	Anope::string Escape(const Anope::string &query);
+	/** Finds or compiles the statement for a prepared query and binds its parameters
+	 * @return The statement, or NULL if the query can not be run as a prepared statement
+	 */
+	sqlite3_stmt *GetStatement(const Query &query);
+
+	/** Steps through a statement, collecting its rows
+	 */
+	Result Execute(sqlite3_stmt *stmt, const Query &query, const Anope::string &real_query);
 
  public:
 	SQLiteService(Module *o, const Anope::string &n, const Anope::string &d);
 
+	Anope::string Escape(const Anope::string &query);
+
 	~SQLiteService();
 
 	void Run(Interface *i, const Query &query) anope_override;
 
+	void Run(Interface *i, const std::vector<Query> &queries) anope_override;
+
 	Result RunQuery(const Query &query);
 
+	std::vector<Result> RunQuery(const std::vector<Query> &queries) anope_override;
+
 	std::vector<Query> CreateTable(const Anope::string &table, const Data &data) anope_override;
 
 	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data);
 
+	Query BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows) anope_override;
+
+	Query Prepare(const Query &query) anope_override;
+
 	Query GetTables(const Anope::string &prefix);
 
 	Anope::string BuildQuery(const Query &q);
@@ -137,6 +164,8 @@ SQLiteService::SQLiteService(Module *o, const Anope::string &n, const Anope::str
 SQLiteService::~SQLiteService()
 {
 	sqlite3_interrupt(this->sql);
+	for (std::map<Anope::string, Statement>::iterator it = this->statements.begin(), it_end = this->statements.end(); it != it_end; ++it)
+		sqlite3_finalize(it->second.stmt);
 	sqlite3_close(this->sql);
 }
 
@@ -149,14 +178,111 @@ void SQLiteService::Run(Interface *i, const Query &query)
 		i->OnResult(res);
 }
 
+void SQLiteService::Run(Interface *i, const std::vector<Query> &queries)
+{
+	i->OnResults(this->RunQuery(queries));
+}
+
 Result SQLiteService::RunQuery(const Query &query)
 {
+	if (query.prepared)
+	{
+		sqlite3_stmt *stmt = this->GetStatement(query);
+		if (stmt)
+		{
+			Result result = this->Execute(stmt, query, query.query);
+			sqlite3_reset(stmt);
+			sqlite3_clear_bindings(stmt);
+			return result;
+		}
+	}
+
 	Anope::string real_query = this->BuildQuery(query);
 	sqlite3_stmt *stmt;
 	int err = sqlite3_prepare_v2(this->sql, real_query.c_str(), real_query.length(), &stmt, NULL);
 	if (err != SQLITE_OK)
 		return SQLiteResult(query, real_query, sqlite3_errmsg(this->sql));
 
+	Result result = this->Execute(stmt, query, real_query);
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+std::vector<Result> SQLiteService::RunQuery(const std::vector<Query> &queries)
+{
+	std::vector<Result> results;
+
+	Result res = this->RunQuery(Query("BEGIN TRANSACTION"));
+	if (!res.GetError().empty())
+	{
+		results.push_back(res);
+		return results;
+	}
+
+	for (unsigned i = 0; i < queries.size(); ++i)
+	{
+		res = this->RunQuery(queries[i]);
+		results.push_back(res);
+
+		if (!res.GetError().empty())
+		{
+			this->RunQuery(Query("ROLLBACK"));
+			return results;
+		}
+	}
+
+	res = this->RunQuery(Query("COMMIT"));
+	if (!res.GetError().empty())
+		results.push_back(res);
+
+	return results;
+}
+
+sqlite3_stmt *SQLiteService::GetStatement(const Query &query)
+{
+	for (std::map<Anope::string, QueryData>::const_iterator it = query.parameters.begin(), it_end = query.parameters.end(); it != it_end; ++it)
+		if (!it->second.escape)
+			return NULL;
+
+	std::map<Anope::string, Statement>::iterator sit = this->statements.find(query.query);
+	if (sit == this->statements.end())
+	{
+		Placeholders placeholders;
+		const Anope::string &text = query.Substitute(placeholders);
+
+		Statement statement;
+		statement.parameters = placeholders.names;
+
+		if (sqlite3_prepare_v2(this->sql, text.c_str(), text.length(), &statement.stmt, NULL) != SQLITE_OK)
+			return NULL;
+
+		/* Don't let the cache grow without bound if something prepares many different queries */
+		if (this->statements.size() >= 128)
+		{
+			for (sit = this->statements.begin(); sit != this->statements.end(); ++sit)
+				sqlite3_finalize(sit->second.stmt);
+			this->statements.clear();
+		}
+
+		sit = this->statements.insert(std::make_pair(query.query, statement)).first;
+	}
+
+	const Statement &statement = sit->second;
+	for (unsigned i = 0; i < statement.parameters.size(); ++i)
+	{
+		std::map<Anope::string, QueryData>::const_iterator it = query.parameters.find(statement.parameters[i]);
+		if (it != query.parameters.end())
+			sqlite3_bind_text(statement.stmt, i + 1, it->second.data.c_str(), it->second.data.length(), SQLITE_TRANSIENT);
+		else
+			sqlite3_bind_null(statement.stmt, i + 1);
+	}
+
+	return statement.stmt;
+}
+
+Result SQLiteService::Execute(sqlite3_stmt *stmt, const Query &query, const Anope::string &real_query)
+{
+	int err;
 	std::vector<Anope::string> columns;
 	int cols = sqlite3_column_count(stmt);
 	columns.resize(cols);
@@ -179,8 +305,6 @@ Result SQLiteService::RunQuery(const Query &query)
 
 	result.id = sqlite3_last_insert_rowid(this->sql);
 
-	sqlite3_finalize(stmt);
-
 	if (err != SQLITE_DONE)
 		return SQLiteResult(query, real_query, sqlite3_errmsg(this->sql));
 
@@ -287,6 +411,19 @@ Query SQLiteService::BuildInsert(const Anope::string &table, unsigned int id, Da
 	return query;
 }
 
+Query SQLiteService::BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows)
+{
+	std::set<Anope::string> columns = this->active_schema[table];
+	return BuildRows("REPLACE", table, columns, rows);
+}
+
+Query SQLiteService::Prepare(const Query &query)
+{
+	Query q = query;
+	q.prepared = true;
+	return q;
+}
+
 Query SQLiteService::GetTables(const Anope::string &prefix)
 {
 	return Query("SELECT name FROM sqlite_master WHERE type='table' AND name LIKE '" + prefix + "%';");
@@ -302,12 +439,8 @@ Anope::string SQLiteService::Escape(const Anope::string &query)
 
 Anope::string SQLiteService::BuildQuery(const Query &q)
 {
-	Anope::string real_query = q.query;
-
-	for (std::map<Anope::string, QueryData>::const_iterator it = q.parameters.begin(), it_end = q.parameters.end(); it != it_end; ++it)
-		real_query = real_query.replace_all_cs("@" + it->first + "@", (it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data));
-
-	return real_query;
+	Quote<SQLiteService> quote(this);
+	return q.Substitute(quote);
 }
 
 Anope::string SQLiteService::FromUnixtime(time_t t)
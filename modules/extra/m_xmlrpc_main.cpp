@@ -59,6 +59,8 @@ class MyXMLRPCEvent : public XMLRPCEvent
 			this->DoUser(iface, client, request);
 		else if (request.name == "opers")
 			this->DoOperType(iface, client, request);
+		else if (request.name == "list")
+			this->DoList(iface, client, request);
 
 		return true;
 	}
@@ -250,6 +252,72 @@ class MyXMLRPCEvent : public XMLRPCEvent
 			request.reply(ot->GetName(), perms);
 		}
 	}
+
+	/* Lists registered nicks or channels matching a pattern, in name order. A list
+	 * which stops early returns the name to continue after in "next".
+	 */
+	void DoList(XMLRPCServiceInterface *iface, HTTPClient *client, XMLRPCRequest &request)
+	{
+		Anope::string type = request.data.size() > 0 ? request.data[0] : "";
+		Anope::string pattern = request.data.size() > 1 && !request.data[1].empty() ? request.data[1] : "*";
+		Anope::string after = request.data.size() > 2 ? request.data[2] : "";
+		unsigned max = 50;
+
+		if (request.data.size() > 3)
+		{
+			try
+			{
+				max = convertTo<unsigned>(request.data[3]);
+			}
+			catch (const ConvertException &) { }
+		}
+
+		/* An empty page would have nothing to continue after */
+		if (!max)
+			max = 1;
+
+		if (type == "nicks")
+			this->ListNames(iface, request, *OrderedNickAliasList, pattern, after, max);
+		else if (type == "channels")
+			this->ListNames(iface, request, *OrderedRegisteredChannelList, pattern, after, max);
+		else
+			request.reply("error", "Invalid parameters");
+	}
+
+	/* Whether a name is shown by list, the same as is shown to non admins by NickServ and ChanServ's LIST */
+	static bool Listed(const NickAlias *na)
+	{
+		return !na->nc->HasExt("PRIVATE");
+	}
+
+	static bool Listed(const ChannelInfo *ci)
+	{
+		return !ci->HasExt("PRIVATE") && !ci->HasExt("SUSPENDED");
+	}
+
+	template<typename T> void ListNames(XMLRPCServiceInterface *iface, XMLRPCRequest &request, const Anope::map<T> &names, const Anope::string &pattern, const Anope::string &after, unsigned max)
+	{
+		const Anope::string &prefix = Anope::LiteralPrefix(pattern, true);
+		Anope::string last;
+		unsigned count = 0;
+
+		for (typename Anope::map<T>::const_iterator it = names.lower_bound_prefix(prefix, after), it_end = names.end(); it != it_end && it->first.starts_with_ci(prefix); ++it)
+		{
+			if (!Anope::Match(it->first, pattern, false, true) || !Listed(it->second))
+				continue;
+
+			if (count == max)
+			{
+				request.reply("next", iface->Sanitize(last));
+				break;
+			}
+
+			last = it->first;
+			request.reply("name" + stringify(++count), iface->Sanitize(last));
+		}
+
+		request.reply("count", stringify(count));
+	}
 };
 
 class ModuleXMLRPCMain : public Module
@@ -0,0 +1,52 @@
+/*
+ * (C) 2003-2013 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+#include "../../webcpanel.h"
+
+WebCPanel::ChanServ::List::List(const Anope::string &cat, const Anope::string &u) : WebPanelProtectedPage(cat, u)
+{
+}
+
+bool WebCPanel::ChanServ::List::OnRequest(HTTPProvider *server, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply, NickAlias *na, TemplateFileServer::Replacements &replacements)
+{
+	Anope::string pattern = HTTPUtils::URLDecode(message.get_data["pattern"]), after = HTTPUtils::URLDecode(message.get_data["after"]);
+	if (pattern.empty())
+		pattern = "*";
+	bool is_servadmin = na->nc->IsServicesOper() && na->nc->o->ot->HasCommand("chanserv/list");
+	unsigned listmax = Config->GetModule("cs_list")->Get<unsigned>("listmax", "50"), count = 0;
+
+	replacements["PATTERN"] = HTTPUtils::Escape(pattern);
+
+	/* Pages through the channels in name order, like ChanServ's LIST ... AFTER */
+	const Anope::string &prefix = Anope::LiteralPrefix(pattern, true);
+	Anope::string last;
+	for (ordered_registered_channel_map::const_iterator it = OrderedRegisteredChannelList->lower_bound_prefix(prefix, after), it_end = OrderedRegisteredChannelList->end(); it != it_end && it->first.starts_with_ci(prefix); ++it)
+	{
+		const ChannelInfo *ci = it->second;
+
+		if (!is_servadmin && (ci->HasExt("PRIVATE") || ci->HasExt("SUSPENDED")))
+			continue;
+		else if (!Anope::Match(ci->name, pattern, false, true))
+			continue;
+
+		if (count++ == listmax)
+		{
+			replacements["NEXT"] = HTTPUtils::URLEncode(last);
+			break;
+		}
+
+		replacements["CHANNEL_NAMES"] = HTTPUtils::Escape(ci->name);
+		replacements["DESCRIPTIONS"] = ci->HasExt("SUSPENDED") ? "[Suspended]" : HTTPUtils::Escape(ci->desc);
+		last = ci->name;
+	}
+
+	replacements["ESCAPED_PATTERN"] = HTTPUtils::URLEncode(pattern);
+
+	TemplateFileServer page("chanserv/list.html");
+	page.Serve(server, page_name, client, message, reply, replacements);
+	return true;
+}
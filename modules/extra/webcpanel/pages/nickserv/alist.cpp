@@ -15,6 +15,7 @@ bool WebCPanel::NickServ::Alist::OnRequest(HTTPProvider *server, const Anope::st
 {
 	int chan_count = 0;
 
+	/* Every channel is walked, as access from wildcard masks does not reference the account */
 	for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end(); it != it_end; ++it)
 	{
 		ChannelInfo *ci = it->second;
@@ -29,7 +30,11 @@ bool WebCPanel::NickServ::Alist::OnRequest(HTTPProvider *server, const Anope::st
 			continue;
 		}
 
-		AccessGroup access = ci->AccessFor(na->nc);
+		std::vector<ChanAccess *> access;
+		na->nc->GetAccessReferences(ci, access);
+		/* Fall back to the entries whose masks match the account */
+		if (access.empty())
+			access = ci->AccessFor(na->nc);
 		if (access.empty())
 			continue;
 				
@@ -38,8 +43,8 @@ bool WebCPanel::NickServ::Alist::OnRequest(HTTPProvider *server, const Anope::st
 		replacements["NUMBERS"] = stringify(chan_count);
 		replacements["CHANNELS"] = (ci->HasExt("NO_EXPIRE") ? "!" : "") + ci->name;
 		Anope::string access_str;
-		for (unsigned i = 0; i < access.size(); ++i)
-			access_str += ", " + access[i]->AccessSerialize();
+		for (unsigned j = 0; j < access.size(); ++j)
+			access_str += ", " + access[j]->AccessSerialize();
 		replacements["ACCESSES"] = access_str.substr(2);
 	}
 
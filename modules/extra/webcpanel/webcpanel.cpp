@@ -32,6 +32,7 @@ class ModuleWebCPanel : public Module
 	WebCPanel::ChanServ::Access chanserv_access;
 	WebCPanel::ChanServ::Akick chanserv_akick;
 	WebCPanel::ChanServ::Drop chanserv_drop;
+	WebCPanel::ChanServ::List chanserv_list;
 
 	WebCPanel::MemoServ::Memos memoserv_memos;
 
@@ -47,7 +48,7 @@ class ModuleWebCPanel : public Module
 		index("/"), logout("/logout"), _register("/register"), confirm("/confirm"),
 		nickserv_info("NickServ", "/nickserv/info"), nickserv_cert("NickServ", "/nickserv/cert"), nickserv_access("NickServ", "/nickserv/access"), nickserv_alist("NickServ", "/nickserv/alist"),
 		chanserv_info("ChanServ", "/chanserv/info"), chanserv_set("ChanServ", "/chanserv/set"), chanserv_access("ChanServ", "/chanserv/access"), chanserv_akick("ChanServ", "/chanserv/akick"),
-		chanserv_drop("ChanServ", "/chanserv/drop"), memoserv_memos("MemoServ", "/memoserv/memos"), hostserv_request("HostServ", "/hostserv/request"), operserv_akill("OperServ", "/operserv/akill")
+		chanserv_drop("ChanServ", "/chanserv/drop"), chanserv_list("ChanServ", "/chanserv/list"), memoserv_memos("MemoServ", "/memoserv/memos"), hostserv_request("HostServ", "/hostserv/request"), operserv_akill("OperServ", "/operserv/akill")
 	{
 
 		me = this;
@@ -135,6 +136,11 @@ class ModuleWebCPanel : public Module
 			s.subsections.push_back(ss);
 			provider->RegisterPage(&this->chanserv_drop);
 
+			ss.name = "List";
+			ss.url = "/chanserv/list";
+			s.subsections.push_back(ss);
+			provider->RegisterPage(&this->chanserv_list);
+
 			panel.sections.push_back(s);
 		}
 
@@ -205,6 +211,7 @@ class ModuleWebCPanel : public Module
 			provider->UnregisterPage(&this->chanserv_access);
 			provider->UnregisterPage(&this->chanserv_akick);
 			provider->UnregisterPage(&this->chanserv_drop);
+			provider->UnregisterPage(&this->chanserv_list);
 
 			provider->UnregisterPage(&this->memoserv_memos);
 			
@@ -166,6 +166,7 @@ namespace WebPanel
 #include "pages/chanserv/access.h"
 #include "pages/chanserv/akick.h"
 #include "pages/chanserv/drop.h"
+#include "pages/chanserv/list.h"
 
 #include "pages/memoserv/memos.h"
 
@@ -13,6 +13,10 @@
 #include "module.h"
 #include "modules/dns.h"
 
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
 using namespace DNS;
 
 namespace
@@ -20,6 +24,14 @@ namespace
 	Anope::string admin, nameservers;
 	int refresh;
 	time_t timeout;
+	/* The most answers to cache, and roughly the most memory to use for them, 0 for no limit */
+	unsigned long cache_size, cache_memory;
+}
+
+/* Milliseconds between two times */
+static long Elapsed(const timeval &from, const timeval &to)
+{
+	return (to.tv_sec - from.tv_sec) * 1000 + (to.tv_usec - from.tv_usec) / 1000;
 }
 
 /** A full packet sent or recieved to/from the nameserver
@@ -135,9 +147,13 @@ class Packet : public Query
 		record.ttl = (input[pos] << 24) | (input[pos + 1] << 16) | (input[pos + 2] << 8) | input[pos + 3];
 		pos += 4;
 
-		//record.rdlength = input[pos] << 8 | input[pos + 1];
+		unsigned short rdlength = input[pos] << 8 | input[pos + 1];
 		pos += 2;
 
+		if (pos + rdlength > input_size)
+			throw SocketException("Unable to unpack resource record");
+		unsigned short rdend = pos + rdlength;
+
 		switch (record.type)
 		{
 			case QUERY_A:
@@ -177,10 +193,26 @@ class Packet : public Query
 				record.rdata = this->UnpackName(input, input_size, pos);
 				break;
 			}
+			case QUERY_SOA:
+			{
+				/* Kept in zone file form, the minimum is needed for negative caching */
+				record.rdata = this->UnpackName(input, input_size, pos);
+				record.rdata += " " + this->UnpackName(input, input_size, pos);
+
+				if (pos + 20 > input_size)
+					throw SocketException("Unable to unpack resource record");
+
+				for (int i = 0; i < 5; ++i, pos += 4)
+					record.rdata += " " + stringify(static_cast<uint32_t>(input[pos]) << 24 | input[pos + 1] << 16 | input[pos + 2] << 8 | input[pos + 3]);
+				break;
+			}
 			default:
 				break;
 		}
 
+		/* Skip anything in the record we don't know how to unpack */
+		pos = rdend;
+
 		Log(LOG_DEBUG_2) << "Resolver: " << record.name << " -> " << record.rdata;
 
 		return record;
@@ -606,18 +638,85 @@ class MyManager : public Manager, public Timer
 {
 	uint32_t serial;
 
-	typedef std::tr1::unordered_map<Question, Query, Question::hash> cache_map;
+	/* Cached questions, in order of when they expire */
+	typedef std::multimap<time_t, const Question *> expiry_map;
+	expiry_map expiry;
+	/* Cached questions, most recently used first */
+	typedef std::list<const Question *> lru_list;
+	lru_list lru;
+
+	/** A cached answer, or a cached error for negative caching
+	 */
+	struct CacheEntry
+	{
+		Query query;
+		time_t expires;
+		/* Roughly how much memory this uses */
+		size_t size;
+		expiry_map::iterator expiry_it;
+		lru_list::iterator lru_it;
+	};
+	typedef std::tr1::unordered_map<Question, CacheEntry, Question::hash> cache_map;
 	cache_map cache;
 
+	/* The id of the query in flight for each question, so identical requests can share it */
+	typedef std::tr1::unordered_map<Question, unsigned short, Question::hash> inflight_map;
+	inflight_map inflight;
+
+	/** An upstream nameserver queries are sent to
+	 */
+	struct Upstream
+	{
+		sockaddrs addr;
+		/* Whether srtt has a sample yet, and the variation in round trip times */
+		bool measured;
+		long rttvar;
+		/* The last time a query was sent to it */
+		time_t last_sent;
+		Stats::Nameserver stats;
+
+		Upstream() : measured(false), rttvar(0), last_sent(0) { }
+	};
+	std::vector<Upstream> upstreams;
+
+	/** A query which has been sent and not answered
+	 */
+	struct Flight
+	{
+		Question question;
+		/* The nameservers it was sent to, hedge is -1 until it is sent to a second one */
+		int primary, hedge;
+		timeval sent, hedged;
+	};
+	std::map<unsigned short, Flight> flights;
+
+	/** Sends queries which are taking longer than expected to a second nameserver
+	 */
+	class HedgeTimer : public Timer
+	{
+		MyManager *manager;
+	 public:
+		HedgeTimer(MyManager *m) : Timer(1, Anope::CurTime, true), manager(m) { }
+
+		void Tick(time_t) anope_override
+		{
+			manager->Hedge();
+			manager->Decay();
+		}
+	} hedge_timer;
+
 	TCPSocket *tcpsock;
 	UDPSocket *udpsock;
 
 	bool listen;
-	sockaddrs addrs;
  public:
-	std::map<unsigned short, Request *> requests;
+	/* Requests waiting on a reply, by the id of the query they are waiting on */
+	typedef std::multimap<unsigned short, Request *> request_map;
+	request_map requests;
+
+	Stats stats;
 
-	MyManager(Module *creator) : Manager(creator), Timer(300, Anope::CurTime, true), serial(Anope::CurTime), tcpsock(NULL), udpsock(NULL), listen(false)
+	MyManager(Module *creator) : Manager(creator), Timer(60, Anope::CurTime, true), serial(Anope::CurTime), hedge_timer(this), tcpsock(NULL), udpsock(NULL), listen(false)
 	{
 	}
 
@@ -626,7 +725,7 @@ class MyManager : public Manager, public Timer
 		delete udpsock;
 		delete tcpsock;
 
-		for (std::map<unsigned short, Request *>::iterator it = this->requests.begin(), it_end = this->requests.end(); it != it_end;)
+		for (request_map::iterator it = this->requests.begin(), it_end = this->requests.end(); it != it_end;)
 		{	
 			Request *request = it->second;
 			++it;
@@ -640,9 +739,11 @@ class MyManager : public Manager, public Timer
 		this->requests.clear();
 
 		this->cache.clear();
+		this->expiry.clear();
+		this->lru.clear();
 	}
 
-	void SetIPPort(const Anope::string &nameserver, const Anope::string &ip, unsigned short port)
+	void SetIPPort(const std::vector<Anope::string> &servers, const Anope::string &ip, unsigned short port)
 	{
 		delete udpsock;
 		delete tcpsock;
@@ -650,10 +751,36 @@ class MyManager : public Manager, public Timer
 		udpsock = NULL;
 		tcpsock = NULL;
 
-		try
+		/* Keep what has been measured about nameservers which are still configured */
+		std::vector<Upstream> old_upstreams;
+		old_upstreams.swap(this->upstreams);
+		for (unsigned i = 0; i < servers.size(); ++i)
 		{
-			this->addrs.pton(nameserver.find(':') != Anope::string::npos ? AF_INET6 : AF_INET, nameserver, 53);
+			Upstream upstream;
+			try
+			{
+				upstream.addr.pton(servers[i].find(':') != Anope::string::npos ? AF_INET6 : AF_INET, servers[i], 53);
+			}
+			catch (const SocketException &ex)
+			{
+				Log() << "Invalid nameserver " << servers[i] << ": " << ex.GetReason();
+				continue;
+			}
 
+			upstream.stats.addr = upstream.addr.addr();
+			for (unsigned j = 0; j < old_upstreams.size(); ++j)
+				if (old_upstreams[j].addr == upstream.addr)
+					upstream = old_upstreams[j];
+
+			this->upstreams.push_back(upstream);
+		}
+
+		/* Queries in flight can't be matched to their nameservers anymore, let them time out */
+		this->flights.clear();
+		this->inflight.clear();
+
+		try
+		{
 			udpsock = new UDPSocket(this, ip, port);
 
 			if (!ip.empty())
@@ -676,13 +803,32 @@ class MyManager : public Manager, public Timer
 		if (req->use_cache && this->CheckCache(req))
 		{
 			Log(LOG_DEBUG_2) << "Resolver: Using cached result";
+			++this->stats.hits;
 			delete req;
 			return;
 		}
 
+		++this->stats.misses;
+
+		/* Wait on the same query if this question has already been asked */
+		inflight_map::iterator it = this->inflight.find(*req);
+		if (it != this->inflight.end())
+		{
+			Log(LOG_DEBUG_2) << "Resolver: Waiting on query " << it->second << " already in flight for " << req->name;
+			++this->stats.coalesced;
+
+			req->id = it->second;
+			this->requests.insert(std::make_pair(req->id, req));
+			req->SetSecs(timeout);
+			return;
+		}
+
 		if (!this->udpsock)
 			throw SocketException("No dns socket");
 
+		if (this->upstreams.empty())
+			throw SocketException("No nameservers");
+
 		if (this->udpsock->GetPackets().size() == 65535)
 			throw SocketException("DNS queue full");
 
@@ -693,21 +839,91 @@ class MyManager : public Manager, public Timer
 		}
 		while (!req->id || this->requests.count(req->id));
 
-		this->requests[req->id] = req;
+		this->requests.insert(std::make_pair(req->id, req));
+		this->inflight[*req] = req->id;
 
 		req->SetSecs(timeout);
-	
-		Packet *p = new Packet(this, &this->addrs);
-		p->flags = QUERYFLAGS_RD;
-		p->id = req->id;
-		p->questions.push_back(*req);
 
-		this->udpsock->Reply(p);
+		Flight &flight = this->flights[req->id];
+		flight.question = *req;
+		flight.primary = this->PickNameserver(-1);
+		flight.hedge = -1;
+		gettimeofday(&flight.sent, NULL);
+
+		this->Send(req->id, flight.question, flight.primary);
 	}
 
 	void RemoveRequest(Request *req) anope_override
 	{
-		this->requests.erase(req->id);
+		std::pair<request_map::iterator, request_map::iterator> range = this->requests.equal_range(req->id);
+		for (request_map::iterator it = range.first; it != range.second; ++it)
+			if (it->second == req)
+			{
+				this->requests.erase(it);
+				break;
+			}
+
+		/* Stop other requests from waiting on this query once nothing is */
+		if (!this->requests.count(req->id))
+		{
+			inflight_map::iterator it = this->inflight.find(*req);
+			if (it != this->inflight.end() && it->second == req->id)
+				this->inflight.erase(it);
+
+			/* Everything waiting on it gave up, so count it against the nameservers it was sent to */
+			std::map<unsigned short, Flight>::iterator fit = this->flights.find(req->id);
+			if (fit != this->flights.end())
+			{
+				this->RecordTimeout(fit->second.primary);
+				if (fit->second.hedge != -1)
+					this->RecordTimeout(fit->second.hedge);
+				this->flights.erase(fit);
+			}
+		}
+	}
+
+	/** Send a query to a second nameserver if the first is taking longer than
+	 * it usually does to answer
+	 */
+	void Hedge()
+	{
+		if (this->upstreams.size() < 2 || !this->udpsock)
+			return;
+
+		timeval now;
+		gettimeofday(&now, NULL);
+
+		for (std::map<unsigned short, Flight>::iterator it = this->flights.begin(), it_end = this->flights.end(); it != it_end; ++it)
+		{
+			Flight &flight = it->second;
+			if (flight.hedge != -1)
+				continue;
+
+			/* Allow the usual round trip time plus a margin for its variation, as TCP does for retransmits */
+			const Upstream &primary = this->upstreams[flight.primary];
+			long delay = primary.measured ? std::max(primary.stats.srtt + 4 * primary.rttvar, 100L) : 1000;
+			if (Elapsed(flight.sent, now) < delay)
+				continue;
+
+			flight.hedge = this->PickNameserver(flight.primary);
+			flight.hedged = now;
+
+			Log(LOG_DEBUG_2) << "Resolver: Query " << it->first << " for " << flight.question.name << " also sent to " << this->upstreams[flight.hedge].stats.addr;
+			this->Send(it->first, flight.question, flight.hedge);
+		}
+	}
+
+	/** Lower the round trip time of nameservers which are not being used, so one which
+	 * is avoided after timing out is tried again later instead of never being picked
+	 */
+	void Decay()
+	{
+		for (unsigned i = 0; i < this->upstreams.size(); ++i)
+		{
+			Upstream &upstream = this->upstreams[i];
+			if (upstream.measured && upstream.last_sent < Anope::CurTime && upstream.stats.srtt > 0)
+				upstream.stats.srtt -= std::max(upstream.stats.srtt / 32, 1L);
+		}
 	}
 
 	bool HandlePacket(ReplySocket *s, const unsigned char *const packet_buffer, int length, sockaddrs *from) anope_override
@@ -792,29 +1008,50 @@ class MyManager : public Manager, public Timer
 			Log(LOG_DEBUG_2) << "Resolver: Received an answer over TCP. This is not supported.";
 			return true;
 		}
-		else if (this->addrs != *from)
+
+		/* Answers after the first to a hedged query end up here too */
+		std::map<unsigned short, Flight>::iterator fit = this->flights.find(recv_packet.id);
+		std::pair<request_map::iterator, request_map::iterator> range = this->requests.equal_range(recv_packet.id);
+		if (fit == this->flights.end() || range.first == range.second)
 		{
-			Log(LOG_DEBUG_2) << "Resolver: Received an answer from the wrong nameserver, Bad NAT or DNS forging attempt? '" << this->addrs.addr() << "' != '" << from->addr() << "'";
+			Log(LOG_DEBUG_2) << "Resolver: Received an answer for something we didn't request";
 			return true;
 		}
 
-		std::map<unsigned short, Request *>::iterator it = this->requests.find(recv_packet.id);
-		if (it == this->requests.end())
+		Flight &flight = fit->second;
+		int server = this->upstreams[flight.primary].addr == *from ? flight.primary : (flight.hedge != -1 && this->upstreams[flight.hedge].addr == *from ? flight.hedge : -1);
+		if (server == -1)
 		{
-			Log(LOG_DEBUG_2) << "Resolver: Received an answer for something we didn't request";
+			Log(LOG_DEBUG_2) << "Resolver: Received an answer from the wrong nameserver, Bad NAT or DNS forging attempt? '" << this->upstreams[flight.primary].stats.addr << "' != '" << from->addr() << "'";
 			return true;
 		}
-		Request *request = it->second;
+
+		timeval now;
+		gettimeofday(&now, NULL);
+		this->RecordAnswer(server, Elapsed(server == flight.primary ? flight.sent : flight.hedged, now));
+		this->flights.erase(fit);
+
+		/* Every request waiting on this query gets the answer. Take them all out first, deleting them removes them */
+		std::vector<Request *> waiting;
+		for (request_map::iterator it = range.first; it != range.second; ++it)
+			waiting.push_back(it->second);
+		this->requests.erase(range.first, range.second);
+
+		Question question = *waiting[0];
+		inflight_map::iterator iit = this->inflight.find(question);
+		if (iit != this->inflight.end() && iit->second == recv_packet.id)
+			this->inflight.erase(iit);
+
+		Error error = ERROR_NONE;
 
 		if (recv_packet.flags & QUERYFLAGS_OPCODE)
 		{
 			Log(LOG_DEBUG_2) << "Resolver: Received a nonstandard query";
-			recv_packet.error = ERROR_NONSTANDARD_QUERY;
-			request->OnError(&recv_packet);
+			error = ERROR_NONSTANDARD_QUERY;
 		}
 		else if (recv_packet.flags & QUERYFLAGS_RCODE)
 		{
-			Error error = ERROR_UNKNOWN;
+			error = ERROR_UNKNOWN;
 
 			switch (recv_packet.flags & QUERYFLAGS_RCODE)
 			{
@@ -841,24 +1078,32 @@ class MyManager : public Manager, public Timer
 				default:
 					break;
 			}
-
-			recv_packet.error = error;
-			request->OnError(&recv_packet);
 		}
 		else if (recv_packet.questions.empty() || recv_packet.answers.empty())
 		{
 			Log(LOG_DEBUG_2) << "Resolver: No resource records returned";
-			recv_packet.error = ERROR_NO_RECORDS;
-			request->OnError(&recv_packet);
+			error = ERROR_NO_RECORDS;
 		}
-		else
+
+		recv_packet.error = error;
+		if (error == ERROR_NONE || error == ERROR_DOMAIN_NOT_FOUND || error == ERROR_NO_RECORDS)
+			this->AddCache(question, recv_packet);
+
+		for (unsigned i = 0; i < waiting.size(); ++i)
 		{
-			Log(LOG_DEBUG_2) << "Resolver: Lookup complete for " << request->name;
-			request->OnLookupComplete(&recv_packet);
-			this->AddCache(recv_packet);
+			Request *request = waiting[i];
+
+			if (error != ERROR_NONE)
+				request->OnError(&recv_packet);
+			else
+			{
+				Log(LOG_DEBUG_2) << "Resolver: Lookup complete for " << request->name;
+				request->OnLookupComplete(&recv_packet);
+			}
+
+			delete request;
 		}
-	
-		delete request;
+
 		return true;
 	}
 
@@ -872,31 +1117,184 @@ class MyManager : public Manager, public Timer
 		return serial;
 	}
 
-	void Tick(time_t now) anope_override
+	Stats GetStats() const anope_override
 	{
-		Log(LOG_DEBUG_2) << "Resolver: Purging DNS cache";
+		Stats s = this->stats;
+		for (unsigned i = 0; i < this->upstreams.size(); ++i)
+			s.nameservers.push_back(this->upstreams[i].stats);
+		return s;
+	}
 
-		for (cache_map::iterator it = this->cache.begin(), it_next; it != this->cache.end(); it = it_next)
+	void Tick(time_t now) anope_override
+	{
+		/* Only the entries which have expired need to be looked at */
+		while (!this->expiry.empty() && this->expiry.begin()->first < now)
 		{
-			const Query &q = it->second;
-			const ResourceRecord &req = q.answers[0];
-			it_next = it;
-			++it_next;
+			this->RemoveCache(this->cache.find(*this->expiry.begin()->second));
+			++this->stats.expired;
+		}
+
+		this->TrimCache();
+
+		Log(LOG_DEBUG_2) << "Resolver: " << this->stats.cache_entries << " cached answers using " << this->stats.cache_bytes << " bytes, " << this->stats.hits << " cache hits, " << this->stats.misses << " cache misses, " << this->stats.coalesced << " requests sharing a query";
+	}
 
-			if (req.created + static_cast<time_t>(req.ttl) < now)
-				this->cache.erase(it);
+	/** Evict the least recently used answers until the cache is within its limits
+	 */
+	void TrimCache()
+	{
+		while (!this->lru.empty() && ((cache_size && this->stats.cache_entries > cache_size) || (cache_memory && this->stats.cache_bytes > cache_memory)))
+		{
+			this->RemoveCache(this->cache.find(*this->lru.back()));
+			++this->stats.evicted;
 		}
 	}
 	
  private:
-	/** Add a record to the dns cache
-	 * @param r The record
+	/** Find the nameserver expected to answer the fastest
+	 * @param exclude A nameserver not to pick, or -1
+	 */
+	int PickNameserver(int exclude) const
+	{
+		int best = -1;
+
+		/* Nameservers which have not been measured yet are tried first */
+		for (unsigned i = 0; i < this->upstreams.size(); ++i)
+			if (static_cast<int>(i) != exclude && (best == -1 || this->upstreams[i].stats.srtt < this->upstreams[best].stats.srtt))
+				best = i;
+
+		return best;
+	}
+
+	void Send(unsigned short id, const Question &q, int server)
+	{
+		Upstream &upstream = this->upstreams[server];
+		++upstream.stats.queries;
+		upstream.last_sent = Anope::CurTime;
+
+		Packet *p = new Packet(this, &upstream.addr);
+		p->flags = QUERYFLAGS_RD;
+		p->id = id;
+		p->questions.push_back(q);
+
+		this->udpsock->Reply(p);
+	}
+
+	void RecordAnswer(int server, long rtt)
+	{
+		Upstream &upstream = this->upstreams[server];
+		++upstream.stats.answers;
+
+		int bucket = 0;
+		while (bucket < Stats::LATENCY_BUCKETS - 1 && rtt >= Stats::LatencyBound(bucket))
+			++bucket;
+		++upstream.stats.latency[bucket];
+
+		this->Measure(upstream, rtt);
+	}
+
+	void RecordTimeout(int server)
+	{
+		Upstream &upstream = this->upstreams[server];
+		++upstream.stats.timeouts;
+
+		/* Treat it as having taken the whole timeout, so slow or dead nameservers are avoided */
+		this->Measure(upstream, timeout * 1000);
+	}
+
+	/* Smooths round trip times the way TCP does (RFC 6298) */
+	void Measure(Upstream &upstream, long rtt)
+	{
+		if (!upstream.measured)
+		{
+			upstream.measured = true;
+			upstream.stats.srtt = rtt;
+			upstream.rttvar = rtt / 2;
+		}
+		else
+		{
+			upstream.rttvar = (3 * upstream.rttvar + std::abs(upstream.stats.srtt - rtt)) / 4;
+			upstream.stats.srtt = (7 * upstream.stats.srtt + rtt) / 8;
+		}
+	}
+
+	void RemoveCache(cache_map::iterator it)
+	{
+		CacheEntry &entry = it->second;
+
+		this->expiry.erase(entry.expiry_it);
+		this->lru.erase(entry.lru_it);
+		--this->stats.cache_entries;
+		this->stats.cache_bytes -= entry.size;
+
+		this->cache.erase(it);
+	}
+
+	/** Add an answer to the dns cache. Failed lookups are cached for
+	 * the time the zone's SOA record says they may be (RFC 2308).
+	 * @param q The question asked
+	 * @param r The answer
 	 */
-	void AddCache(Query &r)
+	void AddCache(const Question &q, const Query &r)
 	{
-		const ResourceRecord &rr = r.answers[0];
-		Log(LOG_DEBUG_3) << "Resolver cache: added cache for " << rr.name << " -> " << rr.rdata << ", ttl: " << rr.ttl;
-		this->cache[r.questions[0]] = r;
+		CacheEntry entry;
+		entry.query = r;
+
+		if (r.error == ERROR_NONE)
+		{
+			unsigned int ttl = r.answers[0].ttl;
+			for (unsigned i = 1; i < r.answers.size(); ++i)
+				ttl = std::min(ttl, r.answers[i].ttl);
+
+			entry.expires = Anope::CurTime + ttl;
+			Log(LOG_DEBUG_3) << "Resolver cache: added cache for " << q.name << " -> " << r.answers[0].rdata << ", ttl: " << ttl;
+		}
+		else
+		{
+			const ResourceRecord *soa = NULL;
+			for (unsigned i = 0; !soa && i < r.authorities.size(); ++i)
+				if (r.authorities[i].type == QUERY_SOA)
+					soa = &r.authorities[i];
+
+			/* Without an SOA there is no way to know how long the answer is good for */
+			if (!soa)
+				return;
+
+			std::vector<Anope::string> fields;
+			spacesepstream(soa->rdata).GetTokens(fields);
+			if (fields.size() != 7)
+				return;
+
+			unsigned int ttl = std::min(soa->ttl, convertTo<unsigned int>(fields[6]));
+			if (!ttl)
+				return;
+
+			entry.expires = Anope::CurTime + ttl;
+			Log(LOG_DEBUG_3) << "Resolver cache: added negative cache for " << q.name << ", ttl: " << ttl;
+		}
+
+		cache_map::iterator it = this->cache.find(q);
+		if (it != this->cache.end())
+			this->RemoveCache(it);
+
+		entry.size = sizeof(CacheEntry) + q.name.length();
+		for (unsigned i = 0; i < r.questions.size(); ++i)
+			entry.size += sizeof(Question) + r.questions[i].name.length();
+		const std::vector<ResourceRecord> *records[] = { &r.answers, &r.authorities, &r.additional };
+		for (int i = 0; i < 3; ++i)
+			for (unsigned j = 0; j < records[i]->size(); ++j)
+				entry.size += sizeof(ResourceRecord) + (*records[i])[j].name.length() + (*records[i])[j].rdata.length();
+
+		it = this->cache.insert(std::make_pair(q, entry)).first;
+		const Question *key = &it->first;
+		it->second.expiry_it = this->expiry.insert(std::make_pair(entry.expires, key));
+		this->lru.push_front(key);
+		it->second.lru_it = this->lru.begin();
+
+		++this->stats.cache_entries;
+		this->stats.cache_bytes += entry.size;
+
+		this->TrimCache();
 	}
 
 	/** Check the DNS cache to see if request can be handled by a cached result
@@ -905,15 +1303,25 @@ class MyManager : public Manager, public Timer
 	bool CheckCache(Request *request)
 	{
 		cache_map::iterator it = this->cache.find(*request);
-		if (it != this->cache.end())
+		if (it == this->cache.end())
+			return false;
+
+		if (it->second.expires < Anope::CurTime)
 		{
-			Query &record = it->second;
-			Log(LOG_DEBUG_3) << "Resolver: Using cached result for " << request->name;
-			request->OnLookupComplete(&record);
-			return true;
+			this->RemoveCache(it);
+			++this->stats.expired;
+			return false;
 		}
 
-		return false;
+		this->lru.splice(this->lru.begin(), this->lru, it->second.lru_it);
+
+		const Query &record = it->second.query;
+		Log(LOG_DEBUG_3) << "Resolver: Using cached result for " << request->name;
+		if (record.error != ERROR_NONE)
+			request->OnError(&record);
+		else
+			request->OnLookupComplete(&record);
+		return true;
 	}
   
 };
@@ -945,45 +1353,42 @@ class ModuleDNS : public Module
 		admin = block->Get<const Anope::string &>("admin", "admin@example.com");
 		nameservers = block->Get<const Anope::string &>("nameservers", "ns1.example.com");
 		refresh = block->Get<int>("refresh", "3600");
+		cache_size = block->Get<unsigned long>("cachesize", "10000");
+		cache_memory = block->Get<unsigned long>("cachememory", "8192") * 1024;
 
-		if (Anope::IsFile(nameserver))
+		/* This may be a list of nameservers, or resolver configuration files to read them from */
+		std::vector<Anope::string> servers;
+		spacesepstream sep(nameserver);
+		for (Anope::string token; sep.GetToken(token);)
 		{
-			std::ifstream f(nameserver.c_str());
-			bool success = false;
+			if (!Anope::IsFile(token))
+			{
+				servers.push_back(token);
+				continue;
+			}
 
-			if (f.is_open())
+			std::ifstream f(token.c_str());
+			for (Anope::string line; std::getline(f, line.str());)
 			{
-				for (Anope::string server; std::getline(f, server.str());)
+				std::vector<Anope::string> fields;
+				spacesepstream(line).GetTokens(fields);
+				if (fields.size() >= 2 && fields[0] == "nameserver")
 				{
-					if (server.find("nameserver") == 0)
-					{
-						size_t i = server.find_first_of("123456789");
-						if (i != Anope::string::npos)
-						{
-							if (server.substr(i).is_pos_number_only())
-							{
-								nameserver = server.substr(i);
-								Log(LOG_DEBUG) << "Nameserver set to " << nameserver;
-								success = true;
-								break;
-							}
-						}
-					}
+					Log(LOG_DEBUG) << "Found nameserver " << fields[1] << " in " << token;
+					servers.push_back(fields[1]);
 				}
-
-				f.close();
 			}
+		}
 
-			if (!success)
-			{
-				Log() << "Unable to find nameserver, defaulting to 127.0.0.1";
-				nameserver = "127.0.0.1";
-			}
+		if (servers.empty())
+		{
+			Log() << "Unable to find nameserver, defaulting to 127.0.0.1";
+			servers.push_back("127.0.0.1");
 		}
 
 		try
 		{
-			this->manager.SetIPPort(nameserver, ip, port);
+			this->manager.SetIPPort(servers, ip, port);
 		}
 		catch (const SocketException &ex)
 		{
@@ -993,21 +1398,21 @@ class ModuleDNS : public Module
 
 	void OnModuleUnload(User *u, Module *m) anope_override
 	{
-		for (std::map<unsigned short, Request *>::iterator it = this->manager.requests.begin(), it_end = this->manager.requests.end(); it != it_end;)
+		std::vector<Request *> unloaded;
+		for (MyManager::request_map::iterator it = this->manager.requests.begin(), it_end = this->manager.requests.end(); it != it_end; ++it)
+			if (it->second->creator == m)
+				unloaded.push_back(it->second);
+
+		/* Deleting a request removes it from the manager */
+		for (unsigned i = 0; i < unloaded.size(); ++i)
 		{
-			unsigned short id = it->first;
-			Request *req = it->second;
-			++it;
+			Request *req = unloaded[i];
 
-			if (req->creator == m)
-			{
-				Query rr(*req);
-				rr.error = ERROR_UNLOADED;
-				req->OnError(&rr);
+			Query rr(*req);
+			rr.error = ERROR_UNLOADED;
+			req->OnError(&rr);
 
-				delete req;
-				this->manager.requests.erase(id);
-			}
+			delete req;
 		}
 	}
 };
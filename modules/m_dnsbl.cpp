@@ -23,40 +23,176 @@ struct Blacklist
 	Blacklist(const Anope::string &n, time_t b, const Anope::string &r, const std::map<int, Anope::string> &re) : name(n), bantime(b), reason(r), replies(re) { }
 };
 
+class ModuleDNSBL;
+static ModuleDNSBL *me;
+
 class DNSBLResolver : public Request
 {
 	Reference<User> user;
+	/* Who was looked up, the verdict is worth remembering even if they quit before it arrives */
+	Anope::string ip, nick, ident;
 	Blacklist blacklist;
-	bool add_to_akill;
+	bool unloading;
 
  public:
-	DNSBLResolver(Module *c, User *u, const Blacklist &b, const Anope::string &host, bool add_akill) : Request(dnsmanager, c, host, QUERY_A, true), user(u), blacklist(b), add_to_akill(add_akill) { }
+	DNSBLResolver(Module *c, User *u, const Blacklist &b, const Anope::string &host);
+	~DNSBLResolver();
+
+	void OnLookupComplete(const Query *record) anope_override;
+	void OnError(const Query *record) anope_override;
+};
 
-	void OnLookupComplete(const Query *record) anope_override
+class ModuleDNSBL : public Module
+{
+	/* A lookup waiting for a free query slot */
+	struct Pending
 	{
-		if (!user || user->HasExt("m_dnsbl_akilled"))
-			return;
+		Reference<User> user;
+		unsigned blacklist;
+		Anope::string host;
+	};
+
+	/* The last answer a blacklist gave for an IP */
+	struct Verdict
+	{
+		time_t expires;
+		bool listed;
+		Anope::string reason;
+	};
+
+	class CacheTimer : public Timer
+	{
+	 public:
+		CacheTimer(Module *o) : Timer(o, 60, Anope::CurTime, true) { }
+
+		void Tick(time_t) anope_override
+		{
+			me->ExpireCache();
+		}
+	};
+
+	std::vector<Blacklist> blacklists;
+	bool check_on_connect;
+	bool check_on_netburst;
+	bool add_to_akill;
+	time_t cache_time;
+	unsigned max_queries, max_queue;
+
+	/* Verdicts keyed by blacklist name and IP */
+	Anope::hash_map<Verdict> verdicts;
+	std::deque<Pending> pending;
+	unsigned inflight;
+	bool draining;
+	CacheTimer cache_timer;
+
+	static Anope::string Key(const Blacklist &b, const Anope::string &ip)
+	{
+		return b.name + " " + ip;
+	}
+
+	/* Whether the user is already covered by an existing akill, checked without acting on it */
+	static bool IsAkilled(User *u)
+	{
+		if (!akills)
+			return false;
+
+		const std::vector<XLine *> &list = akills->GetList();
+		for (unsigned i = 0; i < list.size(); ++i)
+		{
+			const XLine *x = list[i];
+			if ((!x->expires || x->expires >= Anope::CurTime) && akills->Check(u, x))
+				return true;
+		}
+		return false;
+	}
+
+	void Launch(User *u, const Blacklist &b, const Anope::string &host)
+	{
+		DNSBLResolver *res = NULL;
+		try
+		{
+			res = new DNSBLResolver(this, u, b, host);
+			dnsmanager->Process(res);
+		}
+		catch (const SocketException &ex)
+		{
+			delete res;
+			Log(this) << ex.GetReason();
+		}
+	}
 
-		const ResourceRecord &ans_record = record->answers[0];
-		// Replies should be in 127.0.0.0/24
-		if (ans_record.rdata.find("127.0.0.") != 0)
+	/* Start as many queued lookups as there are free slots for */
+	void Drain()
+	{
+		if (this->draining)
 			return;
+		this->draining = true;
 
-		Anope::string record_reason;
-		if (!this->blacklist.replies.empty())
+		while (!this->pending.empty() && this->inflight < this->max_queries && dnsmanager)
 		{
-			sockaddrs sresult;
-			sresult.pton(AF_INET, ans_record.rdata);
-			int result = sresult.sa4.sin_addr.s_addr >> 24;
+			Pending p = this->pending.front();
+			this->pending.pop_front();
 
-			if (!this->blacklist.replies.count(result))
-				return;
-			record_reason = this->blacklist.replies[result];
+			if (!p.user || p.user->Quitting() || p.user->HasExt("m_dnsbl_akilled") || p.blacklist >= this->blacklists.size())
+				continue;
+
+			this->Launch(p.user, this->blacklists[p.blacklist], p.host);
 		}
 
+		this->draining = false;
+	}
+
+ public:
+	ModuleDNSBL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, VENDOR),
+		cache_time(0), max_queries(0), max_queue(0), inflight(0), draining(false), cache_timer(this)
+	{
+		me = this;
+
+		Implementation i[] = { I_OnReload, I_OnUserConnect };
+		ModuleManager::Attach(i, this, sizeof(i) / sizeof(Implementation));
+	}
+
+	void Started()
+	{
+		++this->inflight;
+	}
+
+	void Finished(bool unloading)
+	{
+		--this->inflight;
+		if (unloading)
+			this->pending.clear();
+		else
+			this->Drain();
+	}
+
+	void Remember(const Blacklist &b, const Anope::string &ip, bool listed, const Anope::string &reason)
+	{
+		if (!this->cache_time)
+			return;
+
+		Verdict &v = this->verdicts[Key(b, ip)];
+		v.expires = Anope::CurTime + this->cache_time;
+		v.listed = listed;
+		v.reason = reason;
+	}
+
+	void ExpireCache()
+	{
+		for (Anope::hash_map<Verdict>::iterator it = this->verdicts.begin(); it != this->verdicts.end();)
+		{
+			if (it->second.expires <= Anope::CurTime)
+				it = this->verdicts.erase(it);
+			else
+				++it;
+		}
+	}
+
+	void Ban(User *user, const Blacklist &blacklist, const Anope::string &record_reason)
+	{
 		user->Extend("m_dnsbl_akilled");
 
-		Anope::string reason = this->blacklist.reason;
+		Anope::string reason = blacklist.reason;
 		reason = reason.replace_all_cs("%n", user->nick);
 		reason = reason.replace_all_cs("%u", user->GetIdent());
 		reason = reason.replace_all_cs("%g", user->realname);
@@ -65,8 +201,8 @@ class DNSBLResolver : public Request
 		reason = reason.replace_all_cs("%r", record_reason);
 		reason = reason.replace_all_cs("%N", Config->GetBlock("networkinfo")->Get<const Anope::string &>("networkname"));
 
-		Log(OperServ) << "DNSBL: " << user->GetMask() << " (" << user->ip << ") appears in " << this->blacklist.name;
-		XLine *x = new XLine("*@" + user->ip, OperServ ? OperServ->nick : "m_dnsbl", Anope::CurTime + this->blacklist.bantime, reason, XLineManager::GenerateUID());
+		Log(OperServ) << "DNSBL: " << user->GetMask() << " (" << user->ip << ") appears in " << blacklist.name;
+		XLine *x = new XLine("*@" + user->ip, OperServ ? OperServ->nick : "m_dnsbl", Anope::CurTime + blacklist.bantime, reason, XLineManager::GenerateUID());
 		if (this->add_to_akill && akills)
 		{
 			akills->AddXLine(x);
@@ -78,22 +214,6 @@ class DNSBLResolver : public Request
 			delete x;
 		}
 	}
-};
-
-class ModuleDNSBL : public Module
-{
-	std::vector<Blacklist> blacklists;
-	bool check_on_connect;
-	bool check_on_netburst;
-	bool add_to_akill;
-
- public:
-	ModuleDNSBL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, VENDOR)
-	{
-
-		Implementation i[] = { I_OnReload, I_OnUserConnect };
-		ModuleManager::Attach(i, this, sizeof(i) / sizeof(Implementation));
-	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
 	{
@@ -101,6 +221,15 @@ class ModuleDNSBL : public Module
 		this->check_on_connect = block->Get<bool>("check_on_connect");
 		this->check_on_netburst = block->Get<bool>("check_on_netburst");
 		this->add_to_akill = block->Get<bool>("add_to_akill", "yes");
+		this->cache_time = block->Get<time_t>("cache_time", "1h");
+		this->max_queries = block->Get<unsigned>("max_queries", "128");
+		this->max_queue = block->Get<unsigned>("max_queue", "4096");
+		if (!this->max_queries)
+			this->max_queries = 1;
+
+		/* Queued lookups refer to blacklists by index, and cached verdicts depend on the replies configured */
+		this->pending.clear();
+		this->verdicts.clear();
 
 		this->blacklists.clear();
 		for (int i = 0, num = conf->CountBlock("blacklist"); i < num; ++i)
@@ -132,6 +261,10 @@ class ModuleDNSBL : public Module
 		if (!this->check_on_netburst && !user->server->IsSynced())
 			return;
 
+		/* Already banned, there is nothing a lookup could add */
+		if (user->HasExt("m_dnsbl_akilled") || IsAkilled(user))
+			return;
+
 		/* At this time we only support IPv4 */
 		sockaddrs user_ip;
 		try
@@ -153,21 +286,89 @@ class ModuleDNSBL : public Module
 		{
 			const Blacklist &b = this->blacklists[i];
 
-			Anope::string dnsbl_host = user_ip.addr() + "." + b.name;
-			DNSBLResolver *res = NULL;
-			try
+			Anope::hash_map<Verdict>::iterator it = this->verdicts.find(Key(b, user->ip));
+			if (it != this->verdicts.end() && it->second.expires > Anope::CurTime)
 			{
-				res = new DNSBLResolver(this, user, b, dnsbl_host, this->add_to_akill);
-				dnsmanager->Process(res);
+				if (it->second.listed)
+				{
+					this->Ban(user, b, it->second.reason);
+					return;
+				}
+				continue;
 			}
-			catch (const SocketException &ex)
+
+			Anope::string dnsbl_host = user_ip.addr() + "." + b.name;
+			if (this->inflight < this->max_queries && this->pending.empty())
+				this->Launch(user, b, dnsbl_host);
+			else if (this->pending.size() < this->max_queue)
 			{
-				delete res;
-				Log(this) << ex.GetReason();
+				Pending p;
+				p.user = user;
+				p.blacklist = i;
+				p.host = dnsbl_host;
+				this->pending.push_back(p);
 			}
+			else
+				Log(LOG_DEBUG) << "m_dnsbl: lookup queue is full, not checking " << user->GetMask() << " against " << b.name;
 		}
 	}
 };
 
+DNSBLResolver::DNSBLResolver(Module *c, User *u, const Blacklist &b, const Anope::string &host) : Request(dnsmanager, c, host, QUERY_A, true), user(u), ip(u->ip), nick(u->nick), ident(u->GetIdent()), blacklist(b), unloading(false)
+{
+	me->Started();
+}
+
+DNSBLResolver::~DNSBLResolver()
+{
+	me->Finished(this->unloading);
+}
+
+void DNSBLResolver::OnLookupComplete(const Query *record)
+{
+	const ResourceRecord &ans_record = record->answers[0];
+	// Replies should be in 127.0.0.0/24
+	if (ans_record.rdata.find("127.0.0.") != 0)
+	{
+		me->Remember(this->blacklist, this->ip, false, "");
+		return;
+	}
+
+	Anope::string record_reason;
+	if (!this->blacklist.replies.empty())
+	{
+		sockaddrs sresult;
+		sresult.pton(AF_INET, ans_record.rdata);
+		int result = sresult.sa4.sin_addr.s_addr >> 24;
+
+		if (!this->blacklist.replies.count(result))
+		{
+			me->Remember(this->blacklist, this->ip, false, "");
+			return;
+		}
+		record_reason = this->blacklist.replies[result];
+	}
+
+	me->Remember(this->blacklist, this->ip, true, record_reason);
+
+	if (!user || user->Quitting())
+	{
+		Log(LOG_DEBUG) << "m_dnsbl: " << this->nick << "!" << this->ident << " (" << this->ip << ") appears in " << this->blacklist.name << " but is already gone";
+		return;
+	}
+
+	if (!user->HasExt("m_dnsbl_akilled"))
+		me->Ban(user, this->blacklist, record_reason);
+}
+
+void DNSBLResolver::OnError(const Query *record)
+{
+	if (record->error == ERROR_UNLOADED)
+		this->unloading = true;
+	/* Not being listed is an answer too, anything else is worth asking again next time */
+	else if (record->error == ERROR_DOMAIN_NOT_FOUND || record->error == ERROR_NO_RECORDS)
+		me->Remember(this->blacklist, this->ip, false, "");
+}
+
 MODULE_INIT(ModuleDNSBL)
 
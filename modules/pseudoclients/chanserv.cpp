@@ -239,27 +239,15 @@ class ChanServCore : public Module
 			if (ci->GetSuccessor() == nc)
 				ci->SetSuccessor(NULL);
 
-			for (unsigned j = 0; j < ci->GetAccessCount(); ++j)
-			{
-				const ChanAccess *ca = ci->GetAccess(j);
-				const NickCore *anc = NickCore::Find(ca->mask);
-
-				if (anc && anc == nc)
-				{
-					ci->EraseAccess(j);
-					break;
-				}
-			}
-
-			for (unsigned j = 0; j < ci->GetAkickCount(); ++j)
-			{
-				const AutoKick *akick = ci->GetAkick(j);
-				if (akick->nc == nc)
-				{
-					ci->EraseAkick(j);
-					break;
-				}
-			}
+			std::vector<ChanAccess *> access;
+			nc->GetAccessReferences(ci, access);
+			for (unsigned j = 0; j < access.size(); ++j)
+				delete access[j];
+
+			std::vector<AutoKick *> akicks;
+			nc->GetAkickReferences(ci, akicks);
+			for (unsigned j = 0; j < akicks.size(); ++j)
+				delete akicks[j];
 		}
 	}
 
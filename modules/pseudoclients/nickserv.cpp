@@ -94,6 +94,7 @@ class MyNickServService : public NickServService
 			Anope::string last_usermask = u->GetIdent() + "@" + u->GetDisplayedHost();
 			na->last_usermask = last_usermask;
 			na->last_realname = u->realname;
+			na->QueueUpdate();
 			return;
 		}
 
@@ -159,8 +160,11 @@ class ExpireCallback : public Timer
 			++it;
 
 			User *u = User::Find(na->nick);
-			if (u && (na->nc->HasExt("SECURE") ? u->IsIdentified(true) : u->IsRecognized()))
+			if (u && (na->nc->HasExt("SECURE") ? u->IsIdentified(true) : u->IsRecognized()) && na->last_seen != Anope::CurTime)
+			{
 				na->last_seen = Anope::CurTime;
+				na->QueueUpdate();
+			}
 
 			bool expire = false;
 
@@ -451,6 +455,7 @@ class NickServCore : public Module
 		{
 			na->last_seen = Anope::CurTime;
 			na->last_quit = msg;
+			na->QueueUpdate();
 		}
 	}
 };
@@ -59,7 +59,7 @@ static struct
 	{"VOICEME", _("Allowed to (de)voice him/herself")}
 };
 
-Privilege::Privilege(const Anope::string &n, const Anope::string &d, int r) : name(n), desc(d), rank(r)
+Privilege::Privilege(const Anope::string &n, const Anope::string &d, int r) : name(n), desc(d), rank(r), index(0)
 {
 	if (this->desc.empty())
 		for (unsigned j = 0; j < sizeof(descriptions) / sizeof(*descriptions); ++j)
@@ -73,6 +73,20 @@ bool Privilege::operator==(const Privilege &other) const
 }
 
 std::vector<Privilege> PrivilegeManager::Privileges;
+Anope::hash_map<unsigned> PrivilegeManager::PrivilegesByName;
+unsigned PrivilegeManager::Generation = 0;
+
+void PrivilegeManager::Reindex()
+{
+	PrivilegesByName.clear();
+	for (unsigned i = 0; i < Privileges.size(); ++i)
+	{
+		Privileges[i].index = i;
+		PrivilegesByName[Privileges[i].name] = i;
+	}
+
+	++Generation;
+}
 
 void PrivilegeManager::AddPrivilege(Privilege p)
 {
@@ -86,6 +100,7 @@ void PrivilegeManager::AddPrivilege(Privilege p)
 	}
 	
 	Privileges.insert(Privileges.begin() + i, p);
+	Reindex();
 }
 
 void PrivilegeManager::RemovePrivilege(Privilege &p)
@@ -93,6 +108,7 @@ void PrivilegeManager::RemovePrivilege(Privilege &p)
 	std::vector<Privilege>::iterator it = std::find(Privileges.begin(), Privileges.end(), p);
 	if (it != Privileges.end())
 		Privileges.erase(it);
+	Reindex();
 
 	for (registered_channel_map::const_iterator cit = RegisteredChannelList->begin(), cit_end = RegisteredChannelList->end(); cit != cit_end; ++cit)
 	{
@@ -103,10 +119,10 @@ void PrivilegeManager::RemovePrivilege(Privilege &p)
 
 Privilege *PrivilegeManager::FindPrivilege(const Anope::string &name)
 {
-	for (unsigned i = Privileges.size(); i > 0; --i)
-		if (Privileges[i - 1].name.equals_ci(name))
-			return &Privileges[i - 1];
-	return NULL;
+	Anope::hash_map<unsigned>::const_iterator it = PrivilegesByName.find(name);
+	if (it == PrivilegesByName.end())
+		return NULL;
+	return &Privileges[it->second];
 }
 
 std::vector<Privilege> &PrivilegeManager::GetPrivileges()
@@ -117,6 +133,55 @@ std::vector<Privilege> &PrivilegeManager::GetPrivileges()
 void PrivilegeManager::ClearPrivileges()
 {
 	Privileges.clear();
+	Reindex();
+}
+
+unsigned PrivilegeManager::GetGeneration()
+{
+	return Generation;
+}
+
+PrivilegeSet &PrivilegeSet::operator|=(const PrivilegeSet &other)
+{
+	if (other.bits.size() > this->bits.size())
+		this->bits.resize(other.bits.size());
+	for (unsigned i = 0; i < other.bits.size(); ++i)
+		this->bits[i] |= other.bits[i];
+	return *this;
+}
+
+static int HighestBit(unsigned long word)
+{
+	int i = -1;
+	for (; word; word >>= 1)
+		++i;
+	return i;
+}
+
+int PrivilegeSet::Highest() const
+{
+	for (unsigned i = this->bits.size(); i > 0; --i)
+		if (this->bits[i - 1])
+			return (i - 1) * BITS + HighestBit(this->bits[i - 1]);
+	return -1;
+}
+
+int PrivilegeSet::Compare(const PrivilegeSet &other) const
+{
+	for (unsigned i = std::max(this->bits.size(), other.bits.size()); i > 0; --i)
+	{
+		unsigned long mine = i <= this->bits.size() ? this->bits[i - 1] : 0,
+			theirs = i <= other.bits.size() ? other.bits[i - 1] : 0;
+
+		if (!(mine | theirs))
+			continue;
+
+		unsigned long top = 1UL << HighestBit(mine | theirs);
+		bool this_p = mine & top, other_p = theirs & top;
+		return this_p == other_p ? 0 : (this_p ? 1 : -1);
+	}
+
+	return 0;
 }
 
 AccessProvider::AccessProvider(Module *o, const Anope::string &n) : Service(o, "AccessProvider", n)
@@ -138,7 +203,7 @@ const std::list<AccessProvider *>& AccessProvider::GetProviders()
 	return Providers;
 }
 
-ChanAccess::ChanAccess(AccessProvider *p) : Serializable("ChanAccess"), provider(p)
+ChanAccess::ChanAccess(AccessProvider *p) : Serializable("ChanAccess"), privileges_valid(false), privileges_generation(0), privileges_levels(0), provider(p)
 {
 }
 
@@ -150,9 +215,8 @@ ChanAccess::~ChanAccess()
 		if (it != this->ci->access->end())
 			this->ci->access->erase(it);
 
-		const NickAlias *na = NickAlias::Find(this->mask);
-		if (na != NULL)
-			na->nc->RemoveChannelReference(this->ci);
+		if (this->nc)
+			this->nc->RemoveAccessReference(this);
 	}
 }
 
@@ -181,7 +245,13 @@ Serializable* ChanAccess::Unserialize(Serializable *obj, Serialize::Data &data)
 
 	ChanAccess *access;
 	if (obj)
+	{
 		access = anope_dynamic_static_cast<ChanAccess *>(obj);
+		/* The mask may have changed, so this is readded below */
+		if (access->nc)
+			access->nc->RemoveAccessReference(access);
+		access->nc = NULL;
+	}
 	else
 		access = aprovider->Create();
 	access->ci = ci;
@@ -193,9 +263,19 @@ Serializable* ChanAccess::Unserialize(Serializable *obj, Serialize::Data &data)
 	Anope::string adata;
 	data["data"] >> adata;
 	access->AccessUnserialize(adata);
+	access->InvalidatePrivileges();
 
 	if (!obj)
 		ci->AddAccess(access);
+	else
+	{
+		const NickAlias *na = NickAlias::Find(access->mask);
+		if (na != NULL)
+		{
+			access->nc = na->nc;
+			na->nc->AddAccessReference(access);
+		}
+	}
 	return access;
 }
 
@@ -216,80 +296,50 @@ bool ChanAccess::Matches(const User *u, const NickCore *acc) const
 	return false;
 }
 
-bool ChanAccess::operator>(const ChanAccess &other) const
+const PrivilegeSet &ChanAccess::GetPrivileges() const
 {
-	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
-	for (unsigned i = privs.size(); i > 0; --i)
+	unsigned priv_generation = PrivilegeManager::GetGeneration(), levels = this->ci ? this->ci->GetLevelsVersion() : 0;
+
+	if (!this->privileges_valid || this->privileges_generation != priv_generation || this->privileges_levels != levels)
 	{
-		bool this_p = this->HasPriv(privs[i - 1].name),
-			other_p = other.HasPriv(privs[i - 1].name);
+		this->privileges.Clear();
 
-		if (!this_p && !other_p)
-			continue;
-		else if (this_p && !other_p)
-			return true;
-		else
-			return false;
+		const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
+		for (unsigned i = 0; i < privs.size(); ++i)
+			if (this->HasPriv(privs[i].name))
+				this->privileges.Set(privs[i].index);
+
+		this->privileges_valid = true;
+		this->privileges_generation = priv_generation;
+		this->privileges_levels = levels;
 	}
 
-	return false;
+	return this->privileges;
 }
 
-bool ChanAccess::operator<(const ChanAccess &other) const
+void ChanAccess::InvalidatePrivileges() const
 {
-	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
-	for (unsigned i = privs.size(); i > 0; --i)
-	{
-		bool this_p = this->HasPriv(privs[i - 1].name),
-			other_p = other.HasPriv(privs[i - 1].name);
+	this->privileges_valid = false;
+}
 
-		if (!this_p && !other_p)
-			continue;
-		else if (!this_p && other_p)
-			return true;
-		else
-			return false;
-	}	
+bool ChanAccess::operator>(const ChanAccess &other) const
+{
+	return this->GetPrivileges().Compare(other.GetPrivileges()) > 0;
+}
 
-	return false;
+bool ChanAccess::operator<(const ChanAccess &other) const
+{
+	return this->GetPrivileges().Compare(other.GetPrivileges()) < 0;
 }
 
 bool ChanAccess::operator>=(const ChanAccess &other) const
 {
-	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
-	for (unsigned i = privs.size(); i > 0; --i)
-	{
-		bool this_p = this->HasPriv(privs[i - 1].name),
-			other_p = other.HasPriv(privs[i - 1].name);
-
-		if (!this_p && !other_p)
-			continue;
-		else if (!this_p && other_p)
-			return false;
-		else
-			return true;
-	}
-
-	return true;
+	return this->GetPrivileges().Compare(other.GetPrivileges()) >= 0;
 }
 
 bool ChanAccess::operator<=(const ChanAccess &other) const
 {
-	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
-	for (unsigned i = privs.size(); i > 0; --i)
-	{
-		bool this_p = this->HasPriv(privs[i - 1].name),
-			other_p = other.HasPriv(privs[i - 1].name);
-
-		if (!this_p && !other_p)
-			continue;
-		else if (this_p && !other_p)
-			return false;
-		else
-			return true;
-	}
-
-	return true;
+	return this->GetPrivileges().Compare(other.GetPrivileges()) <= 0;
 }
 
 AccessGroup::AccessGroup() : std::vector<ChanAccess *>()
@@ -311,24 +361,77 @@ bool AccessGroup::HasPriv(const Anope::string &name) const
 	FOREACH_RESULT(I_OnGroupCheckPriv, OnGroupCheckPriv(this, name));
 	if (MOD_RESULT != EVENT_CONTINUE)
 		return MOD_RESULT == EVENT_ALLOW;
+	const Privilege *p = PrivilegeManager::FindPrivilege(name);
 	for (unsigned i = this->size(); i > 0; --i)
 	{
 		ChanAccess *access = this->at(i - 1);
 		FOREACH_RESULT(I_OnCheckPriv, OnCheckPriv(access, name));
-		if (MOD_RESULT == EVENT_ALLOW || access->HasPriv(name))
+		if (MOD_RESULT == EVENT_ALLOW || (p ? access->GetPrivileges().Has(p->index) : access->HasPriv(name)))
 			return true;
 	}
 	return false;
 }
 
-const ChanAccess *AccessGroup::Highest() const
+bool AccessGroup::HasPriv(const Privilege &priv, const PrivilegeSet &entries) const
 {
+	if (this->super_admin)
+		return true;
+	else if (ci->GetLevel(priv.name) == ACCESS_INVALID)
+		return false;
+	else if (this->founder)
+		return true;
+	EventReturn MOD_RESULT;
+	FOREACH_RESULT(I_OnGroupCheckPriv, OnGroupCheckPriv(this, priv.name));
+	if (MOD_RESULT != EVENT_CONTINUE)
+		return MOD_RESULT == EVENT_ALLOW;
+	if (entries.Has(priv.index))
+		return true;
+	for (unsigned i = this->size(); i > 0; --i)
+	{
+		FOREACH_RESULT(I_OnCheckPriv, OnCheckPriv(this->at(i - 1), priv.name));
+		if (MOD_RESULT == EVENT_ALLOW)
+			return true;
+	}
+	return false;
+}
+
+int AccessGroup::Compare(const AccessGroup &other) const
+{
+	PrivilegeSet mine, theirs;
+	for (unsigned i = 0; i < this->size(); ++i)
+		mine |= this->at(i)->GetPrivileges();
+	for (unsigned i = 0; i < other.size(); ++i)
+		theirs |= other.at(i)->GetPrivileges();
+
 	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
 	for (unsigned i = privs.size(); i > 0; --i)
-		for (unsigned j = this->size(); j > 0; --j)
-			if (this->at(j - 1)->HasPriv(privs[i - 1].name))
-				return this->at(j - 1);
-	return NULL;
+	{
+		bool this_p = this->HasPriv(privs[i - 1], mine),
+			other_p = other.HasPriv(privs[i - 1], theirs);
+
+		if (this_p != other_p)
+			return this_p ? 1 : -1;
+		else if (this_p)
+			return 0;
+	}
+
+	return 0;
+}
+
+const ChanAccess *AccessGroup::Highest() const
+{
+	const ChanAccess *highest = NULL;
+	int highest_priv = -1;
+	for (unsigned i = this->size(); i > 0; --i)
+	{
+		int h = this->at(i - 1)->GetPrivileges().Highest();
+		if (h > highest_priv)
+		{
+			highest = this->at(i - 1);
+			highest_priv = h;
+		}
+	}
+	return highest;
 }
 
 bool AccessGroup::operator>(const AccessGroup &other) const
@@ -341,21 +444,7 @@ bool AccessGroup::operator>(const AccessGroup &other) const
 		return true;
 	else if (!this->founder && other.founder)
 		return false;
-	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
-	for (unsigned i = privs.size(); i > 0; --i)
-	{
-		bool this_p = this->HasPriv(privs[i - 1].name),
-			other_p = other.HasPriv(privs[i - 1].name);
-
-		if (!this_p && !other_p)
-			continue;
-		else if (this_p && !other_p)
-			return true;
-		else
-			return false;
-	}
-
-	return false;
+	return this->Compare(other) > 0;
 }
 
 bool AccessGroup::operator<(const AccessGroup &other) const
@@ -368,21 +457,7 @@ bool AccessGroup::operator<(const AccessGroup &other) const
 		return true;
 	else if (this->founder && !other.founder)
 		return false;
-	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
-	for (unsigned i = privs.size(); i > 0; --i)
-	{
-		bool this_p = this->HasPriv(privs[i - 1].name),
-			other_p = other.HasPriv(privs[i - 1].name);
-
-		if (!this_p && !other_p)
-			continue;
-		else if (!this_p && other_p)
-			return true;
-		else
-			return false;
-	}
-
-	return false;
+	return this->Compare(other) < 0;
 }
 
 bool AccessGroup::operator>=(const AccessGroup &other) const
@@ -395,21 +470,7 @@ bool AccessGroup::operator>=(const AccessGroup &other) const
 		return true;
 	else if (other.founder)
 		return false;
-	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
-	for (unsigned i = privs.size(); i > 0; --i)
-	{
-		bool this_p = this->HasPriv(privs[i - 1].name),
-			other_p = other.HasPriv(privs[i - 1].name);
-
-		if (!this_p && !other_p)
-			continue;
-		else if (other_p && !this_p)
-			return false;
-		else
-			return true;
-	}
-
-	return true;
+	return this->Compare(other) >= 0;
 }
 
 bool AccessGroup::operator<=(const AccessGroup &other) const
@@ -422,20 +483,5 @@ bool AccessGroup::operator<=(const AccessGroup &other) const
 		return true;
 	else if (this->founder)
 		return false;
-	const std::vector<Privilege> &privs = PrivilegeManager::GetPrivileges();
-	for (unsigned i = privs.size(); i > 0; --i)
-	{
-		bool this_p = this->HasPriv(privs[i - 1].name),
-			other_p = other.HasPriv(privs[i - 1].name);
-
-		if (!this_p && !other_p)
-			continue;
-		else if (this_p && !other_p)
-			return false;
-		else
-			return true;
-	}
-
-	return true;
+	return this->Compare(other) <= 0;
 }
-
@@ -116,12 +116,16 @@ void BotInfo::GenerateUID()
 void BotInfo::SetNewNick(const Anope::string &newnick)
 {
 	UserListByNick.erase(this->nick);
+	OrderedUserList.erase(this->nick);
 	BotListByNick->erase(this->nick);
 
 	this->nick = newnick;
 
 	UserListByNick[this->nick] = this;
+	OrderedUserList[this->nick] = this;
 	(*BotListByNick)[this->nick] = this;
+
+	UserIndex::Update(this);
 }
 
 const std::set<ChannelInfo *> &BotInfo::GetChannels() const
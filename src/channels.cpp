@@ -25,6 +25,16 @@
 #include "sockets.h"
 
 channel_map ChannelList;
+ordered_channel_map OrderedChannelList;
+
+/* Channels by the modes they have set, other than list and status modes */
+static std::map<Anope::string, std::set<Channel *> > ChannelModeIndex;
+
+static void UnindexModes(Channel *c)
+{
+	for (Channel::ModeList::const_iterator it = c->GetModes().begin(), it_end = c->GetModes().end(); it != it_end; ++it)
+		ChannelModeIndex[it->first].erase(c);
+}
 
 Channel::Channel(const Anope::string &nname, time_t ts)
 {
@@ -32,6 +42,7 @@ Channel::Channel(const Anope::string &nname, time_t ts)
 		throw CoreException("A channel without a name ?");
 
 	this->name = nname;
+	OrderedChannelList[this->name] = this;
 
 	this->creation_time = ts;
 	this->server_modetime = this->chanserv_modetime = 0;
@@ -59,11 +70,14 @@ Channel::~Channel()
 	if (this->ci)
 		this->ci->c = NULL;
 
+	UnindexModes(this);
 	ChannelList.erase(this->name);
+	OrderedChannelList.erase(this->name);
 }
 
 void Channel::Reset()
 {
+	UnindexModes(this);
 	this->modes.clear();
 
 	for (ChanUserList::const_iterator it = this->users.begin(), it_end = this->users.end(); it != it_end; ++it)
@@ -326,7 +340,10 @@ void Channel::SetModeInternal(MessageSource &setter, ChannelMode *cm, const Anop
 	}
 
 	if (cm->type != MODE_LIST)
+	{
 		this->modes.erase(cm->name);
+		ChannelModeIndex[cm->name].insert(this);
+	}
 	this->modes.insert(std::make_pair(cm->name, param));
 
 	if (param.empty() && cm->type != MODE_REGULAR)
@@ -409,7 +426,10 @@ void Channel::RemoveModeInternal(MessageSource &setter, ChannelMode *cm, const A
 			}
 	}
 	else
+	{
 		this->modes.erase(cm->name);
+		ChannelModeIndex[cm->name].erase(this);
+	}
 	
 	if (cm->type == MODE_LIST)
 	{
@@ -858,63 +878,88 @@ void Channel::SetCorrectModes(User *user, bool give_modes, bool check_noop)
 {
 	if (user == NULL)
 		return;
-	
+
+	this->SetCorrectModes(std::vector<User *>(1, user), give_modes, check_noop);
+}
+
+void Channel::SetCorrectModes(const std::vector<User *> &batch, bool give_modes, bool check_noop)
+{
 	if (!this->ci)
 		return;
 
-	Log(LOG_DEBUG) << "Setting correct user modes for " << user->nick << " on " << this->name << " (" << (give_modes ? "" : "not ") << "giving modes)";
-
-	AccessGroup u_access = ci->AccessFor(user);
 	ChannelMode *registered = ModeManager::FindChannelModeByName("REGISTERED");
+	const std::vector<ChannelModeStatus *> &status_modes = ModeManager::GetStatusChannelModesByRank();
 
-	/* Only give modes if autoop isn't set */
-	give_modes &= (!user->Account() || user->Account()->HasExt("AUTOOP")) && (!check_noop || !ci->HasExt("NOAUTOOP"));
-	/* If this channel has secureops, or the registered channel mode exists and the channel does not have +r set (aka the channel
-	 * was created just now or while we were off), or the registered channel mode does not exist and channel is syncing (aka just
-	 * created *to us*) and the user's server is synced (aka this isn't us doing our initial uplink - without this we would be deopping all
-	 * users with no access on a non-secureops channel on startup), and the user's server isn't ulined, then set negative modes.
-	 */
-	bool take_modes = (ci->HasExt("SECUREOPS") || (registered && !this->HasMode("REGISTERED")) || (!registered && this->HasExt("SYNCING") && user->server->IsSynced())) && !user->server->IsULined();
+	/* The privileges giving each status mode, and the status mode locks, are the same for everyone */
+	std::vector<Anope::string> auto_privs;
+	for (unsigned i = 0; i < status_modes.size(); ++i)
+		auto_privs.push_back("AUTO" + status_modes[i]->name);
 
-	bool given = false;
-	for (unsigned i = 0; i < ModeManager::GetStatusChannelModesByRank().size(); ++i)
+	std::vector<std::pair<const ModeLock *, ChannelMode *> > status_locks;
+	for (ChannelInfo::ModeList::const_iterator it = ci->GetMLock().begin(), it_end = ci->GetMLock().end(); it != it_end; ++it)
 	{
-		ChannelModeStatus *cm = ModeManager::GetStatusChannelModesByRank()[i];
-		bool has_priv = u_access.HasPriv("AUTO" + cm->name);
-
-		/* If we have already given one mode, don't give more until it has a symbol */
-		if (give_modes && has_priv && (!given || cm->symbol))
-		{
-			this->SetMode(NULL, cm, user->GetUID());
-			/* Now if this contains a symbol don't give any more modes, to prevent setting +qaohv etc on users */
-			give_modes = !cm->symbol;
-			given = true;
-		}
-		else if (take_modes && !has_priv)
-			this->RemoveMode(NULL, cm, user->GetUID());
+		ChannelMode *cm = ModeManager::FindChannelModeByName(it->second->name);
+		if (cm && cm->type == MODE_STATUS)
+			status_locks.push_back(std::make_pair(it->second, cm));
 	}
 
-	// Check mlock
-	for (ChannelInfo::ModeList::const_iterator it = ci->GetMLock().begin(), it_end = ci->GetMLock().end(); it != it_end; ++it)
+	for (unsigned u = 0; u < batch.size(); ++u)
 	{
-		const ModeLock *ml = it->second;
-		ChannelMode *cm = ModeManager::FindChannelModeByName(ml->name);
-		if (!cm || cm->type != MODE_STATUS)
+		User *user = batch[u];
+		if (user == NULL)
 			continue;
 
-		if (Anope::Match(user->nick, ml->param) || Anope::Match(user->GetDisplayedMask(), ml->param))
+		Log(LOG_DEBUG) << "Setting correct user modes for " << user->nick << " on " << this->name << " (" << (give_modes ? "" : "not ") << "giving modes)";
+
+		AccessGroup u_access = ci->AccessFor(user);
+
+		/* Only give modes if autoop isn't set */
+		bool give = give_modes && (!user->Account() || user->Account()->HasExt("AUTOOP")) && (!check_noop || !ci->HasExt("NOAUTOOP"));
+		/* If this channel has secureops, or the registered channel mode exists and the channel does not have +r set (aka the channel
+		 * was created just now or while we were off), or the registered channel mode does not exist and channel is syncing (aka just
+		 * created *to us*) and the user's server is synced (aka this isn't us doing our initial uplink - without this we would be deopping all
+		 * users with no access on a non-secureops channel on startup), and the user's server isn't ulined, then set negative modes.
+		 */
+		bool take_modes = (ci->HasExt("SECUREOPS") || (registered && !this->HasMode("REGISTERED")) || (!registered && this->HasExt("SYNCING") && user->server->IsSynced())) && !user->server->IsULined();
+
+		bool given = false;
+		for (unsigned i = 0; i < status_modes.size(); ++i)
 		{
-			if (ml->set != this->HasUserStatus(user, ml->name))
+			ChannelModeStatus *cm = status_modes[i];
+			bool has_priv = u_access.HasPriv(auto_privs[i]);
+
+			/* If we have already given one mode, don't give more until it has a symbol */
+			if (give && has_priv && (!given || cm->symbol))
 			{
-				if (ml->set)
-					this->SetMode(NULL, cm, user->GetUID(), false);
-				else if (!ml->set)
-					this->RemoveMode(NULL, cm, user->GetUID(), false);
+				this->SetMode(NULL, cm, user->GetUID());
+				/* Now if this contains a symbol don't give any more modes, to prevent setting +qaohv etc on users */
+				give = !cm->symbol;
+				given = true;
 			}
+			else if (take_modes && !has_priv)
+				this->RemoveMode(NULL, cm, user->GetUID());
 		}
-	}
 
-	FOREACH_MOD(I_OnSetCorrectModes, OnSetCorrectModes(user, this, u_access, give_modes));
+		// Check mlock
+		for (unsigned i = 0; i < status_locks.size(); ++i)
+		{
+			const ModeLock *ml = status_locks[i].first;
+			ChannelMode *cm = status_locks[i].second;
+
+			if (Anope::Match(user->nick, ml->param) || Anope::Match(user->GetDisplayedMask(), ml->param))
+			{
+				if (ml->set != this->HasUserStatus(user, ml->name))
+				{
+					if (ml->set)
+						this->SetMode(NULL, cm, user->GetUID(), false);
+					else if (!ml->set)
+						this->RemoveMode(NULL, cm, user->GetUID(), false);
+				}
+			}
+		}
+
+		FOREACH_MOD(I_OnSetCorrectModes, OnSetCorrectModes(user, this, u_access, give));
+	}
 }
 
 bool Channel::Unban(User *u, bool full)
@@ -957,3 +1002,8 @@ Channel *Channel::FindOrCreate(const Anope::string &name, bool &created, time_t
 	return chan;
 }
 
+const std::set<Channel *> &Channel::FindByMode(const Anope::string &mname)
+{
+	return ChannelModeIndex[mname];
+}
+
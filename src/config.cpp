@@ -121,6 +121,7 @@ Conf::Conf() : Block("")
 {
 	ReadTimeout = 0;
 	UsePrivmsg = DefPrivmsg = false;
+	BurstBudget = 0;
 
 	this->LoadConf(ServicesConf);
 
@@ -188,6 +189,21 @@ Conf::Conf() : Block("")
 	}
 	this->DefLanguage = options->Get<const Anope::string &>("defaultlanguage");
 	this->TimeoutCheck = options->Get<time_t>("timeoutcheck");
+	this->BurstBudget = options->Get<unsigned>("burstbudget", "10");
+	{
+		std::vector<Anope::string> skip, defer;
+		spacesepstream(options->Get<const Anope::string &>("burstskip")).GetTokens(skip);
+		spacesepstream(options->Get<const Anope::string &>("burstdefer")).GetTokens(defer);
+
+		for (unsigned i = 0; i < skip.size(); ++i)
+			this->BurstPolicies[skip[i]] = BURST_SKIP;
+		for (unsigned i = 0; i < defer.size(); ++i)
+		{
+			if (this->BurstPolicies.count(defer[i]))
+				throw ConfigException("Module " + defer[i] + " can not be in both <options:burstdefer> and <options:burstskip>");
+			this->BurstPolicies[defer[i]] = BURST_DEFER;
+		}
+	}
 
 	for (int i = 0; i < this->CountBlock("uplink"); ++i)
 	{
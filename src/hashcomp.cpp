@@ -89,7 +89,10 @@ const char *ci::ci_char_traits::find(const char *s1, int n, char c)
 
 bool ci::less::operator()(const Anope::string &s1, const Anope::string &s2) const
 {
-	return s1.ci_str().compare(s2.ci_str()) < 0;
+	/* Same ordering as ci::string::compare, without copying both strings first */
+	size_t len1 = s1.length(), len2 = s2.length();
+	int ret = ci_char_traits::compare(s1.c_str(), s2.c_str(), std::min(len1, len2));
+	return ret < 0 || (!ret && len1 < len2);
 }
 
 sepstream::sepstream(const Anope::string &source, char seperator, bool ae) : tokens(source), sep(seperator), pos(0), allow_empty(ae)
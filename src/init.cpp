@@ -463,7 +463,9 @@ void Anope::Init(int ac, char **av)
 	/* Load up databases */
 	Log() << "Loading databases...";
 	EventReturn MOD_RESULT;
+	Serialize::Loading = true;
 	FOREACH_RESULT(I_OnLoadDatabase, OnLoadDatabase());
+	Serialize::Loading = false;
 	Log() << "Databases loaded";
 
 	Serialize::CheckTypes();
@@ -121,6 +121,9 @@ void Join::SJoin(MessageSource &source, const Anope::string &chan, time_t ts, co
 		 */
 		c->SetModesInternal(source, modes, ts, !c->HasExt("SYNCING"));
 	
+	std::vector<User *> joined;
+	joined.reserve(users.size());
+
 	for (std::list<SJoinUser>::const_iterator it = users.begin(), it_end = users.end(); it != it_end; ++it)
 	{
 		const ChannelStatus &status = it->first;
@@ -133,15 +136,19 @@ void Join::SJoin(MessageSource &source, const Anope::string &chan, time_t ts, co
 		if (keep_their_modes)
 			cc->status = status;
 
-		/* Set whatever modes the user should have, and remove any that
-		 * they aren't allowed to have (secureops etc).
-		 */
-		c->SetCorrectModes(u, true, true);
-
-		if (c->ci)
-			c->ci->CheckKick(u);
+		joined.push_back(u);
 	}
 
+	/* Set whatever modes the users should have, and remove any that
+	 * they aren't allowed to have (secureops etc). This is done for the
+	 * whole netjoin at once, which can be thousands of users.
+	 */
+	c->SetCorrectModes(joined, true, true);
+
+	if (c->ci)
+		for (unsigned i = 0; i < joined.size(); ++i)
+			c->ci->CheckKick(joined[i]);
+
 	/* Channel is done syncing */
 	if (c->HasExt("SYNCING"))
 	{
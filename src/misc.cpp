@@ -26,6 +26,7 @@
 #ifndef _WIN32
 #include <sys/socket.h>
 #include <netdb.h>
+#include <sys/time.h>
 #endif
 
 NumberList::NumberList(const Anope::string &list, bool descending) : is_valid(true), desc(descending)
@@ -243,6 +244,13 @@ bool Anope::IsFile(const Anope::string &filename)
 	return false;
 }
 
+uint64_t Anope::MicroTime()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
 time_t Anope::DoTime(const Anope::string &s)
 {
 	if (s.empty())
@@ -474,6 +482,15 @@ bool Anope::Match(const Anope::string &str, const Anope::string &mask, bool case
 	return m == mask_len;
 }
 
+Anope::string Anope::LiteralPrefix(const Anope::string &mask, bool use_regex)
+{
+	/* A regex may match anything, and Match() falls back to a plain match if it doesn't */
+	if (use_regex && mask.length() >= 2 && mask[0] == '/' && mask[mask.length() - 1] == '/')
+		return "";
+
+	return mask.substr(0, mask.find_first_of("*?"));
+}
+
 void Anope::Encrypt(const Anope::string &src, Anope::string &dest)
 {
 	EventReturn MOD_RESULT;
@@ -20,6 +20,7 @@
 #include "config.h"
 
 Serialize::Checker<nickalias_map> NickAliasList("NickAlias");
+Serialize::Checker<ordered_nickalias_map> OrderedNickAliasList("NickAlias");
 
 NickAlias::NickAlias(const Anope::string &nickname, NickCore* nickcore) : Serializable("NickAlias")
 {
@@ -35,6 +36,7 @@ NickAlias::NickAlias(const Anope::string &nickname, NickCore* nickcore) : Serial
 
 	size_t old = NickAliasList->size();
 	(*NickAliasList)[this->nick] = this;
+	(*OrderedNickAliasList)[this->nick] = this;
 	if (old == NickAliasList->size())
 		Log(LOG_DEBUG) << "Duplicate nick " << nickname << " in nickalias table";
 
@@ -75,6 +77,7 @@ NickAlias::~NickAlias()
 
 	/* Remove us from the aliases list */
 	NickAliasList->erase(this->nick);
+	OrderedNickAliasList->erase(this->nick);
 }
 
 void NickAlias::Release()
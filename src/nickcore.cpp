@@ -14,10 +14,12 @@
 #include "modules.h"
 #include "account.h"
 #include "config.h"
+#include "access.h"
+#include "regchannel.h"
 
 Serialize::Checker<nickcore_map> NickCoreList("NickCore");
 
-NickCore::NickCore(const Anope::string &coredisplay) : Serializable("NickCore"), chanaccess("ChannelInfo"), aliases("NickAlias")
+NickCore::NickCore(const Anope::string &coredisplay) : Serializable("NickCore"), chanaccess("ChannelInfo"), access_refs("ChanAccess"), akick_refs("AutoKick"), aliases("NickAlias")
 {
 	if (coredisplay.empty())
 		throw CoreException("Empty display passed to NickCore constructor");
@@ -277,6 +279,58 @@ void NickCore::GetChannelReferences(std::deque<ChannelInfo *> &queue)
 		queue.push_back(it->first);
 }
 
+void NickCore::AddAccessReference(ChanAccess *entry)
+{
+	this->access_refs->insert(std::make_pair(entry->ci, entry));
+	this->AddChannelReference(entry->ci);
+}
+
+void NickCore::RemoveAccessReference(ChanAccess *entry)
+{
+	typedef std::multimap<ChannelInfo *, ChanAccess *>::iterator iterator;
+	for (std::pair<iterator, iterator> range = this->access_refs->equal_range(entry->ci); range.first != range.second; ++range.first)
+		if (range.first->second == entry)
+		{
+			this->access_refs->erase(range.first);
+			this->RemoveChannelReference(entry->ci);
+			break;
+		}
+}
+
+void NickCore::GetAccessReferences(ChannelInfo *ci, std::vector<ChanAccess *> &entries)
+{
+	entries.clear();
+	typedef std::multimap<ChannelInfo *, ChanAccess *>::iterator iterator;
+	for (std::pair<iterator, iterator> range = this->access_refs->equal_range(ci); range.first != range.second; ++range.first)
+		entries.push_back(range.first->second);
+}
+
+void NickCore::AddAkickReference(AutoKick *akick)
+{
+	this->akick_refs->insert(std::make_pair(akick->ci, akick));
+	this->AddChannelReference(akick->ci);
+}
+
+void NickCore::RemoveAkickReference(AutoKick *akick)
+{
+	typedef std::multimap<ChannelInfo *, AutoKick *>::iterator iterator;
+	for (std::pair<iterator, iterator> range = this->akick_refs->equal_range(akick->ci); range.first != range.second; ++range.first)
+		if (range.first->second == akick)
+		{
+			this->akick_refs->erase(range.first);
+			this->RemoveChannelReference(akick->ci);
+			break;
+		}
+}
+
+void NickCore::GetAkickReferences(ChannelInfo *ci, std::vector<AutoKick *> &entries)
+{
+	entries.clear();
+	typedef std::multimap<ChannelInfo *, AutoKick *>::iterator iterator;
+	for (std::pair<iterator, iterator> range = this->akick_refs->equal_range(ci); range.first != range.second; ++range.first)
+		entries.push_back(range.first->second);
+}
+
 NickCore* NickCore::Find(const Anope::string &nick)
 {
 	nickcore_map::const_iterator it = NickCoreList->find(nick);
@@ -38,54 +38,124 @@ OperType *OperType::Find(const Anope::string &name)
 	return NULL;
 }
 
-OperType::OperType(const Anope::string &nname) : name(nname)
+/* Stop remembering results past this many, in case something looks up arbitrary strings */
+static const unsigned MAX_MEMO = 1024;
+
+unsigned OperType::generation = 1;
+
+void OperType::Matcher::Compile(const std::list<Anope::string> &masks)
 {
+	this->exact.clear();
+	this->trie.assign(1, Node());
+	this->wildcards.clear();
+	this->memo.clear();
+
+	for (std::list<Anope::string>::const_iterator it = masks.begin(), it_end = masks.end(); it != it_end; ++it)
+	{
+		const Anope::string &mask = *it;
+		size_t wild = mask.find_first_of("*?");
+
+		if (wild == Anope::string::npos)
+			this->exact[mask] = true;
+		else if (wild == mask.length() - 1 && mask[wild] == '*')
+		{
+			unsigned node = 0;
+			for (unsigned i = 0; i < wild; ++i)
+			{
+				unsigned char c = Anope::tolower(mask[i]);
+				std::map<unsigned char, unsigned>::iterator child = this->trie[node].children.find(c);
+				if (child != this->trie[node].children.end())
+					node = child->second;
+				else
+				{
+					this->trie.push_back(Node());
+					this->trie[node].children[c] = this->trie.size() - 1;
+					node = this->trie.size() - 1;
+				}
+			}
+			this->trie[node].terminal = true;
+		}
+		else
+			this->wildcards.push_back(mask);
+	}
 }
 
-bool OperType::HasCommand(const Anope::string &cmdstr) const
+bool OperType::Matcher::Search(const Anope::string &str) const
 {
-	for (std::list<Anope::string>::const_iterator it = this->commands.begin(), it_end = this->commands.end(); it != it_end; ++it)
+	if (this->exact.count(str))
+		return true;
+
+	unsigned node = 0;
+	for (unsigned i = 0;; ++i)
 	{
-		if (Anope::Match(cmdstr, *it))
+		if (this->trie[node].terminal)
 			return true;
+		if (i == str.length())
+			break;
+
+		std::map<unsigned char, unsigned>::const_iterator child = this->trie[node].children.find(Anope::tolower(str[i]));
+		if (child == this->trie[node].children.end())
+			break;
+		node = child->second;
 	}
-	for (std::set<OperType *>::const_iterator iit = this->inheritances.begin(), iit_end = this->inheritances.end(); iit != iit_end; ++iit)
-	{
-		OperType *ot = *iit;
 
-		if (ot->HasCommand(cmdstr))
+	for (unsigned i = 0; i < this->wildcards.size(); ++i)
+		if (Anope::Match(str, this->wildcards[i]))
 			return true;
-	}
 
 	return false;
 }
 
-bool OperType::HasPriv(const Anope::string &privstr) const
+bool OperType::Matcher::Matches(const Anope::string &str)
 {
-	for (std::list<Anope::string>::const_iterator it = this->privs.begin(), it_end = this->privs.end(); it != it_end; ++it)
-	{
-		if (Anope::Match(privstr, *it))
-			return true;
-	}
-	for (std::set<OperType *>::const_iterator iit = this->inheritances.begin(), iit_end = this->inheritances.end(); iit != iit_end; ++iit)
-	{
-		OperType *ot = *iit;
+	Anope::hash_map<bool>::const_iterator it = this->memo.find(str);
+	if (it != this->memo.end())
+		return it->second;
+
+	bool result = this->Search(str);
+	if (this->memo.size() >= MAX_MEMO)
+		this->memo.clear();
+	this->memo[str] = result;
+	return result;
+}
 
-		if (ot->HasPriv(privstr))
-			return true;
-	}
+OperType::OperType(const Anope::string &nname) : name(nname), compiled(0)
+{
+}
 
-	return false;
+void OperType::Compile() const
+{
+	if (this->compiled == generation)
+		return;
+
+	/* These include everything inherited */
+	this->command_matcher.Compile(this->GetCommands());
+	this->priv_matcher.Compile(this->GetPrivs());
+	this->compiled = generation;
+}
+
+bool OperType::HasCommand(const Anope::string &cmdstr) const
+{
+	this->Compile();
+	return this->command_matcher.Matches(cmdstr);
+}
+
+bool OperType::HasPriv(const Anope::string &privstr) const
+{
+	this->Compile();
+	return this->priv_matcher.Matches(privstr);
 }
 
 void OperType::AddCommand(const Anope::string &cmdstr)
 {
 	this->commands.push_back(cmdstr);
+	++generation;
 }
 
 void OperType::AddPriv(const Anope::string &privstr)
 {
 	this->privs.push_back(privstr);
+	++generation;
 }
 
 const Anope::string &OperType::GetName() const
@@ -96,7 +166,10 @@ const Anope::string &OperType::GetName() const
 void OperType::Inherits(OperType *ot)
 {
 	if (ot != this)
+	{
 		this->inheritances.insert(ot);
+		++generation;
+	}
 }
 
 const std::list<Anope::string> OperType::GetCommands() const
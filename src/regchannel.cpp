@@ -20,8 +20,11 @@
 #include "bots.h"
 #include "language.h"
 #include "servers.h"
+#include "protocol.h"
+#include "sockets.h"
 
 Serialize::Checker<registered_channel_map> RegisteredChannelList("ChannelInfo");
+Serialize::Checker<ordered_registered_channel_map> OrderedRegisteredChannelList("ChannelInfo");
 
 BadWord::BadWord() : Serializable("BadWord")
 {
@@ -34,6 +37,7 @@ BadWord::~BadWord()
 		std::vector<BadWord *>::iterator it = std::find(this->ci->badwords->begin(), this->ci->badwords->end(), this);
 		if (it != this->ci->badwords->end())
 			this->ci->badwords->erase(it);
+		++this->ci->badwords_version;
 	}
 }
 
@@ -64,6 +68,7 @@ Serializable* BadWord::Unserialize(Serializable *obj, Serialize::Data &data)
 		bw = anope_dynamic_static_cast<BadWord *>(obj);
 		data["word"] >> bw->word;
 		bw->type = static_cast<BadWordType>(n);
+		++ci->badwords_version;
 	}
 	else
 		bw = ci->AddBadWord(sword, static_cast<BadWordType>(n));
@@ -71,7 +76,286 @@ Serializable* BadWord::Unserialize(Serializable *obj, Serialize::Data &data)
 	return bw;
 }
 
-AutoKick::AutoKick() : Serializable("AutoKick")
+/** Index of a channel's akick list. Account akicks are keyed on their account and
+ * masks with a literal host on that host, with CIDR masks also kept in a binary trie.
+ * Everything else (wildcard hosts, extbans, channels) is checked in list order.
+ * Candidates are always confirmed with AutoKick::Matches, so the index only
+ * decides which entries are worth checking.
+ */
+class AutoKickMatcher
+{
+	struct Record
+	{
+		AutoKick *ak;
+		/* Position on the akick list, lower entries take precedence */
+		unsigned long order;
+		const NickCore *nc;
+		Anope::string host;
+		/* Trie and node this entry is stored on, node 0 if none */
+		int trie;
+		unsigned node;
+	};
+
+	struct Node
+	{
+		unsigned child[2];
+		std::vector<Record *> records;
+
+		Node() { child[0] = child[1] = 0; }
+	};
+
+	typedef std::vector<Record *> RecordList;
+
+	std::map<AutoKick *, Record> records;
+	std::tr1::unordered_map<const NickCore *, RecordList> accounts;
+	Anope::hash_map<RecordList> hosts;
+	/* IPv4 and IPv6 tries, node 0 is the root */
+	std::vector<Node> tries[2];
+	std::map<unsigned long, Record *> others;
+	unsigned long next_order;
+
+	static void Erase(RecordList &list, const Record *r)
+	{
+		RecordList::iterator it = std::find(list.begin(), list.end(), r);
+		if (it != list.end())
+			list.erase(it);
+	}
+
+	static bool Bit(const unsigned char *addr, unsigned i)
+	{
+		return (addr[i / 8] >> (7 - i % 8)) & 1;
+	}
+
+	static const unsigned char *Address(const sockaddrs &addr, int &trie, unsigned &bits)
+	{
+		if (addr.sa.sa_family == AF_INET)
+		{
+			trie = 0;
+			bits = 32;
+			return reinterpret_cast<const unsigned char *>(&addr.sa4.sin_addr);
+		}
+		else if (addr.sa.sa_family == AF_INET6)
+		{
+			trie = 1;
+			bits = 128;
+			return reinterpret_cast<const unsigned char *>(&addr.sa6.sin6_addr);
+		}
+
+		return NULL;
+	}
+
+	/* Returns the node for the first len bits of addr, creating it if needed */
+	unsigned Insert(int trie, const unsigned char *addr, unsigned len)
+	{
+		std::vector<Node> &nodes = this->tries[trie];
+		if (nodes.empty())
+			nodes.push_back(Node());
+
+		unsigned n = 0;
+		for (unsigned i = 0; i < len; ++i)
+		{
+			bool b = Bit(addr, i);
+			if (!nodes[n].child[b])
+			{
+				nodes[n].child[b] = nodes.size();
+				nodes.push_back(Node());
+			}
+			n = nodes[n].child[b];
+		}
+
+		return n;
+	}
+
+	void Link(Record &r)
+	{
+		AutoKick *ak = r.ak;
+
+		delete ak->entry;
+		ak->entry = ak->nc ? NULL : new Entry("BAN", ak->mask);
+
+		r.nc = ak->nc;
+		r.host.clear();
+		r.trie = 0;
+		r.node = 0;
+
+		if (r.nc)
+		{
+			this->accounts[r.nc].push_back(&r);
+			return;
+		}
+
+		const Entry *e = ak->entry;
+		if (!IRCD || IRCD->IsExtbanValid(ak->mask) || IRCD->IsChannelValid(ak->mask) || e->host.empty() || e->host.find_first_of("*?") != Anope::string::npos)
+		{
+			this->others[r.order] = &r;
+			return;
+		}
+
+		if (e->cidr_len)
+		{
+			const unsigned char *addr = NULL;
+			unsigned bits = 0;
+			sockaddrs sa;
+
+			try
+			{
+				sa.pton(e->host.find(':') != Anope::string::npos ? AF_INET6 : AF_INET, e->host);
+				addr = Address(sa, r.trie, bits);
+			}
+			catch (const SocketException &) { }
+
+			/* Oversized ranges are left to Entry::Matches to make sense of */
+			if (addr == NULL || e->cidr_len > bits)
+			{
+				this->others[r.order] = &r;
+				return;
+			}
+
+			r.node = this->Insert(r.trie, addr, e->cidr_len);
+			this->tries[r.trie][r.node].records.push_back(&r);
+		}
+
+		/* Without a full match CIDR masks are compared to the host as-is, so index those too */
+		r.host = e->host;
+		this->hosts[r.host].push_back(&r);
+	}
+
+	void Unlink(Record &r)
+	{
+		if (r.nc)
+		{
+			std::tr1::unordered_map<const NickCore *, RecordList>::iterator it = this->accounts.find(r.nc);
+			if (it != this->accounts.end())
+			{
+				Erase(it->second, &r);
+				if (it->second.empty())
+					this->accounts.erase(it);
+			}
+		}
+		else if (!r.host.empty())
+		{
+			Anope::hash_map<RecordList>::iterator it = this->hosts.find(r.host);
+			if (it != this->hosts.end())
+			{
+				Erase(it->second, &r);
+				if (it->second.empty())
+					this->hosts.erase(it);
+			}
+
+			if (r.node)
+				Erase(this->tries[r.trie][r.node].records, &r);
+		}
+		else
+			this->others.erase(r.order);
+	}
+
+	static void Consider(const Record *&best, const Record *r, User *u)
+	{
+		if ((!best || r->order < best->order) && r->ak->Matches(u))
+			best = r;
+	}
+
+	void ConsiderHost(const Record *&best, const Anope::string &host, User *u) const
+	{
+		if (host.empty())
+			return;
+
+		Anope::hash_map<RecordList>::const_iterator it = this->hosts.find(host);
+		if (it != this->hosts.end())
+			for (unsigned i = 0; i < it->second.size(); ++i)
+				Consider(best, it->second[i], u);
+	}
+
+ public:
+	AutoKickMatcher() : next_order(0) { }
+
+	void Add(AutoKick *ak)
+	{
+		Record &r = this->records[ak];
+		r.ak = ak;
+		r.order = this->next_order++;
+		this->Link(r);
+	}
+
+	/* Reindex an akick whose mask or account has changed, keeping its place on the list */
+	void Update(AutoKick *ak)
+	{
+		std::map<AutoKick *, Record>::iterator it = this->records.find(ak);
+		if (it == this->records.end())
+			return;
+
+		this->Unlink(it->second);
+		this->Link(it->second);
+	}
+
+	void Remove(AutoKick *ak)
+	{
+		std::map<AutoKick *, Record>::iterator it = this->records.find(ak);
+		if (it == this->records.end())
+			return;
+
+		this->Unlink(it->second);
+		this->records.erase(it);
+
+		if (this->records.empty())
+		{
+			this->tries[0].clear();
+			this->tries[1].clear();
+		}
+	}
+
+	AutoKick *Find(User *u) const
+	{
+		const Record *best = NULL;
+
+		if (u->Account())
+		{
+			std::tr1::unordered_map<const NickCore *, RecordList>::const_iterator it = this->accounts.find(u->Account());
+			if (it != this->accounts.end())
+				for (unsigned i = 0; i < it->second.size(); ++i)
+					Consider(best, it->second[i], u);
+		}
+
+		this->ConsiderHost(best, u->GetDisplayedHost(), u);
+		this->ConsiderHost(best, u->GetCloakedHost(), u);
+		this->ConsiderHost(best, u->host, u);
+		this->ConsiderHost(best, u->ip, u);
+
+		if (!this->tries[0].empty() || !this->tries[1].empty())
+		{
+			try
+			{
+				sockaddrs sa(u->ip);
+				int trie = 0;
+				unsigned bits = 0;
+				const unsigned char *addr = Address(sa, trie, bits);
+				const std::vector<Node> &nodes = this->tries[trie];
+
+				for (unsigned i = 0, n = 0; addr != NULL && !nodes.empty() && i < bits; ++i)
+				{
+					n = nodes[n].child[Bit(addr, i)];
+					if (!n)
+						break;
+
+					for (unsigned j = 0; j < nodes[n].records.size(); ++j)
+						Consider(best, nodes[n].records[j], u);
+				}
+			}
+			catch (const SocketException &) { }
+		}
+
+		for (std::map<unsigned long, Record *>::const_iterator it = this->others.begin(), it_end = this->others.end(); it != it_end && (!best || it->first < best->order); ++it)
+			if (it->second->ak->Matches(u))
+			{
+				best = it->second;
+				break;
+			}
+
+		return best ? best->ak : NULL;
+	}
+};
+
+AutoKick::AutoKick() : Serializable("AutoKick"), entry(NULL)
 {
 }
 
@@ -82,11 +366,13 @@ AutoKick::~AutoKick()
 		std::vector<AutoKick *>::iterator it = std::find(this->ci->akick->begin(), this->ci->akick->end(), this);
 		if (it != this->ci->akick->end())
 			this->ci->akick->erase(it);
+		this->ci->akick_matcher->Remove(this);
 
-		const NickAlias *na = NickAlias::Find(this->mask);
-		if (na != NULL)
-			na->nc->RemoveChannelReference(this->ci);
+		if (this->nc)
+			this->nc->RemoveAkickReference(this);
 	}
+
+	delete this->entry;
 }
 
 void AutoKick::Serialize(Serialize::Data &data) const
@@ -120,10 +406,16 @@ Serializable* AutoKick::Unserialize(Serializable *obj, Serialize::Data &data)
 		ak = anope_dynamic_static_cast<AutoKick *>(obj);
 		data["creator"] >> ak->creator;
 		data["reason"] >> ak->reason;
-		ak->nc = NickCore::Find(snc);
+		if (ak->nc)
+			ak->nc->RemoveAkickReference(ak);
+		ak->nc = nc;
+		if (nc)
+			nc->AddAkickReference(ak);
 		data["mask"] >> ak->mask;
 		data["addtime"] >> ak->addtime;
 		data["last_used"] >> ak->last_used;
+		if (ak->ci)
+			ak->ci->akick_matcher->Update(ak);
 	}
 	else
 	{
@@ -146,6 +438,19 @@ Serializable* AutoKick::Unserialize(Serializable *obj, Serialize::Data &data)
 	return ak;
 }
 
+bool AutoKick::Matches(User *u) const
+{
+	if (this->nc)
+		return this->nc == u->Account();
+	else if (IRCD->IsChannelValid(this->mask))
+	{
+		Channel *c = Channel::Find(this->mask);
+		return c != NULL && c->FindUser(u);
+	}
+	else
+		return this->entry != NULL && this->entry->Matches(u);
+}
+
 ModeLock::ModeLock(ChannelInfo *ch, bool s, const Anope::string &n, const Anope::string &p, const Anope::string &se, time_t c) : Serializable("ModeLock"), ci(ch), set(s), name(n), param(p), setter(se), created(c)
 {
 }
@@ -276,6 +581,9 @@ ChannelInfo::ChannelInfo(const Anope::string &chname) : Serializable("ChannelInf
 	this->repeattimes = 0;
 	this->banexpire = 0;
 	this->bi = NULL;
+	this->badwords_version = 0;
+	this->levels_version = 0;
+	this->akick_matcher = new AutoKickMatcher();
 	this->last_topic_time = 0;
 
 	this->name = chname;
@@ -289,6 +597,7 @@ ChannelInfo::ChannelInfo(const Anope::string &chname) : Serializable("ChannelInf
 
 	size_t old = RegisteredChannelList->size();
 	(*RegisteredChannelList)[this->name] = this;
+	(*OrderedRegisteredChannelList)[this->name] = this;
 	if (old == RegisteredChannelList->size())
 		Log(LOG_DEBUG) << "Duplicate channel " << this->name << " in registered channel table?";
 
@@ -304,6 +613,7 @@ ChannelInfo::ChannelInfo(const ChannelInfo &ci) : Serializable("ChannelInfo"),
 	if (this->founder)
 		--this->founder->channelcount;
 
+	this->akick_matcher = new AutoKickMatcher();
 	this->access->clear();
 	this->akick->clear();
 	this->badwords->clear();
@@ -367,6 +677,7 @@ ChannelInfo::~ChannelInfo()
 	}
 
 	RegisteredChannelList->erase(this->name);
+	OrderedRegisteredChannelList->erase(this->name);
 
 	this->SetFounder(NULL);
 	this->SetSuccessor(NULL);
@@ -375,6 +686,8 @@ ChannelInfo::~ChannelInfo()
 	this->ClearAkick();
 	this->ClearBadWords();
 
+	delete this->akick_matcher;
+
 	for (unsigned i = 0; i < this->log_settings->size(); ++i)
 		delete this->log_settings->at(i);
 	this->log_settings->clear();
@@ -462,6 +775,7 @@ Serializable* ChannelInfo::Unserialize(Serializable *obj, Serialize::Data &data)
 		spacesepstream(slevels).GetTokens(v);
 		for (unsigned i = 0; i + 1 < v.size(); i += 2)
 			ci->levels[v[i]] = convertTo<int16_t>(v[i + 1]);
+		++ci->levels_version;
 	}
 	BotInfo *bi = BotInfo::Find(sbi);
 	if (*ci->bi != bi)
@@ -565,13 +879,14 @@ BotInfo *ChannelInfo::WhoSends() const
 
 void ChannelInfo::AddAccess(ChanAccess *taccess)
 {
+	taccess->ci = this;
 	this->access->push_back(taccess);
 
 	const NickAlias *na = NickAlias::Find(taccess->mask);
 	if (na != NULL)
 	{
-		na->nc->AddChannelReference(this);
 		taccess->nc = na->nc;
+		na->nc->AddAccessReference(taccess);
 	}
 }
 
@@ -622,10 +937,21 @@ AccessGroup ChannelInfo::AccessFor(const User *u)
 
 	if (group.founder || !group.empty())
 	{
-		this->last_used = Anope::CurTime;
+		/* Only queue an update when the time actually changes, access is checked very often */
+		if (this->last_used != Anope::CurTime)
+		{
+			this->last_used = Anope::CurTime;
+			this->QueueUpdate();
+		}
 
 		for (unsigned i = 0; i < group.size(); ++i)
-			group[i]->last_seen = Anope::CurTime;
+		{
+			if (group[i]->last_seen != Anope::CurTime)
+			{
+				group[i]->last_seen = Anope::CurTime;
+				group[i]->QueueUpdate();
+			}
+		}
 	}
 
 	return group;
@@ -656,10 +982,21 @@ AccessGroup ChannelInfo::AccessFor(const NickCore *nc)
 	
 	if (group.founder || !group.empty())
 	{
-		this->last_used = Anope::CurTime;
+		/* Only queue an update when the time actually changes, access is checked very often */
+		if (this->last_used != Anope::CurTime)
+		{
+			this->last_used = Anope::CurTime;
+			this->QueueUpdate();
+		}
 
 		for (unsigned i = 0; i < group.size(); ++i)
-			group[i]->last_seen = Anope::CurTime;
+		{
+			if (group[i]->last_seen != Anope::CurTime)
+			{
+				group[i]->last_seen = Anope::CurTime;
+				group[i]->QueueUpdate();
+			}
+		}
 	}
 
 	return group;
@@ -695,8 +1032,9 @@ AutoKick *ChannelInfo::AddAkick(const Anope::string &user, NickCore *akicknc, co
 	autokick->last_used = lu;
 
 	this->akick->push_back(autokick);
+	this->akick_matcher->Add(autokick);
 
-	akicknc->AddChannelReference(this);
+	akicknc->AddAkickReference(autokick);
 
 	return autokick;
 }
@@ -713,6 +1051,7 @@ AutoKick *ChannelInfo::AddAkick(const Anope::string &user, const Anope::string &
 	autokick->last_used = lu;
 
 	this->akick->push_back(autokick);
+	this->akick_matcher->Add(autokick);
 
 	return autokick;
 }
@@ -727,6 +1066,14 @@ AutoKick *ChannelInfo::GetAkick(unsigned index) const
 	return ak;
 }
 
+AutoKick *ChannelInfo::MatchAkick(User *u)
+{
+	AutoKick *ak = this->akick_matcher->Find(u);
+	if (ak)
+		ak->QueueUpdate();
+	return ak;
+}
+
 unsigned ChannelInfo::GetAkickCount() const
 {
 	return this->akick->size();
@@ -754,6 +1101,7 @@ BadWord* ChannelInfo::AddBadWord(const Anope::string &word, BadWordType type)
 	bw->type = type;
 
 	this->badwords->push_back(bw);
+	++this->badwords_version;
 
 	FOREACH_MOD(I_OnBadWordAdd, OnBadWordAdd(this, bw));
 
@@ -791,6 +1139,11 @@ void ChannelInfo::ClearBadWords()
 		delete this->badwords->back();
 }
 
+unsigned ChannelInfo::GetBadWordVersion() const
+{
+	return this->badwords_version;
+}
+
 bool ChannelInfo::HasMLock(ChannelMode *mode, const Anope::string &param, bool status) const
 {
 	if (!mode)
@@ -1082,16 +1435,24 @@ int16_t ChannelInfo::GetLevel(const Anope::string &priv) const
 void ChannelInfo::SetLevel(const Anope::string &priv, int16_t level)
 {
 	this->levels[priv] = level;
+	++this->levels_version;
 }
 
 void ChannelInfo::RemoveLevel(const Anope::string &priv)
 {
 	this->levels.erase(priv);
+	++this->levels_version;
 }
 
 void ChannelInfo::ClearLevels()
 {
 	this->levels.clear();
+	++this->levels_version;
+}
+
+unsigned ChannelInfo::GetLevelsVersion() const
+{
+	return this->levels_version;
 }
 
 Anope::string ChannelInfo::GetIdealBan(User *u) const
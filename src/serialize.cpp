@@ -26,6 +26,8 @@ using namespace Serialize;
 std::vector<Anope::string> Type::TypeOrder;
 std::map<Anope::string, Type *> Serialize::Type::Types;
 std::list<Serializable *> *Serializable::SerializableItems;
+unsigned Type::trackers = 0;
+bool Serialize::Loading = false;
 
 void Serialize::RegisterTypes()
 {
@@ -44,7 +46,7 @@ void Serialize::CheckTypes()
 	}
 }
 
-Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0), last_commit_time(0), id(0)
+Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0), last_commit_time(0), dirty(false), generation(0), id(0)
 {
 	if (SerializableItems == NULL)
 		SerializableItems = new std::list<Serializable *>();
@@ -55,10 +57,12 @@ Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0)
 	this->s_iter = SerializableItems->end();
 	--this->s_iter;
 
+	this->MarkDirty();
+
 	FOREACH_MOD(I_OnSerializableConstruct, OnSerializableConstruct(this));
 }
 
-Serializable::Serializable(const Serializable &other) : last_commit(0), last_commit_time(0), id(0)
+Serializable::Serializable(const Serializable &other) : last_commit(0), last_commit_time(0), dirty(false), generation(0), id(0)
 {
 	SerializableItems->push_back(this);
 	this->s_iter = SerializableItems->end();
@@ -73,6 +77,8 @@ Serializable::~Serializable()
 {
 	FOREACH_MOD(I_OnSerializableDestruct, OnSerializableDestruct(this));
 
+	this->ClearDirty();
+
 	SerializableItems->erase(this->s_iter);
 }
 
@@ -83,6 +89,8 @@ Serializable &Serializable::operator=(const Serializable &)
 
 void Serializable::QueueUpdate()
 {
+	this->MarkDirty();
+
 	/* Schedule updater */
 	FOREACH_MOD(I_OnSerializableUpdate, OnSerializableUpdate(this));
 
@@ -90,6 +98,25 @@ void Serializable::QueueUpdate()
 	FOREACH_MOD(I_OnSerializeCheck, OnSerializeCheck(this->GetSerializableType()));
 }
 
+void Serializable::MarkDirty()
+{
+	++this->generation;
+
+	/* Objects being loaded are already in the database */
+	if (!this->dirty && this->s_type && Type::IsTrackingDirty() && !Serialize::Loading)
+	{
+		this->s_type->dirty.insert(this);
+		this->dirty = true;
+	}
+}
+
+void Serializable::ClearDirty()
+{
+	if (this->dirty && this->s_type)
+		this->s_type->dirty.erase(this);
+	this->dirty = false;
+}
+
 bool Serializable::IsCached(Serialize::Data &data)
 {
 	return this->last_commit == data.Hash();
@@ -125,6 +152,9 @@ Type::Type(const Anope::string &n, unserialize_func f, Module *o)  : name(n), un
 
 Type::~Type()
 {
+	for (std::set<Serializable *>::iterator it = this->dirty.begin(), it_end = this->dirty.end(); it != it_end; ++it)
+		(*it)->dirty = false;
+
 	std::vector<Anope::string>::iterator it = std::find(TypeOrder.begin(), TypeOrder.end(), this->name);
 	if (it != TypeOrder.end())
 		TypeOrder.erase(it);
@@ -151,6 +181,26 @@ void Type::UpdateTimestamp()
 	this->timestamp = Anope::CurTime;
 }
 
+void Type::ClearDirty()
+{
+	for (std::set<Serializable *>::iterator it = this->dirty.begin(), it_end = this->dirty.end(); it != it_end; ++it)
+		(*it)->dirty = false;
+	this->dirty.clear();
+}
+
+void Type::TrackDirty(bool track)
+{
+	if (track)
+	{
+		++trackers;
+		return;
+	}
+
+	if (trackers > 0 && --trackers == 0)
+		for (std::map<Anope::string, Type *>::iterator it = Types.begin(), it_end = Types.end(); it != it_end; ++it)
+			it->second->ClearDirty();
+}
+
 Type *Serialize::Type::Find(const Anope::string &name)
 {
 	std::map<Anope::string, Type *>::iterator it = Types.find(name);
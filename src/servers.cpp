@@ -32,6 +32,9 @@ Server::Server(Server *up, const Anope::string &sname, unsigned shops, const Ano
 {
 	syncing = true;
 	juped = jupe;
+	burst_users = 0;
+	burst_start = Anope::MicroTime();
+	burst_time = 0;
 
 	Servers::ByName[sname] = this;
 	if (!ssid.empty())
@@ -235,9 +238,16 @@ void Server::Sync(bool sync_links)
 
 	syncing = false;
 
-	Log(this, "sync") << "is done syncing";
+	if (this == Me)
+		Log(this, "sync") << "is done syncing";
+	else
+	{
+		this->burst_time = (Anope::MicroTime() - this->burst_start) / 1000;
+		Log(this, "sync") << "is done syncing (" << this->burst_users << " users in " << this->burst_time << "ms)";
+	}
 
 	FOREACH_MOD(I_OnServerSync, OnServerSync(this));
+	User::RunDeferredConnects();
 
 	if (sync_links && !this->links.empty())
 	{
@@ -238,12 +238,11 @@ bool cidr::match(const sockaddrs &other)
 	if (memcmp(ip, their_ip, byte))
 		return false;
 
-	byte = len % 8;
-	if (byte)
+	unsigned char bits = len % 8;
+	if (bits)
 	{
-		ip += byte;
-		their_ip += byte;
-		if ((*ip & byte) != (*their_ip & byte))
+		unsigned char mask = 0xFF << (8 - bits);
+		if ((ip[byte] & mask) != (their_ip[byte] & mask))
 			return false;
 	}
 
@@ -301,15 +300,19 @@ size_t cidr::hash::operator()(const cidr &s) const
 		}
 		case AF_INET6:
 		{
+			/* Every byte in the range has to affect the hash, sessions often differ in only one */
 			size_t h = 0;
+			unsigned len = s.cidr_len > 128 ? 128 : s.cidr_len;
 
-			for (unsigned i = 0; i < s.cidr_len / 8; ++i)
-				h ^= (s.addr.sa6.sin6_addr.s6_addr[i] << ((i * 8) % sizeof(size_t)));
+			for (unsigned i = 0; i < len / 8; ++i)
+				h = h * 31 + s.addr.sa6.sin6_addr.s6_addr[i];
 
-			int remaining = s.cidr_len % 8;
-			unsigned char m = 0xFF << (8 - remaining);
-
-			h ^= s.addr.sa6.sin6_addr.s6_addr[s.cidr_len / 8] & m;
+			int remaining = len % 8;
+			if (remaining)
+			{
+				unsigned char m = 0xFF << (8 - remaining);
+				h = h * 31 + (s.addr.sa6.sin6_addr.s6_addr[len / 8] & m);
+			}
 
 			return h;
 		}
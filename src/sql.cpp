@@ -0,0 +1,189 @@
+/*
+ * (C) 2003-2013 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+#include "services.h"
+#include "modules.h"
+#include "service.h"
+#include "serialize.h"
+#include "logger.h"
+#include "modules/sql.h"
+
+using namespace SQL;
+
+Anope::string Query::Substitute(Substitution &sub) const
+{
+	Anope::string text;
+
+	for (Anope::string::size_type pos = 0; pos < this->query.length();)
+	{
+		Anope::string::size_type start = this->query.find('@', pos), end = start != Anope::string::npos ? this->query.find('@', start + 1) : Anope::string::npos;
+		if (end == Anope::string::npos)
+		{
+			text += this->query.substr(pos);
+			break;
+		}
+
+		std::map<Anope::string, QueryData>::const_iterator it = this->parameters.find(this->query.substr(start + 1, end - start - 1));
+		if (it == this->parameters.end())
+		{
+			text += this->query.substr(pos, end - pos);
+			pos = end;
+			continue;
+		}
+
+		text += this->query.substr(pos, start - pos) + sub.Replace(it->first, it->second);
+		pos = end + 1;
+	}
+
+	return text;
+}
+
+Anope::string Placeholders::Replace(const Anope::string &name, const QueryData &)
+{
+	this->names.push_back(name);
+	return "?";
+}
+
+Query SQL::BuildRows(const Anope::string &command, const Anope::string &table, std::set<Anope::string> &columns, const std::map<unsigned int, Data *> &rows)
+{
+	/* Every row must have the same columns */
+	for (std::map<unsigned int, Data *>::const_iterator it = rows.begin(), it_end = rows.end(); it != it_end; ++it)
+		for (Data::Map::const_iterator dit = it->second->data.begin(), dit_end = it->second->data.end(); dit != dit_end; ++dit)
+			columns.insert(dit->first);
+	columns.erase("id");
+	columns.erase("timestamp");
+
+	Anope::string query_text = command + " INTO `" + table + "` (`id`";
+	for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		query_text += ",`" + *it + "`";
+	query_text += ") VALUES ";
+
+	Query query;
+	unsigned row = 0;
+	for (std::map<unsigned int, Data *>::const_iterator it = rows.begin(), it_end = rows.end(); it != it_end; ++it, ++row)
+	{
+		Data *data = it->second;
+
+		query_text += (row ? ",(" : "(") + stringify(it->first);
+		for (std::set<Anope::string>::iterator cit = columns.begin(), cit_end = columns.end(); cit != cit_end; ++cit)
+		{
+			const Anope::string &param = stringify(row) + "_" + *cit;
+			query_text += ",@" + param + "@";
+
+			Anope::string buf;
+			Data::Map::const_iterator dit = data->data.find(*cit);
+			if (dit != data->data.end())
+				*dit->second >> buf;
+			query.SetValue(param, buf);
+		}
+		query_text += ")";
+	}
+
+	query.query = query_text;
+	return query;
+}
+
+BatchWriter::~BatchWriter()
+{
+	for (std::map<Anope::string, std::map<unsigned int, Row> >::iterator it = this->tables.begin(), it_end = this->tables.end(); it != it_end; ++it)
+		for (std::map<unsigned int, Row>::iterator rit = it->second.begin(), rit_end = it->second.end(); rit != rit_end; ++rit)
+			delete rit->second.data;
+	for (unsigned i = 0; i < this->pending.size(); ++i)
+		for (unsigned j = 0; j < this->pending[i].size(); ++j)
+			delete this->pending[i][j].data;
+}
+
+void BatchWriter::Finish(std::vector<Row> &rows, const std::vector<Result> &results)
+{
+	bool committed = !results.empty();
+	for (unsigned i = 0; i < results.size(); ++i)
+		if (!results[i].GetError().empty())
+		{
+			Log(LOG_DEBUG) << "Error executing query " << results[i].finished_query << ": " << results[i].GetError();
+			committed = false;
+		}
+
+	for (unsigned i = 0; i < rows.size(); ++i)
+	{
+		Serializable *obj = rows[i].obj;
+		if (obj)
+		{
+			if (committed)
+				obj->UpdateCache(*rows[i].data);
+			else
+				obj->MarkDirty();
+		}
+		delete rows[i].data;
+	}
+}
+
+void BatchWriter::Add(const Anope::string &table, Serializable *obj, Data *data)
+{
+	std::map<unsigned int, Row> &rows = this->tables[table];
+	std::map<unsigned int, Row>::iterator it = rows.find(obj->id);
+	if (it != rows.end())
+	{
+		delete it->second.data;
+		it->second.data = data;
+	}
+	else
+		rows.insert(std::make_pair(obj->id, Row(obj, data)));
+}
+
+void BatchWriter::Write(Provider *sql, bool background)
+{
+	static const unsigned batch_size = 100;
+
+	for (std::map<Anope::string, std::map<unsigned int, Row> >::iterator it = this->tables.begin(), it_end = this->tables.end(); it != it_end; ++it)
+	{
+		std::vector<Query> queries;
+		std::vector<Row> rows;
+		std::map<unsigned int, Data *> batch;
+
+		for (std::map<unsigned int, Row>::iterator rit = it->second.begin(), rit_end = it->second.end(); rit != rit_end; ++rit)
+		{
+			rows.push_back(rit->second);
+			batch[rit->first] = rit->second.data;
+
+			if (batch.size() == batch_size)
+			{
+				queries.push_back(sql->BuildInsert(it->first, batch));
+				batch.clear();
+			}
+		}
+		if (!batch.empty())
+			queries.push_back(sql->BuildInsert(it->first, batch));
+
+		if (background)
+		{
+			/* Providers which don't queue give the results before Run returns */
+			this->pending.push_back(rows);
+			sql->Run(this, queries);
+		}
+		else
+		{
+			sql->Wait(this->owner);
+			this->Finish(rows, sql->RunQuery(queries));
+		}
+	}
+
+	this->tables.clear();
+}
+
+void BatchWriter::OnResults(const std::vector<Result> &results)
+{
+	if (this->pending.empty())
+		return;
+
+	this->Finish(this->pending.front(), results);
+	this->pending.pop_front();
+}
+
+void BatchWriter::OnError(const Result &r)
+{
+	Log(LOG_DEBUG) << "Error executing query " << r.finished_query << ": " << r.GetError();
+}
@@ -22,8 +22,13 @@
 #include "config.h"
 #include "opertype.h"
 #include "language.h"
+#include "sockets.h"
 
 user_map UserListByNick, UserListByUID;
+ordered_user_map OrderedUserList;
+
+/* Users by the user modes they have set */
+static std::map<Anope::string, std::set<User *> > UserModeIndex;
 
 int OperCount = 0;
 unsigned MaxUserCount = 0;
@@ -31,6 +36,156 @@ time_t MaxUserTime = 0;
 
 std::list<User *> User::quitting_users;
 
+/* An OnUserConnect event held back while the user's server was bursting */
+struct DeferredConnect
+{
+	Reference<User> user;
+	Anope::string module;
+
+	DeferredConnect(User *u, const Anope::string &m) : user(u), module(m) { }
+};
+
+/** Runs deferred OnUserConnect events once their servers are done syncing.
+ * Events are queued per server, so a server which is still bursting does
+ * not hold up the events of servers which are done. At most
+ * options:burstbudget milliseconds are spent each time the pipe is notified,
+ * and it notifies itself again if there is more left, so the socket engine
+ * gets to process the uplink in between.
+ */
+class DeferredConnectQueue : public Pipe
+{
+	/* When the current run started, see Anope::MicroTime */
+	uint64_t started;
+	/* Events run and time slices used by the current run */
+	unsigned ran, slices;
+
+ public:
+	/* Deferred events by the name of the server their users are on, in the order they were introduced */
+	std::map<Anope::string, std::deque<DeferredConnect> > events;
+
+	DeferredConnectQueue() : started(0), ran(0), slices(0) { }
+
+	size_t Size() const
+	{
+		size_t size = 0;
+		for (std::map<Anope::string, std::deque<DeferredConnect> >::const_iterator it = this->events.begin(), it_end = this->events.end(); it != it_end; ++it)
+			size += it->second.size();
+		return size;
+	}
+
+	bool ProcessRead() anope_override
+	{
+		/* Empty the pipe first, OnNotify may notify it again */
+		char dummy[512];
+		while (this->Read(dummy, sizeof(dummy)) == sizeof(dummy));
+
+		this->OnNotify();
+		return true;
+	}
+
+	void OnNotify() anope_override
+	{
+		uint64_t now = Anope::MicroTime(), deadline = now + Config->BurstBudget * 1000;
+
+		if (!started)
+			started = now;
+		++slices;
+
+		for (std::map<Anope::string, std::deque<DeferredConnect> >::iterator it = this->events.begin(); it != this->events.end();)
+		{
+			std::deque<DeferredConnect> &queue = it->second;
+
+			while (!queue.empty())
+			{
+				DeferredConnect &dc = queue.front();
+
+				User *u = dc.user;
+				/* Wait for the next Server::Sync, the events of other servers can still run */
+				if (u && !u->server->IsSynced())
+					break;
+
+				Module *m = ModuleManager::FindModule(dc.module);
+				std::vector<Module *> &handlers = ModuleManager::EventHandlers[I_OnUserConnect];
+				if (u && m && std::find(handlers.begin(), handlers.end(), m) != handlers.end())
+				{
+					/* Worked out now as the server may have been ulined since the user was introduced */
+					bool exempt = u->server->IsULined();
+					try
+					{
+						m->OnUserConnect(u, exempt);
+					}
+					catch (const ModuleException &modexcept)
+					{
+						Log() << "Exception caught: " << modexcept.GetReason();
+					}
+					++ran;
+				}
+
+				queue.pop_front();
+
+				if (Anope::MicroTime() >= deadline)
+				{
+					if (queue.empty())
+						this->events.erase(it);
+					this->Notify();
+					return;
+				}
+			}
+
+			if (queue.empty())
+				this->events.erase(it++);
+			else
+				++it;
+		}
+
+		/* Some servers are still bursting */
+		if (!this->events.empty())
+			return;
+
+		Log() << "Ran " << ran << " deferred connect events in " << (Anope::MicroTime() - started) / 1000 << "ms over " << slices << " main loop iterations";
+		started = 0;
+		ran = slices = 0;
+	}
+};
+
+static DeferredConnectQueue *deferred_connects = NULL;
+
+/* Like FOREACH_MOD(I_OnUserConnect, ...), but for users introduced during a
+ * burst, which honours the policy configured for each module */
+static void BurstConnect(User *u, bool &exempt)
+{
+	std::vector<Module *>::iterator safei;
+	for (std::vector<Module *>::iterator it = ModuleManager::EventHandlers[I_OnUserConnect].begin(); it != ModuleManager::EventHandlers[I_OnUserConnect].end();)
+	{
+		safei = it;
+		++safei;
+
+		std::map<Anope::string, BurstPolicy>::const_iterator pit = Config->BurstPolicies.find((*it)->name);
+		BurstPolicy policy = pit != Config->BurstPolicies.end() ? pit->second : BURST_RUN;
+
+		if (policy == BURST_DEFER)
+		{
+			/* The socket engine is running by now, so the pipe can be created */
+			if (!deferred_connects)
+				deferred_connects = new DeferredConnectQueue();
+			deferred_connects->events[u->server->GetName()].push_back(DeferredConnect(u, (*it)->name));
+		}
+		else if (policy == BURST_RUN)
+		{
+			try
+			{
+				(*it)->OnUserConnect(u, exempt);
+			}
+			catch (const ModuleException &modexcept)
+			{
+				Log() << "Exception caught: " << modexcept.GetReason();
+			}
+		}
+
+		it = safei;
+	}
+}
+
 User::User(const Anope::string &snick, const Anope::string &sident, const Anope::string &shost, const Anope::string &svhost, const Anope::string &sip, Server *sserver, const Anope::string &srealname, time_t ssignon, const Anope::string &smodes, const Anope::string &suid)
 {
 	if (snick.empty() || sident.empty() || shost.empty())
@@ -57,6 +212,7 @@ User::User(const Anope::string &snick, const Anope::string &sident, const Anope:
 
 	size_t old = UserListByNick.size();
 	UserListByNick[snick] = this;
+	OrderedUserList[snick] = this;
 	if (!suid.empty())
 		UserListByUID[suid] = this;
 	if (old == UserListByNick.size())
@@ -82,6 +238,17 @@ User::User(const Anope::string &snick, const Anope::string &sident, const Anope:
 	bool exempt = false;
 	if (server && server->IsULined())
 		exempt = true;
+
+	if (server && server != Me && !server->IsSynced())
+	{
+		++server->burst_users;
+		if (!Config->BurstPolicies.empty())
+		{
+			BurstConnect(this, exempt);
+			return;
+		}
+	}
+
 	FOREACH_MOD(I_OnUserConnect, OnUserConnect(this, exempt));
 }
 
@@ -102,12 +269,17 @@ void User::ChangeNick(const Anope::string &newnick, time_t ts)
 	else
 	{
 		NickAlias *old_na = NickAlias::Find(this->nick);
-		if (old_na && (this->IsIdentified(true) || this->IsRecognized()))
+		if (old_na && (this->IsIdentified(true) || this->IsRecognized()) && old_na->last_seen != Anope::CurTime)
+		{
 			old_na->last_seen = Anope::CurTime;
+			old_na->QueueUpdate();
+		}
 		
 		UserListByNick.erase(this->nick);
+		OrderedUserList.erase(this->nick);
 		this->nick = newnick;
 		UserListByNick[this->nick] = this;
+		OrderedUserList[this->nick] = this;
 
 		on_access = false;
 		NickAlias *na = NickAlias::Find(this->nick);
@@ -116,11 +288,17 @@ void User::ChangeNick(const Anope::string &newnick, time_t ts)
 
 		if (na && na->nc == this->Account())
 		{
-			na->last_seen = Anope::CurTime;
+			if (na->last_seen != Anope::CurTime)
+			{
+				na->last_seen = Anope::CurTime;
+				na->QueueUpdate();
+			}
 			this->UpdateHost();
 		}
 	}
 
+	UserIndex::Update(this);
+
 	FOREACH_MOD(I_OnUserNickChange, OnUserNickChange(this, old));
 }
 
@@ -247,8 +425,13 @@ User::~User()
 		this->chans.begin()->second->chan->DeleteUser(this);
 
 	UserListByNick.erase(this->nick);
+	OrderedUserList.erase(this->nick);
 	if (!this->uid.empty())
 		UserListByUID.erase(this->uid);
+	UserIndex::Remove(this);
+
+	for (std::map<Anope::string, Anope::string>::const_iterator it = this->modes.begin(), it_end = this->modes.end(); it != it_end; ++it)
+		UserModeIndex[it->first].erase(this);
 
 	FOREACH_MOD(I_OnPostUserLogoff, OnPostUserLogoff(this));
 }
@@ -361,6 +544,7 @@ void User::Identify(NickAlias *na)
 		na->last_realhost = last_realhost;
 		na->last_realname = this->realname;
 		na->last_seen = Anope::CurTime;
+		na->QueueUpdate();
 	}
 
 	this->Login(na->nc);
@@ -500,6 +684,8 @@ void User::UpdateHost()
 	if (this->host.empty())
 		return;
 
+	UserIndex::Update(this);
+
 	NickAlias *na = NickAlias::Find(this->nick);
 	on_access = false;
 	if (na)
@@ -525,6 +711,7 @@ void User::SetModeInternal(UserMode *um, const Anope::string &param)
 		return;
 
 	this->modes[um->name] = param;
+	UserModeIndex[um->name].insert(this);
 
 	FOREACH_MOD(I_OnUserModeSet, OnUserModeSet(this, um->name));
 }
@@ -535,6 +722,7 @@ void User::RemoveModeInternal(UserMode *um)
 		return;
 
 	this->modes.erase(um->name);
+	UserModeIndex[um->name].erase(this);
 
 	FOREACH_MOD(I_OnUserModeUnset, OnUserModeUnset(this, um->name));
 }
@@ -822,3 +1010,268 @@ void User::QuitUsers()
 	quitting_users.clear();
 }
 
+void User::RunDeferredConnects()
+{
+	if (deferred_connects && !deferred_connects->events.empty())
+		deferred_connects->Notify();
+}
+
+size_t User::DeferredConnects()
+{
+	return deferred_connects ? deferred_connects->Size() : 0;
+}
+
+
+/* Keys are lowercased so that prefix ranges line up with Anope::Match */
+typedef std::multimap<Anope::string, User *> MaskIndex;
+/* Keyed on the address family followed by the address in network byte order */
+typedef std::multimap<std::string, User *> AddressIndex;
+
+struct UserIndexEntry
+{
+	std::vector<std::pair<MaskIndex *, MaskIndex::iterator> > masks;
+	AddressIndex::iterator address;
+	bool has_address;
+};
+
+static MaskIndex NickIndex, IdentIndex, HostIndex, ReverseHostIndex;
+static AddressIndex AddressIndexMap;
+static std::map<User *, UserIndexEntry> UserIndexEntries;
+
+static Anope::string Reverse(const Anope::string &str)
+{
+	return std::string(str.str().rbegin(), str.str().rend());
+}
+
+static bool AddressKey(const sockaddrs &addr, std::string &key, unsigned &bits)
+{
+	if (addr.sa.sa_family == AF_INET)
+	{
+		key.assign(1, '4');
+		key.append(reinterpret_cast<const char *>(&addr.sa4.sin_addr), 4);
+		bits = 32;
+	}
+	else if (addr.sa.sa_family == AF_INET6)
+	{
+		key.assign(1, '6');
+		key.append(reinterpret_cast<const char *>(&addr.sa6.sin6_addr), 16);
+		bits = 128;
+	}
+	else
+		return false;
+
+	return true;
+}
+
+/* Whether the first len bits of two address keys are equal */
+static bool SamePrefix(const std::string &key, const std::string &net, unsigned len)
+{
+	if (key.length() != net.length() || key.compare(0, 1 + len / 8, net, 0, 1 + len / 8))
+		return false;
+
+	unsigned bits = len % 8;
+	if (bits)
+	{
+		unsigned char mask = 0xFF << (8 - bits);
+		if ((key[1 + len / 8] & mask) != (net[1 + len / 8] & mask))
+			return false;
+	}
+
+	return true;
+}
+
+static void IndexMask(UserIndexEntry &entry, MaskIndex &index, const Anope::string &key, User *u)
+{
+	entry.masks.push_back(std::make_pair(&index, index.insert(std::make_pair(key, u))));
+}
+
+static void FindExact(const MaskIndex &index, const Anope::string &key, std::set<User *> &users)
+{
+	std::pair<MaskIndex::const_iterator, MaskIndex::const_iterator> range = index.equal_range(key);
+	for (; range.first != range.second; ++range.first)
+		users.insert(range.first->second);
+}
+
+static void FindPrefix(const MaskIndex &index, const Anope::string &prefix, std::set<User *> &users)
+{
+	for (MaskIndex::const_iterator it = index.lower_bound(prefix), it_end = index.end(); it != it_end && !it->first.str().compare(0, prefix.length(), prefix.str()); ++it)
+		users.insert(it->second);
+}
+
+/* The literal text of a mask before its first and after its last wildcard */
+static bool Literals(const Anope::string &mask, Anope::string &prefix, Anope::string &suffix)
+{
+	size_t first = mask.find_first_of("*?"), last = mask.find_last_of("*?");
+	if (first == Anope::string::npos)
+	{
+		prefix = suffix = mask.lower();
+		return true;
+	}
+
+	prefix = mask.substr(0, first).lower();
+	suffix = mask.substr(last + 1).lower();
+	return false;
+}
+
+/* Parses host as a CIDR range, len is 0 if it is one but can not be narrowed down */
+static bool ParseCIDR(const Anope::string &host, Anope::string &ip, std::string &net, unsigned &len)
+{
+	size_t sl = host.rfind('/');
+	if (sl == Anope::string::npos)
+		return false;
+
+	ip = host.substr(0, sl);
+	const Anope::string &range = host.substr(sl + 1);
+	if (ip.empty() || range.empty() || !range.is_pos_number_only())
+		return false;
+
+	try
+	{
+		sockaddrs addr(ip);
+		unsigned bits;
+		if (!AddressKey(addr, net, bits))
+			return false;
+
+		len = convertTo<unsigned>(range);
+		if (len > bits)
+			len = 0;
+	}
+	catch (const SocketException &)
+	{
+		return false;
+	}
+	catch (const ConvertException &)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+void UserIndex::Update(User *u)
+{
+	Remove(u);
+
+	UserIndexEntry &entry = UserIndexEntries[u];
+	entry.has_address = false;
+
+	IndexMask(entry, NickIndex, u->nick.lower(), u);
+
+	IndexMask(entry, IdentIndex, u->GetIdent().lower(), u);
+	if (!u->GetVIdent().equals_ci(u->GetIdent()))
+		IndexMask(entry, IdentIndex, u->GetVIdent().lower(), u);
+
+	std::set<Anope::string> hosts;
+	hosts.insert(u->host.lower());
+	if (!u->vhost.empty())
+		hosts.insert(u->vhost.lower());
+	if (!u->chost.empty())
+		hosts.insert(u->chost.lower());
+	if (!u->ip.empty())
+		hosts.insert(u->ip.lower());
+	for (std::set<Anope::string>::iterator it = hosts.begin(), it_end = hosts.end(); it != it_end; ++it)
+	{
+		IndexMask(entry, HostIndex, *it, u);
+		IndexMask(entry, ReverseHostIndex, Reverse(*it), u);
+	}
+
+	if (!u->ip.empty())
+	{
+		try
+		{
+			sockaddrs addr(u->ip);
+			std::string key;
+			unsigned bits;
+			if (AddressKey(addr, key, bits))
+			{
+				entry.address = AddressIndexMap.insert(std::make_pair(key, u));
+				entry.has_address = true;
+			}
+		}
+		catch (const SocketException &) { }
+	}
+}
+
+void UserIndex::Remove(User *u)
+{
+	std::map<User *, UserIndexEntry>::iterator it = UserIndexEntries.find(u);
+	if (it == UserIndexEntries.end())
+		return;
+
+	UserIndexEntry &entry = it->second;
+	for (unsigned i = 0; i < entry.masks.size(); ++i)
+		entry.masks[i].first->erase(entry.masks[i].second);
+	if (entry.has_address)
+		AddressIndexMap.erase(entry.address);
+
+	UserIndexEntries.erase(it);
+}
+
+void UserIndex::Find(const Anope::string &nick, const Anope::string &ident, const Anope::string &host, std::set<User *> &users)
+{
+	Anope::string nick_prefix, nick_suffix, ident_prefix, ident_suffix, host_prefix, host_suffix, cidr_ip;
+	bool nick_exact = !nick.empty() && Literals(nick, nick_prefix, nick_suffix),
+		ident_exact = !ident.empty() && Literals(ident, ident_prefix, ident_suffix),
+		host_exact = false, host_cidr = false;
+	std::string net;
+	unsigned cidr_len = 0;
+
+	if (!host.empty())
+	{
+		if (ParseCIDR(host, cidr_ip, net, cidr_len))
+			host_cidr = cidr_len > 0;
+		else
+			host_exact = Literals(host, host_prefix, host_suffix);
+	}
+
+	/* Prefer whatever is likely to narrow things down the most: an exact nick or
+	 * host, then an address range, then an exact ident, then the longest literal
+	 * text any of the masks start or end with.
+	 */
+	if (nick_exact)
+		FindExact(NickIndex, nick_prefix, users);
+	else if (host_exact)
+		FindExact(HostIndex, host_prefix, users);
+	else if (host_cidr)
+	{
+		std::string start = net;
+		for (unsigned i = cidr_len; i < (net.length() - 1) * 8; ++i)
+			start[1 + i / 8] &= ~(0x80 >> (i % 8));
+
+		for (AddressIndex::const_iterator it = AddressIndexMap.lower_bound(start), it_end = AddressIndexMap.end(); it != it_end && SamePrefix(it->first, net, cidr_len); ++it)
+			users.insert(it->second);
+
+		/* Bans also compare the address itself against hosts, and akills the whole mask */
+		FindExact(HostIndex, cidr_ip.lower(), users);
+		FindExact(HostIndex, host.lower(), users);
+	}
+	else if (ident_exact)
+		FindExact(IdentIndex, ident_prefix, users);
+	else if (!nick_prefix.empty() || !ident_prefix.empty() || !host_prefix.empty() || !host_suffix.empty())
+	{
+		size_t longest = std::max(std::max(nick_prefix.length(), ident_prefix.length()), std::max(host_prefix.length(), host_suffix.length()));
+
+		if (host_suffix.length() == longest)
+			FindPrefix(ReverseHostIndex, Reverse(host_suffix), users);
+		else if (host_prefix.length() == longest)
+			FindPrefix(HostIndex, host_prefix, users);
+		else if (nick_prefix.length() == longest)
+			FindPrefix(NickIndex, nick_prefix, users);
+		else
+			FindPrefix(IdentIndex, ident_prefix, users);
+	}
+	else
+		for (user_map::const_iterator it = UserListByNick.begin(), it_end = UserListByNick.end(); it != it_end; ++it)
+			users.insert(it->second);
+}
+
+void UserIndex::Find(const Anope::string &mask, std::set<User *> &users)
+{
+	Entry e("", mask);
+	Find(e.nick, e.user, e.cidr_len ? e.host + "/" + stringify(e.cidr_len) : e.host, users);
+}
+
+const std::set<User *> &UserIndex::FindByMode(const Anope::string &mname)
+{
+	return UserModeIndex[mname];
+}